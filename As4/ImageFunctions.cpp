@@ -126,6 +126,33 @@ std::vector<unsigned char> GrayScaleImage(std::vector<unsigned char> img, unsign
 	return grayscaled;
 }
 
+std::vector<unsigned char> ResizeGrayScaleImage(const std::vector<unsigned char>& img, unsigned int w, unsigned int h) {
+	// Calculate new width and height
+	int new_w = floor(w / 4);
+	int new_h = floor(h / 4);
+	// Only the grayscaled image is allocated
+	std::vector<unsigned char> grayscaled(new_w * new_h);
+
+	// Start the timer
+	timer_struct timer;
+	QueryPerformanceFrequency(&timer.freq);
+	QueryPerformanceCounter(&timer.start);
+
+	// Only every fourth row and column of the original image is read
+	for (int y = 0; y < new_h; y++) {
+		for (int x = 0; x < new_w; x++) {
+			int dy = y * h / new_h;
+			int dx = x * w / new_w;
+			int coord = (dx+dy*w)*4;
+			grayscaled[y*new_w+x] = img[coord]*0.299 + img[coord + 1]*0.587 + img[coord + 2]*0.114;
+		}
+	}
+	// Stop the timer
+	std::string action = "Image downscaled and grayscaled.";
+	stopTimer(timer, action);
+	return grayscaled;
+}
+
 std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::vector<unsigned char> img_right, unsigned int w, unsigned int h, int min_disparity, int max_disparity) {
 	/* Sources:
 	* Pseudocode + formula from the assignment's document
@@ -27,21 +27,16 @@ int main() {
 	im1 = ReadImage("im1.png", w, h, LCT_RGBA);
 	if (im1.size() < 1) return 1;
 
-	// Resize both images
-	printf("Donwscaling im0.png by four.");
-	im0 = ResizeImage(im0, w, h);
-	printf("Donwscaling im1.png by four.");
-	im1 = ResizeImage(im1, w, h);
+	// Downscale and grayscale both images in one pass
+	printf("Downscaling and grayscaling im0.png\n");
+	im0_grey = ResizeGrayScaleImage(im0, w, h);
+	printf("Downscaling and grayscaling im1.png\n");
+	im1_grey = ResizeGrayScaleImage(im1, w, h);
 	
 	// Update image width and height according to the resizing
 	w = floor(w / 4);
 	h = floor(h / 4);
 	
-	// Grayscale the images
-	printf("Grayscaling im0.png\n");
-	im0_grey = GrayScaleImage(im0, w, h);
-	printf("Grayscaling im1.png\n");
-	im1_grey = GrayScaleImage(im1, w, h);
 	// Save the resulting images
 	if (!WriteImage("im0_grey.png", im0_grey, w, h, LCT_GREY)) return 1;
 	if (!WriteImage("im1_grey.png", im1_grey, w, h, LCT_GREY)) return 1;
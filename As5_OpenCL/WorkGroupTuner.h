@@ -0,0 +1,79 @@
+#ifndef WORKGROUPTUNER_H_INCLUDED
+#define WORKGROUPTUNER_H_INCLUDED
+
+/*********************************************************
+* PICKS THE FASTEST WORK-GROUP SIZE OF EVERY KERNEL
+* Candidates are timed with profiling events, and the winners are kept in a tuning file per device
+*********************************************************/
+
+#include <map>
+#include <string>
+#include <functional>
+// OpenCL include
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif // __APPLE__
+
+#define TUNER_RUNS 3 // Every candidate is run this many times, and the fastest run counts
+#define TUNER_MAX_CANDIDATES 16 // Largest number of local sizes tried for one kernel
+
+/*
+* \brief Enqueues the kernel being tuned once with the given local size, setting any argument that depends on it
+* \param local_size Local work size to use
+* \param event Event of the kernel is returned here
+* \return OpenCL error code of the enqueue
+*/
+typedef std::function<cl_int(const size_t local_size[2], cl_event* event)> tuner_launch;
+
+/*
+* \brief Finds the fastest local work size of 2D kernels on one device. Candidates fit CL_DEVICE_MAX_WORK_GROUP_SIZE,
+* CL_KERNEL_WORK_GROUP_SIZE and CL_DEVICE_MAX_WORK_ITEM_SIZES, and ones that are whole multiples of
+* CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE are tried first. The command queue must have profiling enabled.
+* Results are saved to a file named after the device and its driver, so every later run uses them without tuning
+*/
+class WorkGroupTuner {
+public:
+	/*
+	* \brief Loads the tuning file of the device, if there is one
+	* \param device_id Device the kernels run on
+	* \param tuning_dir Directory of the tuning files. Created if missing
+	*/
+	WorkGroupTuner(cl_device_id device_id, const char* tuning_dir);
+
+	/*
+	* \brief Returns the local size of a kernel. Tunes it if this key has not been tuned on this device yet
+	* \param kernel Kernel being tuned
+	* \param key Name of the kernel and anything else that changes its speed, like build options. The global size is added to it
+	* \param global_size Global work size the kernel will be run with
+	* \param uniform true if every local size must divide global_size, i.e. the kernel does not check if it is outside the image.
+	* If false, launch has to round the global size up to whole work-groups
+	* \param launch Enqueues the kernel with a given local size on a command queue with profiling enabled. Nothing else may run on the same buffers
+	* \param local_size The result is stored here
+	* \return Nothing
+	*/
+	void LocalSize(cl_kernel kernel, const std::string& key, const size_t global_size[2], bool uniform,
+		const tuner_launch& launch, size_t local_size[2]);
+
+	/*
+	* \brief Same as above for kernels whose arguments are already set, launched as is with global_size
+	*/
+	void LocalSize(cl_command_queue cmd_q, cl_kernel kernel, const std::string& key, const size_t global_size[2], size_t local_size[2]);
+
+private:
+	typedef struct {
+		size_t local_size[2];
+		double milliseconds;
+	} tuned_size;
+
+	void Load();
+	void Save() const;
+
+	cl_device_id device_id;
+	std::string file_name;
+	std::map<std::string, tuned_size> tuned;
+};
+
+
+#endif
@@ -13,6 +13,7 @@
 #include "lodepng.h"
 #include "ImageFunctions.h"
 #include "OpenCLFunctions.h"
+#include "WorkGroupTuner.h"
 #include <algorithm>
 
 
@@ -31,6 +32,9 @@
 #define KERNEL_NORMALIZE_FILE_NAME "kernels/normalize.cl"
 #define KERNEL_NORMALIZE "normalize_img"
 
+#define AUTOTUNE_WORK_GROUPS 1 // Time the work-group sizes of the kernels on the first run. If 0, every kernel uses 1x1
+#define TUNING_DIR "tuning" // Tuned work-group sizes are saved here, one file per device
+
 int main() {
 	// Image width and height. Both input images are the same size
 	unsigned w = 2940;
@@ -96,7 +100,11 @@ int main() {
 	size_t region[3] = { new_w, new_h, 1 };
 	// Kernel workgroup sizes
 	size_t global_work_size[] = { new_w, new_h }; // Use the downscaled image height and width
-	size_t local_work_size[] = { 1, 1 };
+	size_t resize_local[] = { 1, 1 };
+	size_t zncc_local[] = { 1, 1 };
+	size_t cross_local[] = { 1, 1 };
+	size_t fill_local[] = { 1, 1 };
+	size_t normalize_local[] = { 1, 1 };
 
 	// Load Kernel sources into memory
 	kernel_source resize_grayscale_src = loadKernel(KERNEL_RESIZE_GRAYSCALE_FILE_NAME);
@@ -125,6 +133,8 @@ int main() {
 	printf("Creating command queue\n");
 	cmd_q = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err_num);
 	if (!errorCheck(err_num)) return 1;
+	// Work-group sizes are tuned on the first run and read from the tuning file after that
+	WorkGroupTuner tuner(device_id, TUNING_DIR);
 
 	// Create the resize & grayscale kernel
 	kernel = createKernel(context, device_id, KERNEL_RESIZE_GRAYSCALE, (const char**)&resize_grayscale_src.source_str, (const size_t*)&resize_grayscale_src.source_size);
@@ -162,9 +172,12 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &im0_gray_cl);
 	if (!errorCheck(err_num)) return 1;
 
+	// Find the fastest work-group size
+	if (AUTOTUNE_WORK_GROUPS) tuner.LocalSize(cmd_q, kernel, KERNEL_RESIZE_GRAYSCALE, global_work_size, resize_local);
+
 	// Execute the Kernel
 	printf("Executing the resize and grayscale Kernel for im0\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, resize_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -190,7 +203,7 @@ int main() {
 
 	// Execute the Kernel
 	printf("Executing the resize and grayscale Kernel for im1\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, resize_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -247,9 +260,12 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 8, sizeof(int), &max_disparity);
 	if (!errorCheck(err_num)) return 1;
 
+	// Find the fastest work-group size. The same size is used for both directions
+	if (AUTOTUNE_WORK_GROUPS) tuner.LocalSize(cmd_q, kernel, KERNEL_CALCZNCC, global_work_size, zncc_local);
+
 	// Execute the Kernel
 	printf("Executing the CalcZNCC Kernel for im0=left & im1=right\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, zncc_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -280,7 +296,7 @@ int main() {
 
 	// Execute the Kernel
 	printf("Executing the CalcZNCC Kernel for im0=left & im1=right\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, zncc_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -315,9 +331,12 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &threshold);
 	if (!errorCheck(err_num)) return 1;
 
+	// Find the fastest work-group size
+	if (AUTOTUNE_WORK_GROUPS) tuner.LocalSize(cmd_q, kernel, KERNEL_CROSS_CHECK, global_work_size, cross_local);
+
 	// Execute the Kernel
 	printf("Executing the CrossCheck Kernel\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, cross_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -350,9 +369,12 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &new_h);
 	if (!errorCheck(err_num)) return 1;
 
+	// Find the fastest work-group size
+	if (AUTOTUNE_WORK_GROUPS) tuner.LocalSize(cmd_q, kernel, KERNEL_OCCLUSION_FILL, global_work_size, fill_local);
+
 	// Execute the Kernel
 	printf("Executing the Occlusion Fill Kernel\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, fill_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -390,9 +412,12 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &max);
 	if (!errorCheck(err_num)) return 1;
 	
+	// Find the fastest work-group size
+	if (AUTOTUNE_WORK_GROUPS) tuner.LocalSize(cmd_q, kernel, KERNEL_NORMALIZE, global_work_size, normalize_local);
+
 	// Execute the Kernel
 	printf("Executing the Normalization Kernel on dmap0\n");;
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, normalize_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -420,7 +445,7 @@ int main() {
 
 	// Execute the Kernel
 	printf("Executing the Normalization Kernel on dmap1\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, normalize_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -448,7 +473,7 @@ int main() {
 
 	// Execute the Kernel
 	printf("Executing the Normalization Kernel on Cross Check image\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, normalize_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -476,7 +501,7 @@ int main() {
 
 	// Execute the Kernel
 	printf("Executing the Normalization Kernel on Occlusion Fill image\n");
-	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, normalize_local, 0, NULL, &event);
 	if (!errorCheck(err_num)) return 1;
 	// Wait for execution to finish
 	clWaitForEvents(1, &event);
@@ -111,6 +111,29 @@ std::vector<unsigned char> GrayScaleImage(std::vector<unsigned char> img, unsign
 	return grayscaled;
 }
 
+std::vector<unsigned char> ResizeGrayScaleImage(const std::vector<unsigned char>& img, unsigned int w, unsigned int h) {
+	timer_struct timer = {};
+	// Calculate new width and height
+	unsigned new_w = floor(w / 4);
+	unsigned new_h = floor(h / 4);
+	// Only the grayscaled image is allocated
+	std::vector<unsigned char> grayscaled(new_w * new_h);
+
+	StartTimer(&timer);
+	// Only every fourth row and column of the original image is read
+	#pragma omp parallel for
+	for (int y = 0; y < new_h; y++) {
+		for (int x = 0; x < new_w; x++) {
+			int dy = y * h / new_h;
+			int dx = x * w / new_w;
+			int coord = (dx + dy * w) * 4;
+			grayscaled[y * new_w + x] = img[coord] * 0.299 + img[coord + 1] * 0.587 + img[coord + 2] * 0.114;
+		}
+	}
+	StopTimer(&timer, "Image resized and grayscaled");
+	return grayscaled;
+}
+
 std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::vector<unsigned char> img_right, unsigned int w, unsigned int h, int window_y, int window_x, int min_disparity, int max_disparity) {
 	std::vector<unsigned char> disparity_map(w * h);
 	int window_size = window_y * window_x; // Size of the whole window
@@ -52,6 +52,16 @@ std::vector<unsigned char> ResizeImage(std::vector<unsigned char> img, unsigned
 */
 std::vector<unsigned char> GrayScaleImage(std::vector<unsigned char> img, unsigned int w, unsigned int h);
 
+/*
+* \brief Downscales the given RGBA image by 4 and grayscales it in one pass. Gives the same result as ResizeImage followed by GrayScaleImage,
+* without the intermediate RGBA image
+* \param img Image to downscale
+* \param w Width of the original image
+* \param h Height of the original image
+* \return Downscaled and grayscaled image
+*/
+std::vector<unsigned char> ResizeGrayScaleImage(const std::vector<unsigned char>& img, unsigned int w, unsigned int h);
+
 /*
 * \brief Performs a Cross Check between the given left and right image
 * \param left Left image
@@ -21,29 +21,20 @@ int main() {
 	ReadImage(im1, "im1.png", w, h);
 	printf("\n");
 
-	// Resize the images
-	printf("Resizing im0.png\n");
-	std::vector<unsigned char> im0_resized = ResizeImage(im0, w, h);
-	printf("Resizing im1.png\n");
-	std::vector<unsigned char> im1_resized = ResizeImage(im1, w, h);
+	// Resize and grayscale the images in one pass
+	printf("Resizing and grayscaling im0.png\n");
+	std::vector<unsigned char> im0_gray = ResizeGrayScaleImage(im0, w, h);
+	printf("Resizing and grayscaling im1.png\n");
+	std::vector<unsigned char> im1_gray = ResizeGrayScaleImage(im1, w, h);
 	printf("\n");
 
 	// Update image dimentions to match the resizing
 	w = floor(w / 4);
 	h = floor(h / 4);
 
-	// Grayscale the images
-	printf("Grayscaling im0.png\n");
-	std::vector<unsigned char> im0_gray = GrayScaleImage(im0_resized, w, h);
-	printf("Grayscaling im1.png\n");
-	std::vector<unsigned char> im1_gray = GrayScaleImage(im1_resized, w, h);
-	printf("\n");
-
-	// Free the resized and original images
+	// Free the original images
 	FreeImageVector(im0);
 	FreeImageVector(im1);
-	FreeImageVector(im0_resized);
-	FreeImageVector(im1_resized);
 
 	// Calculate ZNCC
 	printf("Calculating ZNCC, left=im0, right=im1\n");
@@ -1,11 +1,15 @@
 #include <vector>
 #include <math.h>
 #include <algorithm>
-#include <thread>
+#include <mutex>
+#include <atomic>
 #include "lodepng.h"
 #include "ImageFunctions.h"
+#include "ThreadPool.h"
 #include "Timer.h"
 
+#define ROW_GRAIN 16 // Rows handed to a pool thread at once by the light stages
+
 
 void FreeImageVector(std::vector<unsigned char>& img_vector) {
 	/* Sources:
@@ -76,20 +80,22 @@ std::vector<unsigned char> ResizeImage(std::vector<unsigned char> img, unsigned
 	std::vector<unsigned char> new_img(new_w * new_h * 4);
 
 	StartTimer(&timer);
-	// Drop the pixels
-	for (int y = 0; y < new_h; y++) {
-		for (int x = 0; x < new_w; x++) {
-			int dy = y * h / new_h;
-			int dx = x * w / new_w;
-			int coord = (dx + dy * w) * 4;
-			int coord_new = (y * new_w + x) * 4;
+	// Drop the pixels, rows are split between the pool threads
+	GetThreadPool().ParallelFor(0, new_h, ROW_GRAIN, [&](int y0, int y1) {
+		for (int y = y0; y < y1; y++) {
+			for (int x = 0; x < new_w; x++) {
+				int dy = y * h / new_h;
+				int dx = x * w / new_w;
+				int coord = (dx + dy * w) * 4;
+				int coord_new = (y * new_w + x) * 4;
 
-			new_img[coord_new] = img[coord];
-			new_img[coord_new + 1] = img[coord + 1];
-			new_img[coord_new + 2] = img[coord + 2];
-			new_img[coord_new + 3] = img[coord + 3];
+				new_img[coord_new] = img[coord];
+				new_img[coord_new + 1] = img[coord + 1];
+				new_img[coord_new + 2] = img[coord + 2];
+				new_img[coord_new + 3] = img[coord + 3];
+			}
 		}
-	}
+	});
 	StopTimer(&timer, "Image resized");
 	return new_img;
 }
@@ -98,19 +104,32 @@ std::vector<unsigned char> GrayScaleImage(std::vector<unsigned char> img, unsign
 	timer_struct timer = {};
 	// Initialize a vector for the grayscaled image
 	std::vector<unsigned char> grayscaled(w * h); // Resulting image only has one value per pixel
-	unsigned int ind = 0; // Counter for current index in resulting image
 
 	StartTimer(&timer);
 	// Perform the grayscaling
-	for (int i = 0; i < w * h * 4; i += 4) {
-		grayscaled[ind] = img[i] * 0.299 + img[i + 1] * 0.587 + img[i + 2] * 0.114;
-		ind += 1;
-	}
+	GetThreadPool().ParallelFor(0, h, ROW_GRAIN, [&](int y0, int y1) {
+		for (int ind = y0 * w; ind < y1 * w; ind++) {
+			int i = ind * 4;
+			grayscaled[ind] = img[i] * 0.299 + img[i + 1] * 0.587 + img[i + 2] * 0.114;
+		}
+	});
 	StopTimer(&timer, "Image grayscaled");
 	return grayscaled;
 }
 
-void getBestDisparityThread(std::vector<unsigned char>& disparity_map, std::vector<unsigned char> img_left, std::vector<unsigned char> img_right,
+/*
+* \brief Calculates the best disparity for every pixel on rows [y0, y1). Called by the pool threads of CalcZNCC
+*/
+static void getBestDisparityRows(std::vector<unsigned char>& disparity_map, const std::vector<unsigned char>& img_left, const std::vector<unsigned char>& img_right,
+	int y0, int y1, int window_y, int window_x, unsigned int w, unsigned int h, int min_disparity, int max_disparity) {
+	for (int y = y0; y < y1; y++) {
+		for (int x = 0; x < w; x++) {
+			getBestDisparity(disparity_map, img_left, img_right, y, x, window_y, window_x, w, h, min_disparity, max_disparity);
+		}
+	}
+}
+
+void getBestDisparity(std::vector<unsigned char>& disparity_map, const std::vector<unsigned char>& img_left, const std::vector<unsigned char>& img_right,
 	int y, int x, int window_y, int window_x, unsigned int w, unsigned int h, int min_disparity, int max_disparity) {
 	
 	int window_size = window_y * window_x; // Size of the whole window
@@ -177,40 +196,14 @@ void getBestDisparityThread(std::vector<unsigned char>& disparity_map, std::vect
 
 std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::vector<unsigned char> img_right, unsigned int w, unsigned int h, int window_y, int window_x, int min_disparity, int max_disparity) {
 	std::vector<unsigned char> disparity_map(w * h);
-	std::vector<std::thread> threads; // Threads are stored here
-
-	int counter = 0; // For handling nnumber of concurrent threads
-	int window_size = window_y * window_x; // Size of the whole window
-
-	// Create a vector with all coordinates in the image, this will be used for by threads
-	std::vector<std::vector<int>> all_coords(h * w, std::vector<int>(2));
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			all_coords[y * w + x] = { y, x };
-		}
-	}
 
 	timer_struct timer;
 	StartTimer(&timer);
 
-	for (int i = 0; i < all_coords.size(); i++) {
-		threads.push_back(std::thread(getBestDisparityThread, std::ref(disparity_map), std::ref(img_left), std::ref(img_right), all_coords[i][0], all_coords[i][1], window_y, window_x, w, h, min_disparity, max_disparity));
-		counter += 1;
-		if (counter % 8 == 0) {
-			// Wait for the threads to finish
-			for (int i = 0; i < threads.size(); i++) {
-				threads[i].join();
-			}
-			// Remove completed threads
-			threads.clear();
-		}
-	}
-	// Stop and clear remaining threads
-	for (int i = 0; i < threads.size(); i++) {
-		threads[i].join();
-	}
-	threads.clear();
-
+	// Every pool thread takes one row at a time. The images are shared by reference, nothing is copied per pixel
+	GetThreadPool().ParallelFor(0, h, 1, [&](int y0, int y1) {
+		getBestDisparityRows(disparity_map, img_left, img_right, y0, y1, window_y, window_x, w, h, min_disparity, max_disparity);
+	});
 
 	StopTimer(&timer, "ZNCC calculated");
 	return disparity_map;
@@ -219,29 +212,30 @@ std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::ve
 std::vector<unsigned char> CrossCheck(std::vector<unsigned char> left, std::vector<unsigned char> right, unsigned int w, unsigned int h, unsigned int th) {
 	// Allocate memory for the result
 	std::vector<unsigned char> result(w * h);
-	int current_value;
 	// Start the timer
 	timer_struct timer;
 
 	StartTimer(&timer);
-	for (int i = 0; i < w * h; i++) {
-		// Compare absolute value of difference between left and right image to the given threshold
-		current_value = abs(left[i] - right[i]);
-		if (current_value > th) {
-			// Threshold exceeded, replacing pixel value with 0
-			result[i] = 0;
-		}
-		else {
-			// Add value from right image
-			result[i] = right[i];
+	GetThreadPool().ParallelFor(0, h, ROW_GRAIN, [&](int y0, int y1) {
+		for (int i = y0 * w; i < y1 * w; i++) {
+			// Compare absolute value of difference between left and right image to the given threshold
+			int current_value = abs(left[i] - right[i]);
+			if (current_value > th) {
+				// Threshold exceeded, replacing pixel value with 0
+				result[i] = 0;
+			}
+			else {
+				// Add value from right image
+				result[i] = right[i];
+			}
 		}
-	}
+	});
 	// Stop the timer
 	StopTimer(&timer, "Cross check done");
 	return result;
 }
 
-int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h, int y, int x) {
+int find_nearest(const std::vector<unsigned char>& dmap, unsigned int w, unsigned int h, int y, int x) {
 	int nh_size = 150;
 	int current_val;
 	for (int spread = 1; spread <= nh_size / 2; spread++) {
@@ -266,32 +260,39 @@ int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h
 
 std::vector<unsigned char> OcclusionFill(std::vector<unsigned char> cross, unsigned int w, unsigned int h) {
 	std::vector<unsigned char> result(w * h);
-	int current_val;
+	std::atomic<bool> failed(false);
 
 	// Start the timer
 	timer_struct timer;
 
 	StartTimer(&timer);
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			current_val = cross[y * w + x];
-			// Check if current pixel's value is zero
-			if (current_val != 0) {
-				// Not zero, use the pixels value
-				result[y * w + x] = current_val;
-			}
-			else {
-				// Pixel's value is zero, find nearest non zero value in the neighborhood
-				current_val = find_nearest(cross, w, h, y, x);
-				// Return empty image if no non-zero neighbor was found
-				if (current_val == -1) return std::vector<unsigned char>();
-				// Assign the new value
-				result[y * w + x] = current_val;
+	GetThreadPool().ParallelFor(0, h, ROW_GRAIN, [&](int y0, int y1) {
+		for (int y = y0; y < y1 && !failed; y++) {
+			for (int x = 0; x < w; x++) {
+				int current_val = cross[y * w + x];
+				// Check if current pixel's value is zero
+				if (current_val != 0) {
+					// Not zero, use the pixels value
+					result[y * w + x] = current_val;
+				}
+				else {
+					// Pixel's value is zero, find nearest non zero value in the neighborhood
+					current_val = find_nearest(cross, w, h, y, x);
+					// Stop if no non-zero neighbor was found
+					if (current_val == -1) {
+						failed = true;
+						break;
+					}
+					// Assign the new value
+					result[y * w + x] = current_val;
+				}
 			}
 		}
-	}
+	});
 	// Stop the timer
 	StopTimer(&timer, "Occlusion Fill done");
+	// Return empty image if no non-zero neighbor was found
+	if (failed) return std::vector<unsigned char>();
 	return result;
 }
 
@@ -302,14 +303,22 @@ std::vector<unsigned char> NormalizeImage(std::vector<unsigned char> dmap, unsig
 	timer_struct timer;
 
 	StartTimer(&timer);
-	// Get the maximum value of the map
-	unsigned int max = *std::max_element(dmap.begin(), dmap.end());
-	// Get the minimum value of the map
-	unsigned int min = *std::min_element(dmap.begin(), dmap.end());
+	// Get the minimum and maximum values of the map. Each range is reduced first, then merged
+	unsigned int min = 255, max = 0;
+	std::mutex min_max_mutex;
+	GetThreadPool().ParallelFor(0, h, ROW_GRAIN, [&](int y0, int y1) {
+		unsigned char range_min = *std::min_element(dmap.begin() + y0 * w, dmap.begin() + y1 * w);
+		unsigned char range_max = *std::max_element(dmap.begin() + y0 * w, dmap.begin() + y1 * w);
+		std::lock_guard<std::mutex> lock(min_max_mutex);
+		min = std::min(min, (unsigned int)range_min);
+		max = std::max(max, (unsigned int)range_max);
+	});
 	// Perform the normalization. Range [0-255]
-	for (int i = 0; i < w * h; i++) {
-		dmap[i] = 255 * (dmap[i] - min) / (max - min);
-	}
+	GetThreadPool().ParallelFor(0, h, ROW_GRAIN, [&](int y0, int y1) {
+		for (int i = y0 * w; i < y1 * w; i++) {
+			dmap[i] = 255 * (dmap[i] - min) / (max - min);
+		}
+	});
 	StopTimer(&timer, "Image normalized");
 	return dmap;
 }
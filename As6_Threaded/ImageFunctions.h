@@ -77,6 +77,24 @@ std::vector<unsigned char> CrossCheck(std::vector<unsigned char> left, std::vect
 */
 std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::vector<unsigned char> img_right, unsigned int w, unsigned int h, int window_y, int window_x, int min_disparity, int max_disparity);
 
+/*
+* \brief Calculates the best disparity of a single pixel and stores it to the disparity map. Called by CalcZNCC
+* \param disparity_map Result is stored here
+* \param img_left Left image
+* \param img_right Right image
+* \param y Current y coordinate
+* \param x Current x coordinate
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param w Image width
+* \param h Image height
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return Nothing
+*/
+void getBestDisparity(std::vector<unsigned char>& disparity_map, const std::vector<unsigned char>& img_left, const std::vector<unsigned char>& img_right,
+	int y, int x, int window_y, int window_x, unsigned int w, unsigned int h, int min_disparity, int max_disparity);
+
 /*
 * \brief Eliminates the zeros created by Cross Checking
 * \param cross Result of the Cross Checking
@@ -96,7 +114,7 @@ std::vector<unsigned char> OcclusionFill(std::vector<unsigned char> cross, unsig
 * \param x Current x coordinate
 * \return Non-zero value or -1 if failed to find
 */
-int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h, int y, int x);
+int find_nearest(const std::vector<unsigned char>& dmap, unsigned int w, unsigned int h, int y, int x);
 
 /*
 * \brief Normalizes the values of a disparity map making it look nicer
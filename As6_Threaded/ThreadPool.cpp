@@ -0,0 +1,83 @@
+#include <algorithm>
+#include "ThreadPool.h"
+
+/* Sources:
+* "Thread pooling in C++11" - https://stackoverflow.com/questions/15752659/thread-pooling-in-c11
+*/
+
+ThreadPool::ThreadPool(unsigned int thread_count) : job(NULL), next_index(0), end_index(0), grain_size(1), busy_workers(0), generation(0), stopping(false) {
+	// The thread calling ParallelFor is one of the workers
+	for (unsigned int i = 1; i < std::max(1u, thread_count); i++) {
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_ready.notify_all();
+	for (int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+unsigned int ThreadPool::Size() const {
+	return workers.size() + 1;
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+	if (end <= begin) return;
+	std::lock_guard<std::mutex> submit_lock(submit_mutex);
+	{
+		// Publish the job
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &body;
+		next_index = begin;
+		end_index = end;
+		grain_size = std::max(1, grain);
+		busy_workers = workers.size();
+		generation++;
+	}
+	work_ready.notify_all();
+
+	// Help with the ranges, then wait for the workers to finish theirs
+	RunRanges();
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [this] { return busy_workers == 0; });
+	job = NULL;
+}
+
+void ThreadPool::RunRanges() {
+	while (true) {
+		int start = next_index.fetch_add(grain_size);
+		if (start >= end_index) break;
+		(*job)(start, std::min(start + grain_size, end_index));
+	}
+}
+
+void ThreadPool::WorkerLoop() {
+	unsigned int seen_generation = 0;
+	while (true) {
+		{
+			// Sleep until there is a new job
+			std::unique_lock<std::mutex> lock(mutex);
+			work_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+			if (stopping) return;
+			seen_generation = generation;
+		}
+		RunRanges();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy_workers--;
+			if (busy_workers == 0) work_done.notify_one();
+		}
+	}
+}
+
+ThreadPool& GetThreadPool() {
+	// hardware_concurrency() may return 0 if it is not known
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	return pool;
+}
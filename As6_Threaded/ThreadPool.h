@@ -0,0 +1,71 @@
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*
+* \brief Fixed-size pool of worker threads. The threads are created once and reused by every ParallelFor call,
+* so no stage has to spawn its own threads
+*/
+class ThreadPool {
+public:
+	/*
+	* \brief Starts the worker threads
+	* \param thread_count Total number of threads working on a ParallelFor, including the calling thread
+	*/
+	explicit ThreadPool(unsigned int thread_count);
+
+	/*
+	* \brief Stops and joins the worker threads
+	*/
+	~ThreadPool();
+
+	/*
+	* \brief Splits [begin, end) into ranges of grain indices and runs body on them with all threads. The calling
+	* thread works too, and the call returns once every range is done. Calls from the body itself are not supported
+	* \param begin First index, for example the first image row
+	* \param end End of the indices, exclusive
+	* \param grain Number of indices handed out at once
+	* \param body Function called with the start and exclusive end of a range
+	* \return Nothing
+	*/
+	void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+	/*
+	* \brief Number of threads working on a ParallelFor, including the calling thread
+	*/
+	unsigned int Size() const;
+
+private:
+	void WorkerLoop();
+	void RunRanges();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::mutex submit_mutex; // Only one ParallelFor at a time
+	std::condition_variable work_ready;
+	std::condition_variable work_done;
+	// Current job
+	const std::function<void(int, int)>* job;
+	std::atomic<int> next_index;
+	int end_index;
+	int grain_size;
+	unsigned int busy_workers;
+	unsigned int generation; // Incremented for every job, so the workers know when a new one arrives
+	bool stopping;
+};
+
+/*
+* \brief Returns the pool shared by all pipeline stages. It is created on the first call and sized with
+* std::thread::hardware_concurrency()
+* \return The shared ThreadPool
+*/
+ThreadPool& GetThreadPool();
+
+
+#endif
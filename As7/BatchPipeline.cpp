@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <omp.h>
+#include "BatchPipeline.h"
+#include "ImageFunctions.h"
+#include "TileScheduler.h"
+#include "Timer.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#endif
+
+/* Sources:
+* "Producer-consumer problem" - https://en.wikipedia.org/wiki/Producer%E2%80%93consumer_problem
+*/
+
+typedef std::chrono::steady_clock steady_clock;
+
+static double SecondsSince(steady_clock::time_point start) {
+	return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+
+/*
+* \brief Queue of pairs between two stages. Push waits while the queue is full and Pop while it is empty, so a slow stage
+* holds back the one before it instead of letting decoded images pile up. The queue closes once every producer is done
+*/
+class BatchQueue {
+public:
+	BatchQueue(unsigned int capacity, unsigned int producers)
+		: capacity(std::max(1u, capacity)), producers(producers), occupancy_sum(0), max_size(0), push_wait(0), pop_wait(0) {
+		start = last_change = steady_clock::now();
+	}
+
+	void Push(std::unique_ptr<batch_pair> pair) {
+		std::unique_lock<std::mutex> lock(mutex);
+		steady_clock::time_point wait_start = steady_clock::now();
+		not_full.wait(lock, [&] { return pairs.size() < capacity; });
+		push_wait += SecondsSince(wait_start);
+		Count();
+		pairs.push_back(std::move(pair));
+		max_size = std::max(max_size, (unsigned int)pairs.size());
+		not_empty.notify_one();
+	}
+
+	/*
+	* \brief Takes the oldest pair. Returns NULL once the queue is closed and empty
+	*/
+	std::unique_ptr<batch_pair> Pop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		steady_clock::time_point wait_start = steady_clock::now();
+		not_empty.wait(lock, [&] { return !pairs.empty() || producers == 0; });
+		pop_wait += SecondsSince(wait_start);
+		if (pairs.empty()) return NULL;
+		Count();
+		std::unique_ptr<batch_pair> pair = std::move(pairs.front());
+		pairs.pop_front();
+		not_full.notify_one();
+		return pair;
+	}
+
+	void ProducerDone() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--producers == 0) not_empty.notify_all();
+	}
+
+	void PrintStats(const char* name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		Count();
+		double seconds = std::chrono::duration<double>(last_change - start).count();
+		printf("  %s queue: %.2f pairs on average, %u at most, capacity %u. Producers waited %.2f s, consumers %.2f s\n",
+			name, seconds > 0 ? occupancy_sum / seconds : 0, max_size, capacity, push_wait, pop_wait);
+	}
+
+private:
+	// Adds the time since the last change at the current size. Called with the mutex held, before the size changes
+	void Count() {
+		steady_clock::time_point now = steady_clock::now();
+		occupancy_sum += pairs.size() * std::chrono::duration<double>(now - last_change).count();
+		last_change = now;
+	}
+
+	std::deque<std::unique_ptr<batch_pair>> pairs;
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+	const unsigned int capacity;
+	unsigned int producers;
+
+	// Statistics
+	steady_clock::time_point start;
+	steady_clock::time_point last_change;
+	double occupancy_sum; // Pairs in the queue integrated over time, divided by the run time this is the average occupancy
+	unsigned int max_size;
+	double push_wait;
+	double pop_wait;
+};
+
+/*
+* \brief Time every stage spent working, summed over its threads
+*/
+typedef struct {
+	std::mutex mutex;
+	double busy;
+	unsigned int threads;
+} stage_stats;
+
+static void AddBusy(stage_stats& stats, double seconds) {
+	std::lock_guard<std::mutex> lock(stats.mutex);
+	stats.busy += seconds;
+}
+
+static bool FileExists(const std::string& path) {
+	FILE* fp = NULL;
+	if (fopen_s(&fp, path.c_str(), "rb") != 0 || fp == NULL) return false;
+	fclose(fp);
+	return true;
+}
+
+/*
+* \brief Lists the subdirectories of dir that have an im0.png and an im1.png, sorted by name
+*/
+static std::vector<std::string> ListPairs(const char* dir) {
+	std::vector<std::string> dirs;
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((std::string(dir) + "/*").c_str(), &entry);
+	if (find != INVALID_HANDLE_VALUE) {
+		do {
+			if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) dirs.push_back(entry.cFileName);
+		} while (FindNextFileA(find, &entry));
+		FindClose(find);
+	}
+#else
+	DIR* handle = opendir(dir);
+	if (handle != NULL) {
+		while (dirent* entry = readdir(handle)) dirs.push_back(entry->d_name);
+		closedir(handle);
+	}
+#endif
+	std::vector<std::string> pairs;
+	for (int i = 0; i < dirs.size(); i++) {
+		if (dirs[i] == "." || dirs[i] == "..") continue;
+		std::string path = std::string(dir) + "/" + dirs[i] + "/";
+		if (FileExists(path + "im0.png") && FileExists(path + "im1.png")) pairs.push_back(dirs[i]);
+	}
+	std::sort(pairs.begin(), pairs.end());
+	return pairs;
+}
+
+int RunBatch(const char* input_dir, const char* output_dir, const batch_config& config, const batch_compute& compute) {
+	std::vector<std::string> names = ListPairs(input_dir);
+	if (names.empty()) {
+		printf("No stereo pairs found in %s\n", input_dir);
+		return 1;
+	}
+	// Fails harmlessly if the directory already exists
+	make_dir(output_dir);
+	printf("Processing %d stereo pairs from %s: %u decode threads, %u compute workers with %u threads each, %u encode threads\n\n",
+		(int)names.size(), input_dir, config.decode_threads, config.compute_workers, config.threads_per_worker, config.encode_threads);
+
+	unsigned int decode_threads = std::max(1u, config.decode_threads);
+	unsigned int compute_workers = std::max(1u, config.compute_workers);
+	unsigned int encode_threads = std::max(1u, config.encode_threads);
+	BatchQueue decoded(config.queue_capacity, decode_threads);
+	BatchQueue computed(config.queue_capacity, compute_workers);
+	stage_stats decode_stats, compute_stats, encode_stats;
+	decode_stats.busy = compute_stats.busy = encode_stats.busy = 0;
+	decode_stats.threads = decode_threads;
+	compute_stats.threads = compute_workers;
+	encode_stats.threads = encode_threads;
+	std::atomic<int> next_pair(0), failed(0), done(0);
+	std::atomic<long long> pixels(0);
+	steady_clock::time_point start = steady_clock::now();
+
+	std::vector<std::thread> threads;
+	// Stage 1: decode the pairs in order
+	for (unsigned int i = 0; i < decode_threads; i++) {
+		threads.push_back(std::thread([&] {
+			for (int index; (index = next_pair++) < (int)names.size();) {
+				steady_clock::time_point work_start = steady_clock::now();
+				std::unique_ptr<batch_pair> pair(new batch_pair());
+				pair->index = index;
+				pair->name = names[index];
+				std::string path = std::string(input_dir) + "/" + pair->name + "/";
+				if (DecodeImage(pair->im0, (path + "im0.png").c_str()) || DecodeImage(pair->im1, (path + "im1.png").c_str())) {
+					printf("Failed to load pair %s, skipping it\n", pair->name.c_str());
+					AddBusy(decode_stats, SecondsSince(work_start));
+					failed++;
+					continue;
+				}
+				pixels += (long long)pair->im0.Width() * pair->im0.Height();
+				AddBusy(decode_stats, SecondsSince(work_start));
+				decoded.Push(std::move(pair));
+			}
+			decoded.ProducerDone();
+		}));
+	}
+	// Stage 2: compute, every worker on its own TileScheduler so the workers do not wait for each other's Run.
+	// The timings of the workers would mix their lines, so they are summed and printed at the end
+	std::mutex totals_mutex;
+	std::map<std::string, timer_total> timer_totals;
+	std::map<std::string, utilization_total> utilization_totals;
+	for (unsigned int i = 0; i < compute_workers; i++) {
+		threads.push_back(std::thread([&] {
+			std::map<std::string, timer_total> timers;
+			std::map<std::string, utilization_total> utilization;
+#ifdef _OPENMP
+			// The stages still using OpenMP (pyramid, temporal, SGM) would otherwise start a thread per core in every worker
+			omp_set_num_threads(std::max(1u, config.threads_per_worker));
+#endif
+			TileScheduler scheduler(config.threads_per_worker);
+			scheduler.CollectUtilization(&utilization);
+			SetThreadTileScheduler(&scheduler);
+			SetThreadTimerTotals(&timers);
+			while (std::unique_ptr<batch_pair> pair = decoded.Pop()) {
+				steady_clock::time_point work_start = steady_clock::now();
+				int err = compute(*pair);
+				// The originals are not needed anymore
+				pair->im0.Free();
+				pair->im1.Free();
+				AddBusy(compute_stats, SecondsSince(work_start));
+				if (err) {
+					printf("Failed to compute pair %s, skipping it\n", pair->name.c_str());
+					failed++;
+					continue;
+				}
+				computed.Push(std::move(pair));
+			}
+			SetThreadTimerTotals(NULL);
+			SetThreadTileScheduler(NULL);
+			scheduler.CollectUtilization(NULL);
+			{
+				std::lock_guard<std::mutex> lock(totals_mutex);
+				for (std::map<std::string, timer_total>::iterator it = timers.begin(); it != timers.end(); ++it) {
+					timer_totals[it->first].microseconds += it->second.microseconds;
+					timer_totals[it->first].count += it->second.count;
+				}
+				for (std::map<std::string, utilization_total>::iterator it = utilization.begin(); it != utilization.end(); ++it) {
+					utilization_total& total = utilization_totals[it->first];
+					total.run_seconds += it->second.run_seconds;
+					total.busy_seconds += it->second.busy_seconds;
+					total.threads = it->second.threads;
+					total.runs += it->second.runs;
+				}
+			}
+			computed.ProducerDone();
+		}));
+	}
+	// Stage 3: encode the outputs
+	for (unsigned int i = 0; i < encode_threads; i++) {
+		threads.push_back(std::thread([&] {
+			while (std::unique_ptr<batch_pair> pair = computed.Pop()) {
+				steady_clock::time_point work_start = steady_clock::now();
+				std::string path = std::string(output_dir) + "/" + pair->name;
+				make_dir(path.c_str());
+				bool ok = true;
+				for (int j = 0; j < pair->outputs.size(); j++) {
+					std::string filename = path + "/" + pair->outputs[j].first;
+					if (EncodeImage(pair->outputs[j].second, filename.c_str(), LCT_GREY, 8)) {
+						printf("Failed to save %s\n", filename.c_str());
+						ok = false;
+					}
+				}
+				AddBusy(encode_stats, SecondsSince(work_start));
+				if (ok) done++;
+				else failed++;
+			}
+		}));
+	}
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+	double seconds = SecondsSince(start);
+
+	printf("\nBatch done: %d pairs processed, %d failed, in %.2f s\n", (int)done, (int)failed, seconds);
+	printf("Throughput: %.2f pairs/s, %.2f megapixels/s of input\n", done / seconds, pixels / 1e6 / seconds);
+	const char* stage_names[] = { "Decode", "Compute", "Encode" };
+	stage_stats* stages[] = { &decode_stats, &compute_stats, &encode_stats };
+	for (int i = 0; i < 3; i++) {
+		printf("  %s stage: %.2f s busy over %u threads, %.1f%% utilization\n",
+			stage_names[i], stages[i]->busy, stages[i]->threads, 100 * stages[i]->busy / (stages[i]->threads * seconds));
+	}
+	decoded.PrintStats("Decode -> compute");
+	computed.PrintStats("Compute -> encode");
+	printf("Compute stage timings, summed over the workers:\n");
+	for (std::map<std::string, timer_total>::iterator it = timer_totals.begin(); it != timer_totals.end(); ++it) {
+		printf("  %s: %d times, %.2f ms on average\n", it->first.c_str(), it->second.count, it->second.microseconds / 1000.0 / it->second.count);
+	}
+	for (std::map<std::string, utilization_total>::iterator it = utilization_totals.begin(); it != utilization_totals.end(); ++it) {
+		const utilization_total& total = it->second;
+		double utilization = total.run_seconds > 0 ? 100 * total.busy_seconds / (total.run_seconds * total.threads) : 0;
+		printf("  %s: %d runs, %.1f%% thread utilization\n", it->first.c_str(), total.runs, utilization);
+	}
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef BATCHPIPELINE_H_INCLUDED
+#define BATCHPIPELINE_H_INCLUDED
+
+/*********************************************************
+* STREAMING BATCH DRIVER
+* Runs a directory of stereo pairs through three overlapping stages connected by bounded queues: decoding pair N + 1,
+* computing pair N and encoding pair N - 1 happen at the same time, every stage on its own threads
+*********************************************************/
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <functional>
+#include "Image.h"
+
+/*
+* \brief One stereo pair moving through the stages
+* \param index Position of the pair in the sorted input directory
+* \param name Name of the pair's directory, the outputs are saved to a directory of the same name
+* \param im0 Left RGBA image, filled by the decode stage
+* \param im1 Right RGBA image, filled by the decode stage
+* \param outputs 8-bit grayscale images the compute stage wants saved, and their file names
+*/
+typedef struct {
+	int index;
+	std::string name;
+	Image im0;
+	Image im1;
+	std::vector<std::pair<std::string, Image>> outputs;
+} batch_pair;
+
+/*
+* \brief Compute stage of the batch. Reads im0 and im1 of the pair and fills its outputs. Returns 0 if successful; 1 otherwise.
+* Several compute workers call it at the same time, each with its own pair
+*/
+typedef std::function<int(batch_pair&)> batch_compute;
+
+/*
+* \brief Thread budget of every stage and the size of the queues between them
+* \param decode_threads Threads decoding PNGs
+* \param compute_workers Pairs computed at the same time
+* \param threads_per_worker Size of the TileScheduler every compute worker runs its CPU stages on, and of the OpenMP loops of the
+* stages still using OpenMP (pyramid, temporal, SGM)
+* \param encode_threads Threads encoding PNGs
+* \param queue_capacity Pairs a queue holds before the stage filling it has to wait
+*/
+typedef struct {
+	unsigned int decode_threads;
+	unsigned int compute_workers;
+	unsigned int threads_per_worker;
+	unsigned int encode_threads;
+	unsigned int queue_capacity;
+} batch_config;
+
+/*
+* \brief Processes every subdirectory of input_dir that has an im0.png and an im1.png. The outputs of a pair are saved to
+* output_dir/<name>/. Pairs that fail to load or compute are reported and skipped, nothing waits for a key. Throughput,
+* how busy every stage was, how full the queues were and the timings of the compute stage are printed at the end
+* \param input_dir Directory of the pair directories
+* \param output_dir Directory the outputs are saved to. Created if missing
+* \param config Threads and queue sizes
+* \param compute Compute stage
+* \return 0 if every pair was processed; 1 otherwise
+*/
+int RunBatch(const char* input_dir, const char* output_dir, const batch_config& config, const batch_compute& compute);
+
+
+#endif
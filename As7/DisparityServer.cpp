@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "DisparityServer.h"
+
+#ifdef _WIN32
+// winsock2.h has to come before Windows.h. AF_UNIX sockets are available since Windows 10 1803
+#include <winsock2.h>
+#include <afunix.h>
+#include <Windows.h>
+#include <direct.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET socket_handle;
+#define close_socket(s) closesocket(s)
+#define SEND_FLAGS 0
+#define make_dir(path) _mkdir(path)
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <dirent.h>
+typedef int socket_handle;
+#define INVALID_SOCKET -1
+#define close_socket(s) close(s)
+#define SEND_FLAGS MSG_NOSIGNAL // A client that already hung up must not kill the server with SIGPIPE
+#define make_dir(path) mkdir(path, 0755)
+#endif
+
+#define SERVER_MAX_REQUEST 4096 // Longest request line a socket client can send
+#define SERVER_CLIENT_TIMEOUT_MS 5000 // A client that does not send its request in time is dropped, so it cannot stall the server
+
+/* Sources:
+* "AF_UNIX comes to Windows" - https://devblogs.microsoft.com/commandline/af_unix-comes-to-windows/
+* "unix(7) - Linux manual page" - https://man7.org/linux/man-pages/man7/unix.7.html
+*/
+
+typedef std::chrono::steady_clock steady_clock;
+
+/*
+* \brief Counters of the jobs served so far, and whether a client asked the server to stop
+*/
+typedef struct {
+	int jobs;
+	int failed;
+	double seconds;
+	bool quit;
+} server_stats;
+
+static bool FileExists(const std::string& path) {
+	FILE* fp = NULL;
+	if (fopen_s(&fp, path.c_str(), "rb") != 0 || fp == NULL) return false;
+	fclose(fp);
+	return true;
+}
+
+static void WriteTextFile(const std::string& path, const std::string& text) {
+	FILE* fp = NULL;
+	if (fopen_s(&fp, path.c_str(), "w") != 0 || fp == NULL) return;
+	fprintf(fp, "%s\n", text.c_str());
+	fclose(fp);
+}
+
+/*
+* \brief Lists the subdirectories of dir, sorted by name
+*/
+static std::vector<std::string> ListDirectories(const char* dir) {
+	std::vector<std::string> dirs;
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((std::string(dir) + "/*").c_str(), &entry);
+	if (find != INVALID_HANDLE_VALUE) {
+		do {
+			if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) dirs.push_back(entry.cFileName);
+		} while (FindNextFileA(find, &entry));
+		FindClose(find);
+	}
+#else
+	DIR* handle = opendir(dir);
+	if (handle != NULL) {
+		// Files are listed too, the callers only look for files inside the directories
+		while (dirent* entry = readdir(handle)) dirs.push_back(entry->d_name);
+		closedir(handle);
+	}
+#endif
+	dirs.erase(std::remove_if(dirs.begin(), dirs.end(), [](const std::string& name) { return name == "." || name == ".."; }), dirs.end());
+	std::sort(dirs.begin(), dirs.end());
+	return dirs;
+}
+
+/*
+* \brief Runs one job through the handler, timing it and printing the result
+*/
+static int RunJob(const server_handler& handler, const server_job& job, std::string* message, server_stats* stats) {
+	printf("Job: %s and %s to %s\n", job.im0.c_str(), job.im1.c_str(), job.output_dir.c_str());
+	steady_clock::time_point start = steady_clock::now();
+	int err = handler(job, message);
+	double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+	stats->jobs++;
+	stats->seconds += seconds;
+	if (err) stats->failed++;
+	printf("Job %s in %.1f ms: %s\n\n", err ? "failed" : "done", seconds * 1000, message->c_str());
+	return err;
+}
+
+/*
+* \brief Runs every spool job that is ready, and stops the server if a file named quit is in the spool directory
+*/
+static void ProcessSpool(const char* spool_dir, const server_handler& handler, server_stats* stats) {
+	std::string quit_file = std::string(spool_dir) + "/quit";
+	if (FileExists(quit_file)) {
+		remove(quit_file.c_str());
+		stats->quit = true;
+		return;
+	}
+	std::vector<std::string> dirs = ListDirectories(spool_dir);
+	for (int i = 0; i < dirs.size(); i++) {
+		std::string path = std::string(spool_dir) + "/" + dirs[i];
+		std::string ready_file = path + "/ready";
+		if (!FileExists(ready_file)) continue;
+		// Removed first, so a job is never run twice
+		remove(ready_file.c_str());
+		server_job job = { path + "/im0.png", path + "/im1.png", path };
+		std::string message;
+		int err = RunJob(handler, job, &message, stats);
+		WriteTextFile(path + (err ? "/failed" : "/done"), message);
+	}
+}
+
+/*
+* \brief Reads one request line from a socket client, runs it and sends the reply
+*/
+static void ServeClient(socket_handle client, const server_handler& handler, server_stats* stats) {
+	// Without a timeout a client that never sends anything would block every other job
+#ifdef _WIN32
+	DWORD timeout = SERVER_CLIENT_TIMEOUT_MS;
+#else
+	timeval timeout = { SERVER_CLIENT_TIMEOUT_MS / 1000, (SERVER_CLIENT_TIMEOUT_MS % 1000) * 1000 };
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+	std::string request;
+	char buffer[256];
+	while (request.find('\n') == std::string::npos && request.size() < SERVER_MAX_REQUEST) {
+		int received = recv(client, buffer, sizeof(buffer), 0);
+		if (received <= 0) break;
+		request.append(buffer, received);
+	}
+	request = request.substr(0, request.find('\n'));
+	if (!request.empty() && request[request.size() - 1] == '\r') request.erase(request.size() - 1);
+
+	std::string reply;
+	if (request == "QUIT") {
+		stats->quit = true;
+		reply = "OK stopping\n";
+	}
+	else {
+		// Tab separated, so the paths can have spaces
+		std::vector<std::string> fields;
+		for (size_t start = 0;;) {
+			size_t end = request.find('\t', start);
+			fields.push_back(request.substr(start, end - start));
+			if (end == std::string::npos) break;
+			start = end + 1;
+		}
+		if (fields.size() != 3) {
+			reply = "ERROR expected <im0 path>\\t<im1 path>\\t<output dir>\n";
+		}
+		else {
+			server_job job = { fields[0], fields[1], fields[2] };
+			std::string message;
+			int err = RunJob(handler, job, &message, stats);
+			reply = (err ? "ERROR " : "OK ") + message + "\n";
+		}
+	}
+	send(client, reply.c_str(), (int)reply.size(), SEND_FLAGS);
+	close_socket(client);
+}
+
+/*
+* \brief Creates a Unix domain socket listening at path. An old socket file left at path is removed first
+*/
+static socket_handle OpenSocket(const char* path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		printf("Socket path %s is too long\n", path);
+		return INVALID_SOCKET;
+	}
+	address.sun_family = AF_UNIX;
+	// The length was checked above, so the path fits with its terminating zero
+	memcpy(address.sun_path, path, strlen(path) + 1);
+	socket_handle listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET) {
+		printf("Failed to create the socket\n");
+		return INVALID_SOCKET;
+	}
+	remove(path);
+	if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+		printf("Failed to listen on %s\n", path);
+		close_socket(listener);
+		return INVALID_SOCKET;
+	}
+	return listener;
+}
+
+int RunServer(const char* socket_path, const char* spool_dir, int poll_ms, const server_handler& handler) {
+	if (socket_path == NULL && spool_dir == NULL) {
+		printf("The server needs a socket or a spool directory\n");
+		return 1;
+	}
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		printf("Failed to initialize Winsock\n");
+		return 1;
+	}
+#endif
+	socket_handle listener = INVALID_SOCKET;
+	if (socket_path != NULL) {
+		listener = OpenSocket(socket_path);
+		if (listener == INVALID_SOCKET) return 1;
+		printf("Listening on %s\n", socket_path);
+	}
+	if (spool_dir != NULL) {
+		// Fails harmlessly if the directory already exists
+		make_dir(spool_dir);
+		printf("Watching %s every %d ms\n", spool_dir, poll_ms);
+	}
+	printf("\n");
+
+	server_stats stats = { 0, 0, 0, false };
+	while (!stats.quit) {
+		if (spool_dir != NULL) ProcessSpool(spool_dir, handler, &stats);
+		if (stats.quit) break;
+		if (listener == INVALID_SOCKET) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+			continue;
+		}
+		// Wait for a client at most until the next spool check
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		FD_SET(listener, &read_set);
+		timeval timeout = { poll_ms / 1000, (poll_ms % 1000) * 1000 };
+		if (select((int)listener + 1, &read_set, NULL, NULL, &timeout) <= 0) continue;
+		socket_handle client = accept(listener, NULL, NULL);
+		if (client != INVALID_SOCKET) ServeClient(client, handler, &stats);
+	}
+
+	if (listener != INVALID_SOCKET) {
+		close_socket(listener);
+		remove(socket_path);
+	}
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	printf("Server stopped after %d jobs, %d failed", stats.jobs, stats.failed);
+	if (stats.jobs > 0) printf(", %.1f ms per job on average", stats.seconds * 1000 / stats.jobs);
+	printf("\n");
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef DISPARITYSERVER_H_INCLUDED
+#define DISPARITYSERVER_H_INCLUDED
+
+/*********************************************************
+* DISPARITY SERVER
+* Waits for stereo pair jobs on a local socket and in a spool directory, and hands them one at a time to a handler
+* that keeps its OpenCL objects between the jobs
+*********************************************************/
+
+#include <string>
+#include <functional>
+
+/*
+* \brief One stereo pair to compute
+* \param im0 Path of the left RGBA image
+* \param im1 Path of the right RGBA image
+* \param output_dir Directory the results are saved to
+*/
+typedef struct {
+	std::string im0;
+	std::string im1;
+	std::string output_dir;
+} server_job;
+
+/*
+* \brief Computes a job. Returns 0 if successful; 1 otherwise. The message is sent back to the client, for example the saved files or the error
+*/
+typedef std::function<int(const server_job&, std::string*)> server_handler;
+
+/*
+* \brief Serves jobs until a client sends QUIT or a file named quit appears in the spool directory. Jobs are run one at a time
+* in the calling thread, in the order they arrive. A socket client connects to socket_path, sends "<im0 path>\t<im1 path>\t<output dir>\n"
+* and gets back "OK <message>\n" or "ERROR <message>\n". A spool job is a directory in spool_dir with an im0.png, an im1.png
+* and a file named ready, which is written last. The results are saved to the job directory, and ready is replaced with done or
+* failed holding the message
+* \param socket_path Path of the Unix domain socket. NULL to only watch the spool directory
+* \param spool_dir Spool directory, created if missing. NULL to only listen on the socket
+* \param poll_ms How often the spool directory is checked, in milliseconds
+* \param handler Computes the jobs
+* \return 0 if the server was stopped; 1 if it could not be started
+*/
+int RunServer(const char* socket_path, const char* spool_dir, int poll_ms, const server_handler& handler);
+
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef IMAGE_H_INCLUDED
+#define IMAGE_H_INCLUDED
+
+/*********************************************************
+* IMAGE TYPES SHARED BY ALL IMAGE FUNCTIONS
+* ImageView and ImageSpan point to pixels owned by someone else, so passing them around never copies an image.
+* Image owns its pixels, which are aligned for SIMD loads
+*********************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+#define IMAGE_ALIGNMENT 64 // Cache line size, also enough for AVX-512 loads
+
+/*
+* \brief Read-only view to pixels owned by someone else. Pixel (x, y) channel c is data[y * stride + x * channels + c]
+* \tparam T Type of a single channel value
+* \param data First pixel
+* \param width Width in pixels
+* \param height Height in pixels
+* \param stride Distance between the starts of two rows, in values of T
+* \param channels Values per pixel, 1 for grayscale and 4 for RGBA
+*/
+template <typename T>
+struct ImageViewT {
+	const T* data;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int channels;
+
+	ImageViewT() : data(NULL), width(0), height(0), stride(0), channels(1) {}
+	/*
+	* \brief Creates a view. Stride defaults to tightly packed rows
+	*/
+	ImageViewT(const T* data, unsigned int width, unsigned int height, unsigned int channels = 1, unsigned int stride = 0)
+		: data(data), width(width), height(height), stride(stride ? stride : width * channels), channels(channels) {}
+
+	/*
+	* \brief Returns the first value of row y
+	*/
+	const T* Row(unsigned int y) const { return data + (size_t)y * stride; }
+	/*
+	* \brief Returns channel c of pixel (x, y)
+	*/
+	const T& At(unsigned int x, unsigned int y, unsigned int c = 0) const { return data[(size_t)y * stride + x * channels + c]; }
+	/*
+	* \brief Returns a view to rows [y0, y1) of this view. Nothing is copied
+	*/
+	ImageViewT Rows(unsigned int y0, unsigned int y1) const { return ImageViewT(Row(y0), width, y1 - y0, channels, stride); }
+	/*
+	* \brief True if rows are stored back to back, so the whole view is one block of width * height * channels values
+	*/
+	bool IsContiguous() const { return stride == width * channels; }
+	bool Empty() const { return data == NULL || width == 0 || height == 0; }
+};
+
+/*
+* \brief Writable view to pixels owned by someone else. Same layout as ImageViewT
+* \tparam T Type of a single channel value
+*/
+template <typename T>
+struct ImageSpanT {
+	T* data;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int channels;
+
+	ImageSpanT() : data(NULL), width(0), height(0), stride(0), channels(1) {}
+	ImageSpanT(T* data, unsigned int width, unsigned int height, unsigned int channels = 1, unsigned int stride = 0)
+		: data(data), width(width), height(height), stride(stride ? stride : width * channels), channels(channels) {}
+
+	T* Row(unsigned int y) const { return data + (size_t)y * stride; }
+	T& At(unsigned int x, unsigned int y, unsigned int c = 0) const { return data[(size_t)y * stride + x * channels + c]; }
+	ImageSpanT Rows(unsigned int y0, unsigned int y1) const { return ImageSpanT(Row(y0), width, y1 - y0, channels, stride); }
+	bool IsContiguous() const { return stride == width * channels; }
+	bool Empty() const { return data == NULL || width == 0 || height == 0; }
+	/*
+	* \brief A writable view can always be read
+	*/
+	operator ImageViewT<T>() const { return ImageViewT<T>(data, width, height, channels, stride); }
+};
+
+/*
+* \brief Image that owns its pixels. Rows are tightly packed and the first pixel is aligned to IMAGE_ALIGNMENT bytes.
+* Images can be moved but not copied, so a copy can only happen through an explicit Clone()
+* \tparam T Type of a single channel value
+*/
+template <typename T>
+class ImageT {
+public:
+	ImageT() : data(NULL), width(0), height(0), channels(1) {}
+	/*
+	* \brief Allocates a zero-filled image
+	*/
+	ImageT(unsigned int width, unsigned int height, unsigned int channels = 1) : data(NULL), width(0), height(0), channels(channels) {
+		Allocate(width, height, channels);
+	}
+	ImageT(ImageT&& other) : data(other.data), width(other.width), height(other.height), channels(other.channels) {
+		other.data = NULL;
+		other.width = other.height = 0;
+	}
+	ImageT& operator=(ImageT&& other) {
+		if (this != &other) {
+			Free();
+			std::swap(data, other.data);
+			width = other.width;
+			height = other.height;
+			channels = other.channels;
+			other.width = other.height = 0;
+		}
+		return *this;
+	}
+	ImageT(const ImageT&) = delete;
+	ImageT& operator=(const ImageT&) = delete;
+	~ImageT() { Free(); }
+
+	/*
+	* \brief Allocates new zero-filled storage. Old pixels are freed
+	*/
+	void Allocate(unsigned int new_width, unsigned int new_height, unsigned int new_channels = 1) {
+		Free();
+		size_t bytes = (size_t)new_width * new_height * new_channels * sizeof(T);
+		if (bytes == 0) return;
+#ifdef _MSC_VER
+		data = (T*)_aligned_malloc(bytes, IMAGE_ALIGNMENT);
+#else
+		void* ptr = NULL;
+		data = posix_memalign(&ptr, IMAGE_ALIGNMENT, bytes) == 0 ? (T*)ptr : NULL;
+#endif
+		if (data == NULL) return;
+		memset(data, 0, bytes);
+		width = new_width;
+		height = new_height;
+		channels = new_channels;
+	}
+	/*
+	* \brief Frees the pixels, leaving an empty image
+	*/
+	void Free() {
+#ifdef _MSC_VER
+		_aligned_free(data);
+#else
+		free(data);
+#endif
+		data = NULL;
+		width = height = 0;
+	}
+	/*
+	* \brief Explicit deep copy of a view
+	*/
+	static ImageT Clone(ImageViewT<T> src) {
+		ImageT out(src.width, src.height, src.channels);
+		for (unsigned int y = 0; y < src.height; y++) {
+			memcpy(out.Span().Row(y), src.Row(y), (size_t)src.width * src.channels * sizeof(T));
+		}
+		return out;
+	}
+
+	T* Data() { return data; }
+	const T* Data() const { return data; }
+	unsigned int Width() const { return width; }
+	unsigned int Height() const { return height; }
+	unsigned int Channels() const { return channels; }
+	/*
+	* \brief Number of values, width * height * channels
+	*/
+	size_t Size() const { return (size_t)width * height * channels; }
+	bool Empty() const { return data == NULL; }
+	T& operator[](size_t i) { return data[i]; }
+	const T& operator[](size_t i) const { return data[i]; }
+
+	ImageViewT<T> View() const { return ImageViewT<T>(data, width, height, channels); }
+	ImageSpanT<T> Span() { return ImageSpanT<T>(data, width, height, channels); }
+	operator ImageViewT<T>() const { return View(); }
+
+private:
+	T* data;
+	unsigned int width;
+	unsigned int height;
+	unsigned int channels;
+};
+
+typedef ImageViewT<unsigned char> ImageView;
+typedef ImageSpanT<unsigned char> ImageSpan;
+typedef ImageT<unsigned char> Image;
+// Disparity maps that can hold disparities above 255, like full resolution ones
+typedef ImageViewT<unsigned short> ImageView16;
+typedef ImageSpanT<unsigned short> ImageSpan16;
+typedef ImageT<unsigned short> Image16;
+// Disparity maps refined to a fraction of a pixel
+typedef ImageViewT<float> ImageViewF;
+typedef ImageSpanT<float> ImageSpanF;
+typedef ImageT<float> ImageF;
+
+
+#endif
@@ -1,57 +1,73 @@
 #include <vector>
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 #include "lodepng.h"
 #include "ImageFunctions.h"
+#include "TileScheduler.h"
 #include "Timer.h"
 
-#include <omp.h> // Include OpenMP. Also enabled in Visual Studio Compiler Settings
+#include <mutex>
+#include <atomic>
+#include <limits>
 
+#define TILE_WIDTH 64 // Tile size used by the stages running on the TileScheduler
+#define TILE_HEIGHT 32
 
-void FreeImageVector(std::vector<unsigned char>& img_vector) {
-	/* Sources:
-	* "How to clear vector in C++ from memory [duplicate]" - https://stackoverflow.com/questions/35514909/how-to-clear-vector-in-c-from-memory
-	*/
-	img_vector.clear();
-	img_vector.shrink_to_fit();
+
+void FreeImage(Image& img) {
+	img.Free();
 }
 
-int ReadImage(std::vector<unsigned char>& out, const char* filename, unsigned w, unsigned h) {
-	printf("Reading image %s with lodepng\n", filename);
-	// Initialize a temporary variable for the read image
+int DecodeImage(Image& out, const char* filename) {
 	unsigned char* temp = NULL;
+	unsigned w, h;
+	if (lodepng_decode32_file(&temp, &w, &h, filename)) return 1;
+	// Copy into aligned storage. This is the only copy the image goes through
+	out.Allocate(w, h, 4);
+	memcpy(out.Data(), temp, out.Size());
+	// According to the lodepng.h, this must be freed
+	free(temp);
+	return 0;
+}
+
+int ReadImage(Image& out, const char* filename) {
+	printf("Reading image %s with lodepng\n", filename);
 	timer_struct timer = {};
 
 	// Start counting execution time
 	StartTimer(&timer);
-	if (lodepng_decode32_file(&temp, &w, &h, filename)) {
+	if (DecodeImage(out, filename)) {
 		// Image loading failed!
 		printf("Failed to load the image!\n");
 		getchar();
-		// Reurn error code 1
+		// Return error code 1
 		return 1;
 	}
-	// Convert to std::vector
-	out = std::vector<unsigned char>(temp, temp + w * h * 4);
 	// Stop counting execution time
 	StopTimer(&timer, "Image loaded");
-	// According to the lodepng.h, this must be freed
-	free(temp);
 	// No error occured
 	return 0;
 }
 
-int WriteImage(std::vector<unsigned char> img, const char* filename, unsigned w, unsigned h, LodePNGColorType type, unsigned bitdepth) {
+int EncodeImage(ImageView img, const char* filename, LodePNGColorType type, unsigned bitdepth) {
+	Image packed;
+	// lodepng expects tightly packed rows, so only a strided view has to be copied
+	if (!img.IsContiguous()) {
+		packed = Image::Clone(img);
+		img = packed.View();
+	}
+	return lodepng_encode_file(filename, img.data, img.width, img.height, type, bitdepth) ? 1 : 0;
+}
+
+int WriteImage(ImageView img, const char* filename, LodePNGColorType type, unsigned bitdepth) {
 	printf("Saving %s\n", filename);
 	timer_struct timer = {};
 
 	// Start counting execution time
 	StartTimer(&timer);
-	// Convert img back to unsigned char*
-	unsigned char* img_arr = new unsigned char[img.size()];
-	std::copy(begin(img), end(img), img_arr);
 	// Save the image
-	if (lodepng_encode_file(filename, img_arr, w, h, type, bitdepth)) {
+	if (EncodeImage(img, filename, type, bitdepth)) {
 		printf("An error occured while saving the image!\n");
 		getchar();
 		// Return Error code 1
@@ -59,22 +75,84 @@ int WriteImage(std::vector<unsigned char> img, const char* filename, unsigned w,
 	}
 	// Stop counting execution time
 	StopTimer(&timer, "Image saved");
-	// Free the temporare char array
-	delete[] img_arr;
 	// No error occured
 	return 0;
 }
 
-std::vector<unsigned char> ResizeImage(std::vector<unsigned char> img, unsigned int w, unsigned int h) {
+int WriteImage16(ImageView16 img, const char* filename) {
+	printf("Saving %s\n", filename);
+	timer_struct timer = {};
+	StartTimer(&timer);
+	// 16-bit PNG samples are big-endian
+	std::vector<unsigned char> bytes((size_t)img.width * img.height * 2);
+	for (unsigned int y = 0; y < img.height; y++) {
+		const unsigned short* row = img.Row(y);
+		unsigned char* dst = &bytes[(size_t)y * img.width * 2];
+		for (unsigned int x = 0; x < img.width; x++) {
+			dst[2 * x] = row[x] >> 8;
+			dst[2 * x + 1] = row[x] & 0xFF;
+		}
+	}
+	if (lodepng_encode_file(filename, bytes.data(), img.width, img.height, LCT_GREY, 16)) {
+		printf("An error occured while saving the image!\n");
+		return 1;
+	}
+	StopTimer(&timer, "Image saved");
+	return 0;
+}
+
+int WritePFM(ImageViewF img, const char* filename) {
+	/* Sources:
+	* "PFM Portable Float Map" - https://www.pauldebevec.com/Research/HDR/PFM/
+	*/
+	printf("Saving %s\n", filename);
+	timer_struct timer = {};
+	StartTimer(&timer);
+	FILE* fp = fopen(filename, "wb");
+	if (!fp) {
+		printf("An error occured while saving the image!\n");
+		return 1;
+	}
+	// Grayscale header. A negative scale means little-endian floats
+	fprintf(fp, "Pf\n%u %u\n-1.0\n", img.width, img.height);
+	// Rows are stored from the bottom up
+	size_t written = 0;
+	for (unsigned int y = img.height; y-- > 0;) {
+		written += fwrite(img.Row(y), sizeof(float), img.width, fp);
+	}
+	fclose(fp);
+	if (written != (size_t)img.width * img.height) {
+		printf("An error occured while saving the image!\n");
+		return 1;
+	}
+	StopTimer(&timer, "Image saved");
+	return 0;
+}
+
+Image16 FixedPointImage(ImageViewF img, unsigned int scale) {
+	Image16 result(img.width, img.height);
+	for (unsigned int y = 0; y < img.height; y++) {
+		const float* row = img.Row(y);
+		unsigned short* dst = result.Span().Row(y);
+		for (unsigned int x = 0; x < img.width; x++) {
+			float value = row[x] * scale + 0.5f;
+			dst[x] = value < 0 ? 0 : (value > 65535 ? 65535 : (unsigned short)value);
+		}
+	}
+	return result;
+}
+
+Image ResizeImage(ImageView img) {
 	/* Source:
 	* "Image scaling and rotating in C/C++" - https://stackoverflow.com/questions/299267/image-scaling-and-rotating-in-c-c
 	*/
 	timer_struct timer = {};
+	unsigned int w = img.width, h = img.height;
 	// Calculate new width and height
 	unsigned new_w = floor(w / 4);
 	unsigned new_h = floor(h / 4);
-	// Allocate a vector for the new smaller RGBA image
-	std::vector<unsigned char> new_img(new_w * new_h * 4);
+	// Allocate the new smaller RGBA image
+	Image new_img(new_w, new_h, 4);
 
 	StartTimer(&timer);
 	// Drop the pixels
@@ -82,146 +160,218 @@ std::vector<unsigned char> ResizeImage(std::vector<unsigned char> img, unsigned
 		for (int x = 0; x < new_w; x++) {
 			int dy = y * h / new_h;
 			int dx = x * w / new_w;
-			int coord = (dx + dy * w) * 4;
+			const unsigned char* src = &img.At(dx, dy);
 			int coord_new = (y * new_w + x) * 4;
 
-			new_img[coord_new] = img[coord];
-			new_img[coord_new + 1] = img[coord + 1];
-			new_img[coord_new + 2] = img[coord + 2];
-			new_img[coord_new + 3] = img[coord + 3];
+			new_img[coord_new] = src[0];
+			new_img[coord_new + 1] = src[1];
+			new_img[coord_new + 2] = src[2];
+			new_img[coord_new + 3] = src[3];
 		}
 	}
 	StopTimer(&timer, "Image resized");
 	return new_img;
 }
 
-std::vector<unsigned char> GrayScaleImage(std::vector<unsigned char> img, unsigned int w, unsigned int h) {
+Image GrayScaleImage(ImageView img) {
 	timer_struct timer = {};
-	// Initialize a vector for the grayscaled image
-	std::vector<unsigned char> grayscaled(w * h); // Resulting image only has one value per pixel
+	unsigned int w = img.width, h = img.height;
+	// Initialize the grayscaled image
+	Image grayscaled(w, h); // Resulting image only has one value per pixel
 	unsigned int ind = 0; // Counter for current index in resulting image
 
 	StartTimer(&timer);
 	// Perform the grayscaling
-	for (int i = 0; i < w * h * 4; i += 4) {
-		grayscaled[ind] = img[i] * 0.299 + img[i + 1] * 0.587 + img[i + 2] * 0.114;
-		ind += 1;
+	for (int y = 0; y < h; y++) {
+		const unsigned char* row = img.Row(y);
+		for (int i = 0; i < w * 4; i += 4) {
+			grayscaled[ind] = row[i] * 0.299 + row[i + 1] * 0.587 + row[i + 2] * 0.114;
+			ind += 1;
+		}
 	}
 	StopTimer(&timer, "Image grayscaled");
 	return grayscaled;
 }
 
-std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::vector<unsigned char> img_right, unsigned int w, unsigned int h, int window_y, int window_x, int min_disparity, int max_disparity) {
-	std::vector<unsigned char> disparity_map(w * h);
-	int window_size = window_y * window_x; // Size of the whole window
-
-	// Create a vector with all coordinates in the image, this will be used for by threads
-	std::vector<std::vector<int>> all_coords(h * w, std::vector<int>(2));
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			all_coords[y * w + x] = { y, x };
+Image DownsampleImage(ImageView img) {
+	unsigned int new_w = img.width / 2, new_h = img.height / 2;
+	Image result(new_w, new_h);
+	for (unsigned int y = 0; y < new_h; y++) {
+		const unsigned char* row0 = img.Row(2 * y);
+		const unsigned char* row1 = img.Row(2 * y + 1);
+		unsigned char* dst = result.Span().Row(y);
+		// Rounded mean of the 2x2 block
+		for (unsigned int x = 0; x < new_w; x++) {
+			dst[x] = (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) / 4;
 		}
 	}
+	return result;
+}
+
+Image CalcZNCC(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	int window_size = window_y * window_x; // Size of the whole window
 
 	timer_struct timer;
 	StartTimer(&timer);
 
-#pragma omp parallel for num_threads(3)
-	for (int i = 0; i < all_coords.size(); i++) {
-		// Declare variables here so they are private for each thread, and omp private(...) doesn't need to be used
-		int y = all_coords[i][0];
-		int x = all_coords[i][1];
-		int win_y, win_x;
-		float lw_mean, rw_mean; // Left and right image mean
-		float lw_mean_diff, rw_mean_diff; // Pixel difference from the mean
-		float lower_sum_0, lower_sum_1, upper_sum;
-		float zncc_val;
-		float max_sum = -1; // Start with a small number, so values can update
-		float best_disparity = max_disparity;
-
-		for (int d = min_disparity; d < max_disparity; d++) { // Loop to maximum disparity value
-			// Reset
-			lw_mean = 0, rw_mean = 0;
-			// Mean for each window. Based on the equation, window_x & window_y should be divided by 2
-			for (win_y = -window_y / 2; win_y < window_y / 2; win_y++) {
-				for (win_x = -window_x / 2; win_x < window_x / 2; win_x++) {
-					// Make sure we are inside the image boundries
-					if (win_y + y < 0 || win_y + y >= h || win_x + x < 0 || win_x + x - d < 0 || win_x + x >= w || win_x + x - d >= w) {
-						// Outside of image, go to next iteration
-						continue;
+	GetTileScheduler().Run(w, h, TILE_WIDTH, TILE_HEIGHT, [&](const tile& t) {
+		for (int y = t.y0; y < t.y1; y++) {
+			for (int x = t.x0; x < t.x1; x++) {
+				// Declare variables here so they are private for each thread
+				int win_y, win_x;
+				float lw_mean, rw_mean; // Left and right image mean
+				float lw_mean_diff, rw_mean_diff; // Pixel difference from the mean
+				float lower_sum_0, lower_sum_1, upper_sum;
+				float zncc_val;
+				float max_sum = -1; // Start with a small number, so values can update
+				float best_disparity = max_disparity;
+
+				for (int d = min_disparity; d < max_disparity; d++) { // Loop to maximum disparity value
+					// Reset
+					lw_mean = 0, rw_mean = 0;
+					// Mean for each window. Based on the equation, window_x & window_y should be divided by 2
+					for (win_y = -window_y / 2; win_y < window_y / 2; win_y++) {
+						for (win_x = -window_x / 2; win_x < window_x / 2; win_x++) {
+							// Make sure we are inside the image boundries
+							if (win_y + y < 0 || win_y + y >= h || win_x + x < 0 || win_x + x - d < 0 || win_x + x >= w || win_x + x - d >= w) {
+								// Outside of image, go to next iteration
+								continue;
+							}
+							// Add current pixel value
+							lw_mean += img_left.At(win_x + x, win_y + y);
+							rw_mean += img_right.At(win_x + x - d, win_y + y);
+						}
 					}
-					// Add current pixel value
-					lw_mean += img_left[(win_y + y) * w + (win_x + x)];
-					rw_mean += img_right[(win_y + y) * w + (win_x + x - d)];
-				}
-			}
-			// Calculate the window means by dividing summed values with the window's size
-			lw_mean = lw_mean / window_size;
-			rw_mean = rw_mean / window_size;
-
-			//Reset
-			upper_sum = 0, lower_sum_0 = 0, lower_sum_1 = 0, zncc_val = 0;
-
-			// Calculate ZNCC using the same window loops
-			for (win_y = -window_y / 2; win_y < window_y / 2; win_y++) {
-				for (win_x = -window_x / 2; win_x < window_x / 2; win_x++) {
-					// Make sure we are inside the image boundries
-					if (win_y + y < 0 || win_y + y >= h || win_x + x < 0 || win_x + x - d < 0 || win_x + x >= w || win_x + x - d >= w) {
-						// Outside of image, go to next iteration
-						continue;
+					// Calculate the window means by dividing summed values with the window's size
+					lw_mean = lw_mean / window_size;
+					rw_mean = rw_mean / window_size;
+
+					//Reset
+					upper_sum = 0, lower_sum_0 = 0, lower_sum_1 = 0, zncc_val = 0;
+
+					// Calculate ZNCC using the same window loops
+					for (win_y = -window_y / 2; win_y < window_y / 2; win_y++) {
+						for (win_x = -window_x / 2; win_x < window_x / 2; win_x++) {
+							// Make sure we are inside the image boundries
+							if (win_y + y < 0 || win_y + y >= h || win_x + x < 0 || win_x + x - d < 0 || win_x + x >= w || win_x + x - d >= w) {
+								// Outside of image, go to next iteration
+								continue;
+							}
+							// Get pixel mean differences for both images
+							lw_mean_diff = img_left.At(win_x + x, win_y + y) - lw_mean;
+							rw_mean_diff = img_right.At(win_x + x - d, win_y + y) - rw_mean;
+							// Lower Sum calculation
+							lower_sum_0 += lw_mean_diff * lw_mean_diff;
+							lower_sum_1 += rw_mean_diff * rw_mean_diff;
+							// Upper Sum calculation
+							upper_sum += lw_mean_diff * rw_mean_diff;
+						}
+					}
+					// Calculating the ZNCC value with upper and lower sum
+					zncc_val = upper_sum / (sqrt(lower_sum_0) * sqrt(lower_sum_1));
+					// Check if maximum sum and best disparity should be updated based on current zncc value
+					if (zncc_val > max_sum) {
+						best_disparity = d;
+						max_sum = zncc_val;
 					}
-					// Get pixel mean differences for both images
-					lw_mean_diff = img_left[(win_y + y) * w + (win_x + x)] - lw_mean;
-					rw_mean_diff = img_right[(win_y + y) * w + (win_x + x - d)] - rw_mean;
-					// Lower Sum calculation
-					lower_sum_0 += lw_mean_diff * lw_mean_diff;
-					lower_sum_1 += rw_mean_diff * rw_mean_diff;
-					// Upper Sum calculation
-					upper_sum += lw_mean_diff * rw_mean_diff;
 				}
-			}
-			// Calculating the ZNCC value with upper and lower sum
-			zncc_val = upper_sum / (sqrt(lower_sum_0) * sqrt(lower_sum_1));
-			// Check if maximum sum and best disparity should be updated based on current zncc value
-			if (zncc_val > max_sum) {
-				best_disparity = d;
-				max_sum = zncc_val;
+				// Add resulting best disparity value to the disparity map
+				disparity_map[y * w + x] = abs(best_disparity); // Use absolute value of the disparity
 			}
 		}
-		// Add resulting best disparity value to the disparity map
-		disparity_map[y * w + x] = abs(best_disparity); // Use absolute value of the disparity
-	}
+	});
 
 	StopTimer(&timer, "ZNCC calculated");
+	GetTileScheduler().PrintUtilization("ZNCC");
 	return disparity_map;
 }
 
-std::vector<unsigned char> CrossCheck(std::vector<unsigned char> left, std::vector<unsigned char> right, unsigned int w, unsigned int h, unsigned int th) {
+Image ResizeGrayScaleImage(ImageView img, integral_image* table) {
+	timer_struct timer = {};
+	unsigned int w = img.width, h = img.height;
+	// Calculate new width and height
+	unsigned new_w = floor(w / 4);
+	unsigned new_h = floor(h / 4);
+	Image grayscaled(new_w, new_h);
+	unsigned int stride = new_w + 1;
+	if (table != NULL) {
+		table->w = new_w;
+		table->h = new_h;
+		// First row and column stay zero
+		table->sum.assign(stride * (new_h + 1), 0);
+		table->sum_sq.assign(stride * (new_h + 1), 0);
+	}
+
+	StartTimer(&timer);
+	for (int y = 0; y < new_h; y++) {
+		// Only every fourth row and column of the original image is read
+		const unsigned char* src = img.Row(y * h / new_h);
+		unsigned char* dst = grayscaled.Span().Row(y);
+		for (int x = 0; x < new_w; x++) {
+			const unsigned char* pixel = src + (x * w / new_w) * 4;
+			dst[x] = pixel[0] * 0.299 + pixel[1] * 0.587 + pixel[2] * 0.114;
+		}
+		if (table == NULL) continue;
+		// Running sums of the row, added to the row above like BuildIntegralImage does
+		unsigned int row_sum = 0, row_sum_sq = 0;
+		for (int x = 0; x < new_w; x++) {
+			unsigned int val = dst[x];
+			row_sum += val;
+			row_sum_sq += val * val;
+			table->sum[(y + 1) * stride + x + 1] = table->sum[y * stride + x + 1] + row_sum;
+			table->sum_sq[(y + 1) * stride + x + 1] = table->sum_sq[y * stride + x + 1] + row_sum_sq;
+		}
+	}
+	StopTimer(&timer, "Image resized and grayscaled");
+	return grayscaled;
+}
+
+/*
+* \brief CrossCheck for 8 and 16-bit disparity maps
+*/
+template <typename T>
+static ImageT<T> CrossCheckT(ImageViewT<T> left, ImageViewT<T> right, unsigned int th, T invalid) {
+	unsigned int w = left.width, h = left.height;
 	// Allocate memory for the result
-	std::vector<unsigned char> result(w * h);
-	int current_value;
+	ImageT<T> result(w, h);
 	// Start the timer
 	timer_struct timer;
 
 	StartTimer(&timer);
-	for (int i = 0; i < w * h; i++) {
-		// Compare absolute value of difference between left and right image to the given threshold
-		current_value = abs(left[i] - right[i]);
-		if (current_value > th) {
-			// Threshold exceeded, replacing pixel value with 0
-			result[i] = 0;
-		}
-		else {
-			// Add value from right image
-			result[i] = right[i];
+	GetTileScheduler().Run(w, h, TILE_WIDTH, TILE_HEIGHT, [&](const tile& t) {
+		for (int y = t.y0; y < t.y1; y++) {
+			const T* left_row = left.Row(y);
+			const T* right_row = right.Row(y);
+			T* result_row = result.Span().Row(y);
+			// No branches, so the compiler can vectorize the loop with gathers
+			for (int x = t.x0; x < t.x1; x++) {
+				// Pixel x of the left image matched pixel x - d of the right image, which must have matched back within the threshold
+				int d = left_row[x];
+				int match = x - d;
+				int back = right_row[match < 0 ? 0 : match];
+				int consistent = match >= 0 && abs(d - back) <= (int)th;
+				result_row[x] = consistent ? d : invalid;
+			}
 		}
-	}
+	});
 	// Stop the timer
 	StopTimer(&timer, "Cross check done");
+	GetTileScheduler().PrintUtilization("Cross check");
 	return result;
 }
 
-int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h, int y, int x) {
+Image CrossCheck(ImageView left, ImageView right, unsigned int th, unsigned char invalid) {
+	return CrossCheckT(left, right, th, invalid);
+}
+
+Image16 CrossCheck16(ImageView16 left, ImageView16 right, unsigned int th, unsigned short invalid) {
+	return CrossCheckT(left, right, th, invalid);
+}
+
+int find_nearest(ImageView dmap, int y, int x) {
+	int w = dmap.width, h = dmap.height;
 	int nh_size = 150;
 	int current_val;
 	for (int spread = 1; spread <= nh_size / 2; spread++) {
@@ -231,7 +381,7 @@ int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h
 				if (y_nh + y < 0 || y_nh + y >= h || x_nh + x < 0 || x_nh + x >= w || (y_nh == 0 && x_nh == 0)) {
 					continue;
 				}
-				current_val = dmap[(y + y_nh) * w + (x + x_nh)];
+				current_val = dmap.At(x + x_nh, y + y_nh);
 				if (current_val != 0) {
 					// Non-zero value found
 					return current_val;
@@ -244,52 +394,275 @@ int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h
 	return -1;
 }
 
-std::vector<unsigned char> OcclusionFill(std::vector<unsigned char> cross, unsigned int w, unsigned int h) {
-	std::vector<unsigned char> result(w * h);
-	int current_val;
+Image OcclusionFill(ImageView cross) {
+	unsigned int w = cross.width, h = cross.height;
+	Image result(w, h);
+	std::atomic<bool> failed(false);
 
 	// Start the timer
 	timer_struct timer;
 
 	StartTimer(&timer);
+	GetTileScheduler().Run(w, h, TILE_WIDTH, TILE_HEIGHT, [&](const tile& t) {
+		for (int y = t.y0; y < t.y1 && !failed; y++) {
+			for (int x = t.x0; x < t.x1; x++) {
+				int current_val = cross.At(x, y);
+				// Check if current pixel's value is zero
+				if (current_val != 0) {
+					// Not zero, use the pixels value
+					result[y * w + x] = current_val;
+				}
+				else {
+					// Pixel's value is zero, find nearest non zero value in the neighborhood
+					current_val = find_nearest(cross, y, x);
+					// Stop if no non-zero neighbor was found
+					if (current_val == -1) {
+						failed = true;
+						break;
+					}
+					// Assign the new value
+					result[y * w + x] = current_val;
+				}
+			}
+		}
+	});
+	// Stop the timer
+	StopTimer(&timer, "Occlusion Fill done");
+	GetTileScheduler().PrintUtilization("Occlusion Fill");
+	// Return empty image if no non-zero neighbor was found
+	if (failed) return Image();
+	return result;
+}
+
+/*
+* \brief Makes pixel i use the nearest non-zero pixel of neighbor n, if that one is closer than its own. Equally far pixels
+* are ordered like find_nearest scans them, upper row first and then left column first
+*/
+static inline void TakeCloserSeed(std::vector<int>& seed_x, std::vector<int>& seed_y, int i, int n, int x, int y) {
+	if (seed_x[n] < 0) return;
+	int dist = std::max(abs(seed_x[n] - x), abs(seed_y[n] - y));
+	int current_dist = std::max(abs(seed_x[i] - x), abs(seed_y[i] - y));
+	if (seed_x[i] < 0 || dist < current_dist ||
+		(dist == current_dist && (seed_y[n] < seed_y[i] || (seed_y[n] == seed_y[i] && seed_x[n] < seed_x[i])))) {
+		seed_x[i] = seed_x[n];
+		seed_y[i] = seed_y[n];
+	}
+}
+
+/*
+* \brief Finds the coordinates of the nearest non-zero pixel of every pixel with a forward and a backward raster pass
+* \return false if the whole image is zero
+*/
+static bool FindNearestSeeds(ImageView cross, std::vector<int>& seed_x, std::vector<int>& seed_y) {
+	int w = cross.width, h = cross.height;
+	bool found = false;
+	seed_x.assign(w * h, -1);
+	seed_y.assign(w * h, -1);
+	// Non-zero pixels are their own seeds
+	for (int y = 0; y < h; y++) {
+		const unsigned char* row = cross.Row(y);
+		for (int x = 0; x < w; x++) {
+			if (row[x] != 0) {
+				seed_x[y * w + x] = x;
+				seed_y[y * w + x] = y;
+				found = true;
+			}
+		}
+	}
+	if (!found) return false;
+
+	// Forward pass: neighbors above and on the left, then the right neighbor on the way back
 	for (int y = 0; y < h; y++) {
 		for (int x = 0; x < w; x++) {
-			current_val = cross[y * w + x];
-			// Check if current pixel's value is zero
-			if (current_val != 0) {
-				// Not zero, use the pixels value
-				result[y * w + x] = current_val;
+			int i = y * w + x;
+			if (x > 0) TakeCloserSeed(seed_x, seed_y, i, i - 1, x, y);
+			if (y > 0) {
+				if (x > 0) TakeCloserSeed(seed_x, seed_y, i, i - w - 1, x, y);
+				TakeCloserSeed(seed_x, seed_y, i, i - w, x, y);
+				if (x < w - 1) TakeCloserSeed(seed_x, seed_y, i, i - w + 1, x, y);
 			}
-			else {
-				// Pixel's value is zero, find nearest non zero value in the neighborhood
-				current_val = find_nearest(cross, w, h, y, x);
-				// Return empty image if no non-zero neighbor was found
-				if (current_val == -1) return std::vector<unsigned char>();
-				// Assign the new value
-				result[y * w + x] = current_val;
+		}
+		for (int x = w - 2; x >= 0; x--) {
+			TakeCloserSeed(seed_x, seed_y, y * w + x, y * w + x + 1, x, y);
+		}
+	}
+	// Backward pass: neighbors below and on the right, then the left neighbor on the way back
+	for (int y = h - 1; y >= 0; y--) {
+		for (int x = w - 1; x >= 0; x--) {
+			int i = y * w + x;
+			if (x < w - 1) TakeCloserSeed(seed_x, seed_y, i, i + 1, x, y);
+			if (y < h - 1) {
+				if (x < w - 1) TakeCloserSeed(seed_x, seed_y, i, i + w + 1, x, y);
+				TakeCloserSeed(seed_x, seed_y, i, i + w, x, y);
+				if (x > 0) TakeCloserSeed(seed_x, seed_y, i, i + w - 1, x, y);
 			}
 		}
+		for (int x = 1; x < w; x++) {
+			TakeCloserSeed(seed_x, seed_y, y * w + x, y * w + x - 1, x, y);
+		}
+	}
+	return true;
+}
+
+Image OcclusionFillDistance(ImageView cross) {
+	unsigned int w = cross.width, h = cross.height;
+	Image result(w, h);
+	std::vector<int> seed_x, seed_y;
+
+	// Start the timer
+	timer_struct timer;
+
+	StartTimer(&timer);
+	if (!FindNearestSeeds(cross, seed_x, seed_y)) {
+		printf("No non-zero pixel was found!\n");
+		return Image();
+	}
+	for (int y = 0; y < h; y++) {
+		unsigned char* result_row = result.Span().Row(y);
+		for (int x = 0; x < w; x++) {
+			// Non-zero pixels are their own seeds, so they keep their value
+			result_row[x] = cross.At(seed_x[y * w + x], seed_y[y * w + x]);
+		}
 	}
 	// Stop the timer
-	StopTimer(&timer, "Occlusion Fill done");
+	StopTimer(&timer, "Occlusion Fill done with a distance transform");
+	return result;
+}
+
+Image OcclusionFillScanline(ImageView cross) {
+	unsigned int w = cross.width, h = cross.height;
+	Image result(w, h);
+	// Rows without any non-zero pixel. One byte per row, so tiles can write it without locking
+	std::vector<unsigned char> empty_rows(h, 0);
+
+	// Start the timer
+	timer_struct timer;
+
+	StartTimer(&timer);
+	// Tiles span whole rows, since the search runs along the row
+	GetTileScheduler().Run(w, h, w, TILE_HEIGHT, [&](const tile& t) {
+		std::vector<int> left_x(w);
+		for (int y = t.y0; y < t.y1; y++) {
+			const unsigned char* row = cross.Row(y);
+			unsigned char* result_row = result.Span().Row(y);
+			// Nearest non-zero pixel on the left of each pixel
+			int last = -1;
+			for (int x = 0; x < w; x++) {
+				if (row[x] != 0) last = x;
+				left_x[x] = last;
+			}
+			if (last == -1) {
+				empty_rows[y] = 1;
+				continue;
+			}
+			// Walk back from the right, so the nearest non-zero pixel on the right is known as well
+			int next = -1;
+			for (int x = w - 1; x >= 0; x--) {
+				if (row[x] != 0) {
+					next = x;
+					result_row[x] = row[x];
+					continue;
+				}
+				int left = left_x[x];
+				if (left < 0) result_row[x] = row[next];
+				else if (next < 0) result_row[x] = row[left];
+				else if (x - left != next - x) result_row[x] = (x - left < next - x) ? row[left] : row[next];
+				else result_row[x] = std::min(row[left], row[next]);
+			}
+		}
+	});
+
+	// Whole rows of zeros have nothing to copy on the row, use the nearest pixel of the whole image instead
+	if (std::find(empty_rows.begin(), empty_rows.end(), 1) != empty_rows.end()) {
+		std::vector<int> seed_x, seed_y;
+		if (!FindNearestSeeds(cross, seed_x, seed_y)) {
+			printf("No non-zero pixel was found!\n");
+			return Image();
+		}
+		for (int y = 0; y < h; y++) {
+			if (!empty_rows[y]) continue;
+			for (int x = 0; x < w; x++) {
+				result.Span().At(x, y) = cross.At(seed_x[y * w + x], seed_y[y * w + x]);
+			}
+		}
+	}
+	// Stop the timer
+	StopTimer(&timer, "Occlusion Fill done along the scanlines");
+	GetTileScheduler().PrintUtilization("Occlusion Fill");
 	return result;
 }
 
-std::vector<unsigned char> NormalizeImage(std::vector<unsigned char> dmap, unsigned int w, unsigned int h) {
+/*
+* \brief NormalizeImage for 8 and 16-bit disparity maps. The result is always 8-bit
+*/
+template <typename T>
+static Image NormalizeImageT(ImageViewT<T> dmap) {
 	/* Sources:
 	* "How to Normalize Data Between 0 and 100" - https://www.statology.org/normalize-data-between-0-and-100/
 	*/
+	unsigned int w = dmap.width, h = dmap.height;
+	Image result(w, h);
 	timer_struct timer;
 
 	StartTimer(&timer);
-	// Get the maximum value of the map
-	unsigned int max = *std::max_element(dmap.begin(), dmap.end());
-	// Get the minimum value of the map
-	unsigned int min = *std::min_element(dmap.begin(), dmap.end());
+	// Get the minimum and maximum values of the map. Each tile is reduced first, then merged
+	unsigned int min = std::numeric_limits<T>::max(), max = 0;
+	std::mutex min_max_mutex;
+	GetTileScheduler().Run(w, h, TILE_WIDTH, TILE_HEIGHT, [&](const tile& t) {
+		unsigned int tile_min = std::numeric_limits<T>::max(), tile_max = 0;
+		for (int y = t.y0; y < t.y1; y++) {
+			const T* row = dmap.Row(y);
+			for (int i = t.x0; i < t.x1; i++) {
+				tile_min = std::min(tile_min, (unsigned int)row[i]);
+				tile_max = std::max(tile_max, (unsigned int)row[i]);
+			}
+		}
+		std::lock_guard<std::mutex> lock(min_max_mutex);
+		min = std::min(min, tile_min);
+		max = std::max(max, tile_max);
+	});
+	// PrintUtilization only covers the last Run, so both passes are printed
+	GetTileScheduler().PrintUtilization("Normalize, minimum and maximum");
 	// Perform the normalization. Range [0-255]
-	for (int i = 0; i < w * h; i++) {
-		dmap[i] = 255 * (dmap[i] - min) / (max - min);
-	}
+	GetTileScheduler().Run(w, h, TILE_WIDTH, TILE_HEIGHT, [&](const tile& t) {
+		for (int y = t.y0; y < t.y1; y++) {
+			const T* row = dmap.Row(y);
+			unsigned char* result_row = result.Span().Row(y);
+			for (int i = t.x0; i < t.x1; i++) {
+				// A flat map, like an all invalid cross check, becomes 0 like in normalize.cl
+				result_row[i] = max > min ? 255 * (row[i] - min) / (max - min) : 0;
+			}
+		}
+	});
 	StopTimer(&timer, "Image normalized");
-	return dmap;
+	GetTileScheduler().PrintUtilization("Normalize, scaling");
+	return result;
+}
+
+Image NormalizeImage(ImageView dmap) {
+	return NormalizeImageT(dmap);
+}
+
+Image NormalizeImage16(ImageView16 dmap) {
+	return NormalizeImageT(dmap);
+}
+
+int CompareImages(ImageView a, ImageView b, unsigned int tolerance) {
+	if (a.width != b.width || a.height != b.height || a.channels != b.channels) {
+		printf("Compared images have different sizes!\n");
+		return -1;
+	}
+	int mismatches = 0;
+	unsigned int largest = 0;
+	for (unsigned int y = 0; y < a.height; y++) {
+		const unsigned char* a_row = a.Row(y);
+		const unsigned char* b_row = b.Row(y);
+		for (unsigned int i = 0; i < a.width * a.channels; i++) {
+			unsigned int diff = abs(a_row[i] - b_row[i]);
+			largest = std::max(largest, diff);
+			if (diff > tolerance) mismatches++;
+		}
+	}
+	printf("%d values differ by more than %u, largest difference is %u\n", mismatches, tolerance, largest);
+	return mismatches;
 }
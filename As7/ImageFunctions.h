@@ -4,108 +4,197 @@
 #include <vector>
 #include <string>
 #include "lodepng.h"
+#include "Image.h"
+#include "ZNCCFunctions.h"
 
 
 /*
-* \brief Explicitly frees the memory allocated to the given vector
-* \param img_vector Image vector to remove from memory
+* \brief Explicitly frees the memory allocated to the given image
+* \param img Image to remove from memory
 * \return Nothing
 */
-void FreeImageVector(std::vector<unsigned char>& img_vector);
+void FreeImage(Image& img);
 
 /*
-* \brief Uses lodepng to read the given image into memory, Calls lodepng_decode32_file. Read image is stored into std::vector<unsigned char>
-* \param out The read image is stored here
+* \brief Uses lodepng to read the given image into memory, Calls lodepng_decode32_file. The decoded pixels are copied once into the aligned storage of out
+* \param out The read RGBA image is stored here. Its width and height are taken from the file
 * \param filename Name of the image file
-* \param w Width of the image
-* \param h Height of the image
 * \return 0 if successful; 1 otherwise
 */
-int ReadImage(std::vector<unsigned char>& out, const char* filename, unsigned w, unsigned h);
+int ReadImage(Image& out, const char* filename);
 
 /*
-* \brief Uses lodepng_encode_file to save a given image to disk
-* \param img Image to save. The image is converted to an int array before saving
+* \brief Same as ReadImage without printing anything or waiting for a key when it fails, for callers that run unattended
+* \param out The read RGBA image is stored here
+* \param filename Name of the image file
+* \return 0 if successful; 1 otherwise
+*/
+int DecodeImage(Image& out, const char* filename);
+
+/*
+* \brief Uses lodepng_encode_file to save a given image to disk. Contiguous images are passed to lodepng as is, strided views are packed first
+* \param img Image to save
 * \param filename Filename to use
-* \param w Width of the image
-* \param h Height of the image
 * \param type LodePNGColorType to use when saving
 * \bitdepth Bit depth to use when saving
 * \return 0 if successful; 1 otherwise
 */
-int WriteImage(std::vector<unsigned char> img, const char* filename, unsigned int w, unsigned int h, LodePNGColorType type, unsigned bitdepth);
+int WriteImage(ImageView img, const char* filename, LodePNGColorType type, unsigned bitdepth);
+
+/*
+* \brief Same as WriteImage without printing anything or waiting for a key when it fails
+* \param img Image to save
+* \param filename Filename to use
+* \param type LodePNGColorType to use when saving
+* \param bitdepth Bit depth to use when saving
+* \return 0 if successful; 1 otherwise
+*/
+int EncodeImage(ImageView img, const char* filename, LodePNGColorType type, unsigned bitdepth);
+
+/*
+* \brief Saves a 16-bit single channel image, like a full resolution disparity map, as a 16-bit grayscale PNG
+* \param img Image to save
+* \param filename Filename to use
+* \return 0 if successful; 1 otherwise
+*/
+int WriteImage16(ImageView16 img, const char* filename);
+
+/*
+* \brief Saves a float image, like a sub-pixel disparity map, as a grayscale PFM file
+* \param img Image to save
+* \param filename Filename to use
+* \return 0 if successful; 1 otherwise
+*/
+int WritePFM(ImageViewF img, const char* filename);
+
+/*
+* \brief Converts a float image to 16-bit fixed point, so it can be saved with WriteImage16. Values are rounded and clamped to [0, 65535]
+* \param img Float image
+* \param scale Fixed point scale, the stored value is img * scale
+* \return 16-bit image
+*/
+Image16 FixedPointImage(ImageViewF img, unsigned int scale);
 
 /*
 * \brief Downscales the given RGBA image by 4. This is done by dropping pixels
 * \param img Image to downscale
-* \param w Width of the original image
-* \param h Height of the original image
 * \return Downscaled image or an error if failed. (0.0) spooky...
 */
-std::vector<unsigned char> ResizeImage(std::vector<unsigned char> img, unsigned int w, unsigned int h);
+Image ResizeImage(ImageView img);
 
 /*
 * \brief Grayscales the given image RGBA image
 * \param img Image to grayscale
-* \param w Width of the image
-* \param h Height of the image
+* \return Grayscaled image with one channel
 */
-std::vector<unsigned char> GrayScaleImage(std::vector<unsigned char> img, unsigned int w, unsigned int h);
+Image GrayScaleImage(ImageView img);
 
 /*
-* \brief Performs a Cross Check between the given left and right image
-* \param left Left image
-* \param right Right image
-* \param w Image width
-* \param h Image height
+* \brief Downscales the given RGBA image by 4 and grayscales it in one pass. Gives the same result as ResizeImage followed by
+* GrayScaleImage, without the intermediate RGBA image. If table is given, the summed-area tables CalcZNCCIntegralTables needs
+* are built in the same pass, so the grayscale image does not have to be read again
+* \param img Image to downscale
+* \param table Summed-area tables of the result are stored here. Can be NULL
+* \return Downscaled and grayscaled image with one channel
+*/
+Image ResizeGrayScaleImage(ImageView img, integral_image* table);
+
+/*
+* \brief Halves the size of a grayscale image, every pixel being the mean of a 2x2 block. One level of a box pyramid.
+* An odd last row or column is dropped
+* \param img Grayscale image
+* \return Image of half the width and height
+*/
+Image DownsampleImage(ImageView img);
+
+/*
+* \brief Performs a left-right consistency check. Disparity d of pixel x in left is kept if pixel x - d in right has a disparity within th of d
+* \param left Disparity map with im0 as the left image
+* \param right Disparity map with im1 as the left image
 * \param th Threshold value
+* \param invalid Value of the pixels that fail the check. The occlusion fills fill the pixels that are 0
 * \return New image with the result
 */
-std::vector<unsigned char> CrossCheck(std::vector<unsigned char> left, std::vector<unsigned char> right, unsigned int w, unsigned int h, unsigned int th);
+Image CrossCheck(ImageView left, ImageView right, unsigned int th, unsigned char invalid);
+
+/*
+* \brief Same as CrossCheck for 16-bit disparity maps, which can hold disparities above 255
+*/
+Image16 CrossCheck16(ImageView16 left, ImageView16 right, unsigned int th, unsigned short invalid);
 
 /*
 * \brief Calculates Zero-mean Normalized Cross Correlation for two given image
 * \param img_left Left image
 * \param img_right Right image
-* \param w Image width
-* \param h Image height
 * \param window_y Size of window's y axis
 * \param window_x Size of window's x axis
 * \param min_disparity Minimum disparity value
 * \param max_disparity Maximum disparity value
 * \return The result
 */
-std::vector<unsigned char> CalcZNCC(std::vector<unsigned char> img_left, std::vector<unsigned char> img_right, unsigned int w, unsigned int h, int window_y, int window_x, int min_disparity, int max_disparity);
+Image CalcZNCC(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity);
 
 /*
 * \brief Eliminates the zeros created by Cross Checking
 * \param cross Result of the Cross Checking
-* \param w Image width
-* \param h Image height
-* \param neighborhood_size Size of the neighborhood
-* \return Resulting image
+* \return Resulting image, empty if a zero pixel had no non-zero neighbor
+*/
+Image OcclusionFill(ImageView cross);
+
+/*
+* \brief Function pointer type shared by OcclusionFill and its alternatives
 */
-std::vector<unsigned char> OcclusionFill(std::vector<unsigned char> cross, unsigned int w, unsigned int h);
+typedef Image(*occlusion_fill_backend)(ImageView);
+
+/*
+* \brief Eliminates the zeros created by Cross Checking like OcclusionFill, but finds the nearest non-zero pixel of every pixel
+* at once with a two-pass raster distance transform. Each pixel keeps the coordinates of its nearest non-zero pixel, which are
+* propagated forward from the top-left and backward from the bottom-right neighbors. Distance is the same square ring distance
+* find_nearest uses, and equally far pixels are picked in the same order, so the result matches OcclusionFill. Cost is O(w * h) no matter
+* how big the holes are, and holes are not limited to the neighborhood size of find_nearest
+* \param cross Result of the Cross Checking
+* \return Resulting image, empty if the whole image is zero
+*/
+Image OcclusionFillDistance(ImageView cross);
+
+/*
+* \brief Eliminates the zeros created by Cross Checking with the nearest non-zero pixel on the same row, i.e. along the epipolar line.
+* If the nearest pixels on the left and on the right are as far, the smaller disparity is used, since occluded pixels belong to the background.
+* Rows without any non-zero pixel are filled like OcclusionFillDistance does
+* \param cross Result of the Cross Checking
+* \return Resulting image, empty if the whole image is zero
+*/
+Image OcclusionFillScanline(ImageView cross);
 
 /*
 * \brief Finds nearest non-zero pixel from given image's current coordinates neighborhood. Called by OcclusionFill
 * \param dmap Image to use
-* \param w Image width
-* \param h Image height
 * \param y Current y coordinate
 * \param x Current x coordinate
 * \return Non-zero value or -1 if failed to find
 */
-int find_nearest(std::vector<unsigned char> dmap, unsigned int w, unsigned int h, int y, int x);
+int find_nearest(ImageView dmap, int y, int x);
 
 /*
 * \brief Normalizes the values of a disparity map making it look nicer
 * \param dmap Disparity map
-* \param w Image width
-* \param h Image height
 * \return Normalized image
 */
-std::vector<unsigned char> NormalizeImage(std::vector<unsigned char> dmap, unsigned int w, unsigned int h);
+Image NormalizeImage(ImageView dmap);
 
+/*
+* \brief Same as NormalizeImage for a 16-bit disparity map. The result is 8-bit
+*/
+Image NormalizeImage16(ImageView16 dmap);
+
+
+/*
+* \brief Compares two images of the same size pixel by pixel and prints how many pixels differ
+* \param a First image
+* \param b Second image
+* \param tolerance Largest absolute difference a pixel can have and still match
+* \return Number of values that differ by more than tolerance, -1 if the sizes differ
+*/
+int CompareImages(ImageView a, ImageView b, unsigned int tolerance);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "KernelRegistry.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+// rename fails on Windows when the target exists, MoveFileEx can replace it
+#define replace_file(from, to) (MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1)
+#else
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#define replace_file(from, to) rename(from, to)
+#endif
+
+/* Sources:
+* "clGetProgramInfo" - https://registry.khronos.org/OpenCL/sdk/1.2/docs/man/xhtml/clGetProgramInfo.html
+* "FNV Hash" - http://www.isthe.com/chongo/tech/comp/fnv/index.html
+* "MoveFileExA function" - https://learn.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-movefileexa
+*/
+
+
+/*
+* \brief 64-bit FNV-1a hash of the given bytes, continued from hash
+*/
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+* \brief Returns a string valued device info, like CL_DEVICE_NAME
+*/
+static std::string DeviceString(cl_device_id device_id, cl_device_info param) {
+	size_t size = 0;
+	if (clGetDeviceInfo(device_id, param, 0, NULL, &size) != CL_SUCCESS || size == 0) return std::string();
+	std::vector<char> value(size);
+	clGetDeviceInfo(device_id, param, size, value.data(), NULL);
+	return std::string(value.data());
+}
+
+
+KernelRegistry::KernelRegistry(cl_context context, cl_device_id device_id, const char* cache_dir)
+	: context(context), device_id(device_id), cache_dir(cache_dir != NULL ? cache_dir : ""), compiled(0), cached(0) {
+	device_key = DeviceString(device_id, CL_DEVICE_NAME) + "\n" + DeviceString(device_id, CL_DRIVER_VERSION);
+	// Fails harmlessly if the directory already exists
+	if (!this->cache_dir.empty()) make_dir(this->cache_dir.c_str());
+}
+
+KernelRegistry::~KernelRegistry() {
+	for (std::map<std::string, program_entry>::iterator it = programs.begin(); it != programs.end(); ++it) {
+		for (std::map<std::string, cl_kernel>::iterator k = it->second.kernels.begin(); k != it->second.kernels.end(); ++k) {
+			clReleaseKernel(k->second);
+		}
+		if (it->second.program != NULL) clReleaseProgram(it->second.program);
+	}
+}
+
+cl_program KernelRegistry::GetProgram(const char* file_name, const char* options) {
+	std::string key = std::string(file_name) + "\n" + options;
+	std::map<std::string, program_entry>::iterator found = programs.find(key);
+	if (found != programs.end()) return found->second.program;
+
+	kernel_source src;
+	if (!loadKernel((char*)file_name, &src)) return NULL;
+
+	// The cache file is named after everything that changes the binary
+	unsigned long long hash = 14695981039346656037ULL;
+	hash = HashBytes(hash, src.source_str, src.source_size);
+	hash = HashBytes(hash, device_key.c_str(), device_key.size() + 1);
+	hash = HashBytes(hash, options, strlen(options) + 1);
+	char hash_str[17];
+	snprintf(hash_str, sizeof(hash_str), "%016llx", hash);
+	std::string path = cache_dir + "/" + hash_str + ".bin";
+
+	cl_program program = NULL;
+	if (!cache_dir.empty()) program = LoadBinary(path, options);
+	if (program != NULL) {
+		printf("Loaded %s from the kernel cache\n", file_name);
+		cached++;
+	}
+	else {
+		// Build the program from source
+		printf("Building %s %s\n", file_name, options);
+		cl_int err_num;
+		program = clCreateProgramWithSource(context, 1, (const char**)&src.source_str, &src.source_size, &err_num);
+		if (!errorCheck(err_num)) {
+			free(src.source_str);
+			return NULL;
+		}
+		err_num = clBuildProgram(program, 1, &device_id, options, NULL, NULL);
+		if (err_num == CL_BUILD_PROGRAM_FAILURE) printBuildLog(program, device_id);
+		if (!errorCheck(err_num)) {
+			clReleaseProgram(program);
+			free(src.source_str);
+			return NULL;
+		}
+		compiled++;
+		if (!cache_dir.empty()) SaveBinary(path, program);
+	}
+	free(src.source_str);
+
+	programs[key].program = program;
+	return program;
+}
+
+cl_kernel KernelRegistry::GetKernel(const char* file_name, const char* kernel_name, const char* options) {
+	cl_program program = GetProgram(file_name, options);
+	if (program == NULL) return NULL;
+	program_entry& entry = programs[std::string(file_name) + "\n" + options];
+	std::map<std::string, cl_kernel>::iterator found = entry.kernels.find(kernel_name);
+	if (found != entry.kernels.end()) return found->second;
+
+	cl_int err_num;
+	cl_kernel kernel = clCreateKernel(program, kernel_name, &err_num);
+	if (!errorCheck(err_num)) return NULL;
+	entry.kernels[kernel_name] = kernel;
+	return kernel;
+}
+
+void KernelRegistry::PrintStatistics() const {
+	printf("Kernel registry: %d programs compiled, %d loaded from the cache\n", compiled, cached);
+}
+
+cl_program KernelRegistry::LoadBinary(const std::string& path, const char* options) {
+	FILE* fp = NULL;
+	if (fopen_s(&fp, path.c_str(), "rb") != 0 || !fp) return NULL;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	std::vector<unsigned char> binary(size > 0 ? size : 0);
+	size_t read = size > 0 ? fread(binary.data(), 1, size, fp) : 0;
+	fclose(fp);
+	if (size <= 0 || read != (size_t)size) return NULL;
+
+	// A binary the driver does not accept anymore is simply rebuilt from source
+	const unsigned char* binary_ptr = binary.data();
+	size_t binary_size = binary.size();
+	cl_int binary_status, err_num;
+	cl_program program = clCreateProgramWithBinary(context, 1, &device_id, &binary_size, &binary_ptr, &binary_status, &err_num);
+	if (err_num != CL_SUCCESS || binary_status != CL_SUCCESS) {
+		if (program != NULL) clReleaseProgram(program);
+		return NULL;
+	}
+	// Binaries still have to be built, but this only links the device code
+	if (clBuildProgram(program, 1, &device_id, options, NULL, NULL) != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+	return program;
+}
+
+void KernelRegistry::SaveBinary(const std::string& path, cl_program program) {
+	// The program was built for a single device, so there is a single binary
+	size_t binary_size = 0;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binary_size, NULL) != CL_SUCCESS || binary_size == 0) return;
+	std::vector<unsigned char> binary(binary_size);
+	unsigned char* binary_ptr = binary.data();
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary_ptr, NULL) != CL_SUCCESS) return;
+
+	// Written to a temporary file first, so another run never loads a half written binary
+	std::string tmp_path = path + ".tmp";
+	FILE* fp = NULL;
+	if (fopen_s(&fp, tmp_path.c_str(), "wb") != 0 || !fp) {
+		printf("Could not write the kernel cache file %s\n", path.c_str());
+		return;
+	}
+	size_t written = fwrite(binary.data(), 1, binary_size, fp);
+	fclose(fp);
+	if (written != binary_size || replace_file(tmp_path.c_str(), path.c_str()) != 0) remove(tmp_path.c_str());
+}
@@ -0,0 +1,84 @@
+#ifndef KERNELREGISTRY_H_INCLUDED
+#define KERNELREGISTRY_H_INCLUDED
+
+/*********************************************************
+* BUILDS EVERY OPENCL PROGRAM ONCE PER CONTEXT
+* Built programs are also saved to a cache directory as device binaries, so later runs can skip compiling them
+*********************************************************/
+
+#include <map>
+#include <string>
+#include "OpenCLFunctions.h"
+
+
+/*
+* \brief Owns the programs and kernels of one context. A program is identified by its .cl file and build options, and
+* every kernel of it is created once. Binaries are cached on disk in files named by a hash of the source, the device name,
+* the driver version and the build options, so editing a kernel or updating the driver never picks up a stale binary
+*/
+class KernelRegistry {
+public:
+	/*
+	* \brief Creates an empty registry
+	* \param context OpenCL context the programs are built for
+	* \param device_id Device the programs are built for
+	* \param cache_dir Directory for the cached binaries. Created if missing. NULL disables the disk cache
+	*/
+	KernelRegistry(cl_context context, cl_device_id device_id, const char* cache_dir);
+
+	/*
+	* \brief Releases every kernel and program
+	*/
+	~KernelRegistry();
+
+	KernelRegistry(const KernelRegistry&) = delete;
+	KernelRegistry& operator=(const KernelRegistry&) = delete;
+
+	/*
+	* \brief Returns the program built from the given file with the given options. Loaded from the disk cache or
+	* compiled on the first call, later calls return the same program
+	* \param file_name Name of the .cl file
+	* \param options Build options passed to clBuildProgram, for example "-D WINDOW_X=11"
+	* \return OpenCL program or NULL if failed to build. Owned by the registry
+	*/
+	cl_program GetProgram(const char* file_name, const char* options = "");
+
+	/*
+	* \brief Returns a kernel of the program built from the given file with the given options. The same kernel is returned
+	* for every call, so its arguments must be set again before every enqueue
+	* \param file_name Name of the .cl file
+	* \param kernel_name Name of the kernel function
+	* \param options Build options passed to clBuildProgram
+	* \return OpenCL kernel or NULL if failed. Owned by the registry, must not be released
+	*/
+	cl_kernel GetKernel(const char* file_name, const char* kernel_name, const char* options = "");
+
+	/*
+	* \brief Prints how many programs were compiled and how many were loaded from the disk cache
+	* \return Nothing
+	*/
+	void PrintStatistics() const;
+
+	cl_context Context() const { return context; }
+	cl_device_id Device() const { return device_id; }
+
+private:
+	typedef struct {
+		cl_program program;
+		std::map<std::string, cl_kernel> kernels;
+	} program_entry;
+
+	cl_program LoadBinary(const std::string& path, const char* options);
+	void SaveBinary(const std::string& path, cl_program program);
+
+	cl_context context;
+	cl_device_id device_id;
+	std::string cache_dir;
+	std::string device_key; // Device name and driver version, part of every cache key
+	std::map<std::string, program_entry> programs; // Key is the file name and the build options
+	int compiled;
+	int cached;
+};
+
+
+#endif
@@ -16,8 +16,7 @@
 #include <CL/cl.h>
 #endif // __APPLE__
 
-#define MAX_SOURCE_SIZE (0x001000)
-
+static int interactive_errors = 1; // Set by setErrorCheckInteractive
 
 int errorCheck(cl_int err_num) {
 	switch (err_num) {
@@ -62,11 +61,17 @@ int errorCheck(cl_int err_num) {
 	default:
 		printf("An unexpected OpenCL error occured! Code was %d\n", err_num);
 	}
-	printf("Enter something to exit: ");
-	getchar();
+	if (interactive_errors) {
+		printf("Enter something to exit: ");
+		getchar();
+	}
 	return 0;
 }
 
+void setErrorCheckInteractive(int interactive) {
+	interactive_errors = interactive;
+}
+
 int loadKernel(char file_name[], kernel_source *src) {
 	FILE* fp;
 	//printf("Loading Kernel file %s\n", file_name);
@@ -78,13 +83,18 @@ int loadKernel(char file_name[], kernel_source *src) {
 		return 0;
 	}
 
-	src->source_str = (char*)calloc(MAX_SOURCE_SIZE, 1);
+	// The buffer is sized from the file, plus a terminating zero
+	fseek(fp, 0, SEEK_END);
+	long file_size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	src->source_str = (char*)calloc(file_size > 0 ? file_size + 1 : 1, 1);
 	if (src->source_str == 0) {
 		printf("Kernel is empty (source_str = 0)\n");
+		fclose(fp);
 		return 0;
 	}
 
-	src->source_size = fread(src->source_str, 1, MAX_SOURCE_SIZE, fp);
+	src->source_size = fread(src->source_str, 1, file_size > 0 ? file_size : 0, fp);
 	if (src->source_size == 0) {
 		printf("Kernel is empty (source_str = 0)\n");
 		return 0;
@@ -107,18 +117,7 @@ cl_kernel createKernel(cl_context context, cl_device_id device_id, char* kernel_
 	// Build the program
 	err_num = clBuildProgram(program, 1, &device_id, NULL, NULL, NULL);
 	//Print logs if build failed
-	if (err_num == CL_BUILD_PROGRAM_FAILURE) {
-		size_t log_size = 0;
-		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-		// Allocate memory for the log
-		char* log = (char*)malloc(log_size);
-		// Get the log
-		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-		// Print the log
-		printf("LOG: %s\n", log);
-		// Free after print
-		free(log);
-	}
+	if (err_num == CL_BUILD_PROGRAM_FAILURE) printBuildLog(program, device_id);
 	// Create the actual Kernel
 	kernel = clCreateKernel(program, kernel_name, &err_num);
 	if (!errorCheck(err_num)) return NULL;
@@ -127,6 +126,19 @@ cl_kernel createKernel(cl_context context, cl_device_id device_id, char* kernel_
 	return kernel;
 }
 
+void printBuildLog(cl_program program, cl_device_id device_id) {
+	size_t log_size = 0;
+	clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+	// Allocate memory for the log
+	char* log = (char*)malloc(log_size);
+	// Get the log
+	clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+	// Print the log
+	printf("LOG: %s\n", log);
+	// Free after print
+	free(log);
+}
+
 cl_device_id getGPUDevice() {
 	/*SOURCE:
 	* "List OpenCL platforms and devices " - https://gist.github.com/courtneyfaulkner/7919509
@@ -251,13 +263,12 @@ cl_image_format getGrayImageFormat() {
 	return format_gray;
 }
 
-std::vector<unsigned char> executeImageKernel(cl_command_queue cmd_q, cl_kernel kernel, unsigned new_w, unsigned new_h, cl_mem out_cl) {
+Image executeImageKernel(cl_command_queue cmd_q, cl_kernel kernel, unsigned new_w, unsigned new_h, const size_t local_work_size[], cl_mem out_cl) {
 	cl_event event;
 	size_t global_work_size[] = { new_w, new_h };
-	size_t local_work_size[] = { 1, 1 };
 	size_t origin[3] = { 0, 0, 0 };
 	size_t region[3] = { new_w, new_h, 1 };
-	std::vector<unsigned char> out(new_w * new_h);
+	Image out(new_w, new_h);
 	int err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
 	if (!errorCheck(err_num)) return out;
 	// Wait for execution to finish
@@ -270,7 +281,7 @@ std::vector<unsigned char> executeImageKernel(cl_command_queue cmd_q, cl_kernel
 	double milliseconds = (cl_double)(opencl_end - opencl_start) * (cl_double)(1e-06);
 	printf("Kernel execution done, took %f milliseconds\n", milliseconds);
 	// Get the resulting grayscaled image
-	err_num = clEnqueueReadImage(cmd_q, out_cl, CL_TRUE, origin, region, 0, 0, &out[0], 0, NULL, NULL);
+	err_num = clEnqueueReadImage(cmd_q, out_cl, CL_TRUE, origin, region, 0, 0, out.Data(), 0, NULL, NULL);
 	if (!errorCheck(err_num)) return out;
 	// Free the event
 	err_num = clReleaseEvent(event);
@@ -279,10 +290,10 @@ std::vector<unsigned char> executeImageKernel(cl_command_queue cmd_q, cl_kernel
 	return out;
 }
 
-std::vector<unsigned char> executeBufferKernel(cl_command_queue cmd_q, cl_kernel kernel, size_t global_size[], size_t local_size[], unsigned new_w, unsigned new_h, cl_mem out_cl) {
+Image executeBufferKernel(cl_command_queue cmd_q, cl_kernel kernel, size_t global_size[], size_t local_size[], unsigned new_w, unsigned new_h, cl_mem out_cl) {
 	// initialize required variables
 	cl_event event;
-	std::vector<unsigned char> out(new_w * new_h);
+	Image out(new_w, new_h);
 	// Start the kernel execution
 	int err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_size, local_size, 0, NULL, &event);
 	if (!errorCheck(err_num)) return out;
@@ -296,11 +307,208 @@ std::vector<unsigned char> executeBufferKernel(cl_command_queue cmd_q, cl_kernel
 	double milliseconds = (cl_double)(opencl_end - opencl_start) * (cl_double)(1e-06);
 	printf("Kernel execution done, took %f milliseconds\n", milliseconds);
 	// Get the resulting  image
-	err_num = clEnqueueReadBuffer(cmd_q, out_cl, CL_TRUE, 0, new_w * new_h * sizeof(unsigned char), &out[0], 0, NULL, NULL);
+	err_num = clEnqueueReadBuffer(cmd_q, out_cl, CL_TRUE, 0, new_w * new_h * sizeof(unsigned char), out.Data(), 0, NULL, NULL);
 	if (!errorCheck(err_num)) return out;
 	// Free the event
 	err_num = clReleaseEvent(event);
 	if (!errorCheck(err_num)) return out;
 	// Return result
 	return out;
+}
+
+cl_event enqueueKernel(cl_command_queue cmd_q, cl_kernel kernel, const size_t global_size[], const size_t local_size[], cl_uint wait_count, const cl_event* wait_list) {
+	cl_event event = NULL;
+	int err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_size, local_size, wait_count, wait_list, &event);
+	if (!errorCheck(err_num)) return NULL;
+	return event;
+}
+
+cl_event enqueueMinMax(cl_command_queue cmd_q, cl_kernel kernel, cl_mem src_cl, unsigned size, cl_mem min_max_cl, cl_uint wait_count, const cl_event* wait_list) {
+	// The tree reduction needs a power of two work-group size the kernel can run with. The kernel is built for a single device
+	size_t kernel_max = 1;
+	clGetKernelWorkGroupInfo(kernel, NULL, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_max, NULL);
+	size_t local_size = 1;
+	while (local_size * 2 <= MIN_MAX_GROUP_SIZE && local_size * 2 <= kernel_max) local_size *= 2;
+	size_t groups = (size + local_size - 1) / local_size;
+	if (groups > MIN_MAX_GROUPS) groups = MIN_MAX_GROUPS;
+	if (groups == 0) groups = 1;
+	size_t global_size = groups * local_size;
+
+	// Start from values every pixel replaces
+	cl_uint initial[] = { 255, 0 };
+	cl_event reset_event;
+	int err_num = clEnqueueFillBuffer(cmd_q, min_max_cl, initial, sizeof(initial), 0, sizeof(initial), wait_count, wait_list, &reset_event);
+	if (!errorCheck(err_num)) return NULL;
+	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_cl);
+	err_num |= clSetKernelArg(kernel, 1, sizeof(unsigned int), &size);
+	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &min_max_cl);
+	err_num |= clSetKernelArg(kernel, 3, local_size * sizeof(cl_uint), NULL);
+	err_num |= clSetKernelArg(kernel, 4, local_size * sizeof(cl_uint), NULL);
+	if (!errorCheck(err_num)) {
+		clReleaseEvent(reset_event);
+		return NULL;
+	}
+	cl_event event = NULL;
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 1, NULL, &global_size, &local_size, 1, &reset_event, &event);
+	clReleaseEvent(reset_event);
+	if (!errorCheck(err_num)) return NULL;
+	return event;
+}
+
+cl_event readBufferAsync(cl_command_queue cmd_q, cl_mem buffer, unsigned w, unsigned h, Image& out, cl_uint wait_count, const cl_event* wait_list) {
+	cl_event event = NULL;
+	out.Allocate(w, h);
+	int err_num = clEnqueueReadBuffer(cmd_q, buffer, CL_FALSE, 0, w * h * sizeof(unsigned char), out.Data(), wait_count, wait_list, &event);
+	if (!errorCheck(err_num)) return NULL;
+	return event;
+}
+
+cl_int setTiledZNCCArgs(cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl, unsigned w, unsigned h,
+	int window_y, int window_x, int min_disparity, int max_disparity, const size_t group_size[], size_t global_size[]) {
+	// Same tile sizes as in calc_zncc_tiled.cl
+	size_t tile_h = group_size[1] + 2 * (window_y / 2) - 1;
+	size_t left_w = group_size[0] + 2 * (window_x / 2) - 1;
+	size_t right_w = left_w - 1 + max_disparity - min_disparity;
+	global_size[0] = (w + group_size[0] - 1) / group_size[0] * group_size[0];
+	global_size[1] = (h + group_size[1] - 1) / group_size[1] * group_size[1];
+
+	cl_int err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &left_cl);
+	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &right_cl);
+	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &dst_cl);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &h);
+	// Local memory arguments only give the size
+	err_num |= clSetKernelArg(kernel, 5, tile_h * left_w, NULL);
+	err_num |= clSetKernelArg(kernel, 6, tile_h * right_w, NULL);
+	return err_num;
+}
+
+cl_event enqueueTiledZNCC(cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl, unsigned w, unsigned h,
+	int window_y, int window_x, int min_disparity, int max_disparity, const size_t group_size[], cl_uint wait_count, const cl_event* wait_list) {
+	size_t global_size[2];
+	size_t local_size[] = { group_size[0], group_size[1] };
+	int err_num = setTiledZNCCArgs(kernel, left_cl, right_cl, dst_cl, w, h, window_y, window_x, min_disparity, max_disparity, group_size, global_size);
+	if (!errorCheck(err_num)) return NULL;
+	return enqueueKernel(cmd_q, kernel, global_size, local_size, wait_count, wait_list);
+}
+
+cl_int setBidirectionalZNCCArgs(cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_left_cl, cl_mem dst_right_cl, unsigned w, unsigned h,
+	const size_t group_size[], size_t global_size[]) {
+	// Every work-group row keeps a score and a disparity of both maps for every pixel of its image row
+	size_t row_count = group_size[1] * w;
+	global_size[0] = group_size[0];
+	global_size[1] = (h + group_size[1] - 1) / group_size[1] * group_size[1];
+
+	cl_int err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &left_cl);
+	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &right_cl);
+	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &dst_left_cl);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &dst_right_cl);
+	err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &h);
+	// Local memory arguments only give the size
+	err_num |= clSetKernelArg(kernel, 6, row_count * sizeof(cl_float), NULL);
+	err_num |= clSetKernelArg(kernel, 7, row_count * sizeof(cl_float), NULL);
+	err_num |= clSetKernelArg(kernel, 8, row_count * sizeof(cl_short), NULL);
+	err_num |= clSetKernelArg(kernel, 9, row_count * sizeof(cl_short), NULL);
+	return err_num;
+}
+
+cl_event enqueueBidirectionalZNCC(cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_left_cl, cl_mem dst_right_cl,
+	unsigned w, unsigned h, const size_t group_size[], cl_uint wait_count, const cl_event* wait_list) {
+	size_t global_size[2];
+	size_t local_size[] = { group_size[0], group_size[1] };
+	int err_num = setBidirectionalZNCCArgs(kernel, left_cl, right_cl, dst_left_cl, dst_right_cl, w, h, group_size, global_size);
+	if (!errorCheck(err_num)) return NULL;
+	return enqueueKernel(cmd_q, kernel, global_size, local_size, wait_count, wait_list);
+}
+
+cl_int setCrossFillArgs(cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem cross_cl, cl_mem fill_cl, cl_mem range_cl,
+	unsigned w, unsigned h, int threshold, int radius, const size_t group_size[], size_t global_size[]) {
+	// Same tile size as in cross_fill.cl
+	size_t tile_size = (group_size[0] + 2 * radius) * (group_size[1] + 2 * radius);
+	global_size[0] = (w + group_size[0] - 1) / group_size[0] * group_size[0];
+	global_size[1] = (h + group_size[1] - 1) / group_size[1] * group_size[1];
+
+	cl_int err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &left_cl);
+	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &right_cl);
+	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &fill_cl);
+	err_num |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &range_cl);
+	err_num |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(kernel, 6, sizeof(unsigned int), &h);
+	err_num |= clSetKernelArg(kernel, 7, sizeof(int), &threshold);
+	err_num |= clSetKernelArg(kernel, 8, sizeof(int), &radius);
+	err_num |= clSetKernelArg(kernel, 9, tile_size, NULL);
+	return err_num;
+}
+
+cl_event enqueueCrossFill(cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem cross_cl, cl_mem fill_cl, cl_mem range_cl,
+	unsigned w, unsigned h, int threshold, int radius, const size_t group_size[], cl_uint wait_count, const cl_event* wait_list) {
+	size_t global_size[2];
+	size_t local_size[] = { group_size[0], group_size[1] };
+	int err_num = setCrossFillArgs(kernel, left_cl, right_cl, cross_cl, fill_cl, range_cl, w, h, threshold, radius, group_size, global_size);
+	if (!errorCheck(err_num)) return NULL;
+	// Start from values every pixel replaces
+	cl_uint initial[] = { 255, 0, 255, 0 };
+	cl_event reset_event;
+	err_num = clEnqueueFillBuffer(cmd_q, range_cl, initial, sizeof(initial), 0, sizeof(initial), wait_count, wait_list, &reset_event);
+	if (!errorCheck(err_num)) return NULL;
+	cl_event event = enqueueKernel(cmd_q, kernel, global_size, local_size, 1, &reset_event);
+	clReleaseEvent(reset_event);
+	return event;
+}
+
+cl_event enqueueSGMAggregate(cl_command_queue cmd_q, cl_kernel kernel, cl_mem cost_cl, cl_mem sum_cl, cl_mem carry_in_cl, cl_mem carry_out_cl,
+	unsigned w, int rows, int sum_rows, int dx, int dy, int p1, int p2, int disparity_count, int first_path, int has_carry, cl_uint wait_count, const cl_event* wait_list) {
+	// The minimum over the disparities is a tree reduction, so the work-group size is a power of two. The kernel is built for a single device
+	size_t kernel_max = 1;
+	clGetKernelWorkGroupInfo(kernel, NULL, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_max, NULL);
+	size_t local_size = 1;
+	while (local_size * 2 <= kernel_max && local_size * 2 <= (size_t)disparity_count) local_size *= 2;
+	// Every scanline starts on the first or last row, or on the column the path enters from
+	size_t lines = dy == 0 ? sum_rows : w + (dx != 0 ? (dy > 0 ? sum_rows : rows) - 1 : 0);
+	size_t global_size = lines * local_size;
+
+	cl_int err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &cost_cl);
+	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &sum_cl);
+	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &carry_in_cl);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &carry_out_cl);
+	err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(kernel, 5, sizeof(int), &rows);
+	err_num |= clSetKernelArg(kernel, 6, sizeof(int), &sum_rows);
+	err_num |= clSetKernelArg(kernel, 7, sizeof(int), &dx);
+	err_num |= clSetKernelArg(kernel, 8, sizeof(int), &dy);
+	err_num |= clSetKernelArg(kernel, 9, sizeof(int), &p1);
+	err_num |= clSetKernelArg(kernel, 10, sizeof(int), &p2);
+	err_num |= clSetKernelArg(kernel, 11, sizeof(int), &first_path);
+	err_num |= clSetKernelArg(kernel, 12, sizeof(int), &has_carry);
+	err_num |= clSetKernelArg(kernel, 13, local_size * sizeof(cl_int), NULL);
+	if (!errorCheck(err_num)) return NULL;
+	cl_event event = NULL;
+	err_num = clEnqueueNDRangeKernel(cmd_q, kernel, 1, NULL, &global_size, &local_size, wait_count, wait_list, &event);
+	if (!errorCheck(err_num)) return NULL;
+	return event;
+}
+
+std::string znccBuildOptions(int window_y, int window_x, int min_disparity, int max_disparity) {
+	char options[128];
+	snprintf(options, sizeof(options), "-D WINDOW_Y=%d -D WINDOW_X=%d -D MIN_DISPARITY=%d -D MAX_DISPARITY=%d", window_y, window_x, min_disparity, max_disparity);
+	return options;
+}
+
+std::string sgmBuildOptions(int window_y, int window_x, int min_disparity, int max_disparity, int cost_scale) {
+	char options[32];
+	snprintf(options, sizeof(options), " -D SGM_COST_SCALE=%d", cost_scale);
+	return znccBuildOptions(window_y, window_x, min_disparity, max_disparity) + options;
+}
+
+double eventMilliseconds(cl_event event) {
+	return eventMilliseconds(event, event);
+}
+
+double eventMilliseconds(cl_event first_event, cl_event last_event) {
+	cl_ulong opencl_start = 0, opencl_end = 0;
+	clGetEventProfilingInfo(first_event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &opencl_start, NULL);
+	clGetEventProfilingInfo(last_event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &opencl_end, NULL);
+	return (cl_double)(opencl_end - opencl_start) * (cl_double)(1e-06);
 }
\ No newline at end of file
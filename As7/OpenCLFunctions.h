@@ -7,6 +7,8 @@
 *********************************************************/
 
 #include <vector>
+#include <string>
+#include "Image.h"
 // OpenCL include
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
@@ -14,6 +16,9 @@
 #include <CL/cl.h>
 #endif // __APPLE__
 
+#define MIN_MAX_GROUP_SIZE 256 // Largest work-group size of the min_max kernel
+#define MIN_MAX_GROUPS 64 // Largest number of work-groups of the min_max kernel. Each one does two atomics
+
 /*
 * \brief Struct that holds the kernel function and its size
 * \param source_str Contents of the Kernel. Must bee freed at the end of the program
@@ -31,6 +36,14 @@ typedef struct {
 */
 int errorCheck(cl_int err_num);
 
+/*
+* \brief Sets whether errorCheck waits for a key after printing an error. A server turns this off, so an error fails the job
+* and is returned to the caller instead of blocking every job after it
+* \param interactive 1 to wait for a key, which is the default; 0 to only print the error
+* \return Nothing
+*/
+void setErrorCheckInteractive(int interactive);
+
 /*
 * \brief Reads a kernel function from a given function
 * \param fileName Name of the kernel file
@@ -49,6 +62,14 @@ int loadKernel(char file_name[], kernel_source *src);
 */
 cl_kernel createKernel(cl_context context, cl_device_id device_id, char* kernel_name, const char** src, const size_t* size);
 
+/*
+* \brief Prints the build log of a program that failed to build
+* \param program Program that failed to build
+* \param device_id Device the program was built for
+* \return Nothing
+*/
+void printBuildLog(cl_program program, cl_device_id device_id);
+
 /*
 * \brief Selects the OpenCL device with the name "NVIDIA GeForce GTX 1070", prints its info and returns the deivce
 * \return GPU device id
@@ -80,12 +101,230 @@ cl_image_format getGrayImageFormat();
 * \param kernel OpenCL kernel for resize + grayscale
 * \param new_w Image width after resize
 * \param new_h Image height after resize
+* \param local_work_size Local work size
 * \param out_cl OpenCL mem object for the output image
 * \return The resulting image
 */
-std::vector<unsigned char> executeImageKernel(cl_command_queue cmd_q, cl_kernel kernel, unsigned new_w, unsigned new_h, cl_mem out_cl);
+Image executeImageKernel(cl_command_queue cmd_q, cl_kernel kernel, unsigned new_w, unsigned new_h, const size_t local_work_size[], cl_mem out_cl);
+
+
+Image executeBufferKernel(cl_command_queue cmd_q, cl_kernel kernel, size_t global_size[], size_t local_size[], unsigned new_w, unsigned new_h, cl_mem out_cl);
+
+/*
+* \brief Enqueues a 2D kernel without waiting for it to finish
+* \param cmd_q OpenCL command queue
+* \param kernel Kernel with its arguments already set
+* \param global_size Global work size
+* \param local_size Local work size
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the kernel starts. Can be NULL if wait_count is 0
+* \return Event of the kernel, NULL if failed
+*/
+cl_event enqueueKernel(cl_command_queue cmd_q, cl_kernel kernel, const size_t global_size[], const size_t local_size[], cl_uint wait_count, const cl_event* wait_list);
+
+/*
+* \brief Enqueues the min_max kernel, which stores the minimum and maximum of an unsigned char buffer in min_max_cl
+* without the host waiting for anything. min_max_cl is reset before the kernel starts
+* \param cmd_q OpenCL command queue
+* \param kernel min_max kernel
+* \param src_cl Buffer to go through
+* \param size Number of values in src_cl
+* \param min_max_cl Buffer of two unsigned ints, the minimum and the maximum are stored here
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the kernel starts, for example the one writing src_cl. Can be NULL if wait_count is 0
+* \return Event of the kernel, NULL if failed
+*/
+cl_event enqueueMinMax(cl_command_queue cmd_q, cl_kernel kernel, cl_mem src_cl, unsigned size, cl_mem min_max_cl, cl_uint wait_count, const cl_event* wait_list);
+
+/*
+* \brief Starts a non-blocking read of a w * h unsigned char buffer. out must not be touched before the returned event has finished
+* \param cmd_q OpenCL command queue
+* \param buffer Buffer to read
+* \param w Image width
+* \param h Image height
+* \param out Allocated here, the buffer is read into this image
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the read starts. Can be NULL if wait_count is 0
+* \return Event of the read, NULL if failed
+*/
+cl_event readBufferAsync(cl_command_queue cmd_q, cl_mem buffer, unsigned w, unsigned h, Image& out, cl_uint wait_count, const cl_event* wait_list);
+
+/*
+* \brief Sets the arguments of calc_zncc_tiled, sizing the local memory for the tiles from the work-group size, the window and the disparity range
+* \param kernel calc_zncc_tiled kernel built with znccBuildOptions(window_y, window_x, min_disparity, max_disparity)
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_cl Disparity map buffer
+* \param w Image width
+* \param h Image height
+* \param window_y Size of window's y axis the kernel was built with
+* \param window_x Size of window's x axis the kernel was built with
+* \param min_disparity Minimum disparity value the kernel was built with
+* \param max_disparity Maximum disparity value the kernel was built with
+* \param group_size Work-group width and height
+* \param global_size Global work size, rounded up to whole work-groups, is stored here
+* \return OpenCL error code
+*/
+cl_int setTiledZNCCArgs(cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl, unsigned w, unsigned h,
+	int window_y, int window_x, int min_disparity, int max_disparity, const size_t group_size[], size_t global_size[]);
+
+/*
+* \brief Sets the arguments of calc_zncc_tiled and enqueues it. The global size is rounded up to whole work-groups,
+* and the local memory for the tiles is sized from the work-group size, the window and the disparity range
+* \param cmd_q OpenCL command queue
+* \param kernel calc_zncc_tiled kernel built with znccBuildOptions(window_y, window_x, min_disparity, max_disparity)
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_cl Disparity map buffer. Pixels too close to the borders are not written
+* \param w Image width
+* \param h Image height
+* \param window_y Size of window's y axis the kernel was built with
+* \param window_x Size of window's x axis the kernel was built with
+* \param min_disparity Minimum disparity value the kernel was built with
+* \param max_disparity Maximum disparity value the kernel was built with
+* \param group_size Work-group width and height
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the kernel starts. Can be NULL if wait_count is 0
+* \return Event of the kernel, NULL if failed
+*/
+cl_event enqueueTiledZNCC(cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl, unsigned w, unsigned h,
+	int window_y, int window_x, int min_disparity, int max_disparity, const size_t group_size[], cl_uint wait_count, const cl_event* wait_list);
+
+/*
+* \brief Sets the arguments of calc_zncc_bidir, sizing the local memory for the best scores of both maps from the image width
+* and the work-group height. A work-group handles whole rows, so the global size is one work-group wide
+* \param kernel calc_zncc_bidir kernel built with znccBuildOptions(window_y, window_x, min_disparity, max_disparity)
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_left_cl Disparity map with left_cl as the left image
+* \param dst_right_cl Disparity map with right_cl as the left image
+* \param w Image width
+* \param h Image height
+* \param group_size Work-group width and height. The height is the number of rows a work-group handles
+* \param global_size Global work size is stored here
+* \return OpenCL error code
+*/
+cl_int setBidirectionalZNCCArgs(cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_left_cl, cl_mem dst_right_cl, unsigned w, unsigned h,
+	const size_t group_size[], size_t global_size[]);
 
+/*
+* \brief Sets the arguments of calc_zncc_bidir and enqueues it. Both disparity maps come from the same launch
+* \param cmd_q OpenCL command queue
+* \param kernel calc_zncc_bidir kernel built with znccBuildOptions(window_y, window_x, min_disparity, max_disparity)
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_left_cl Disparity map with left_cl as the left image. Pixels too close to the borders are not written
+* \param dst_right_cl Disparity map with right_cl as the left image. Pixels too close to the borders are not written
+* \param w Image width
+* \param h Image height
+* \param group_size Work-group width and height
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the kernel starts. Can be NULL if wait_count is 0
+* \return Event of the kernel, NULL if failed
+*/
+cl_event enqueueBidirectionalZNCC(cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_left_cl, cl_mem dst_right_cl,
+	unsigned w, unsigned h, const size_t group_size[], cl_uint wait_count, const cl_event* wait_list);
 
-std::vector<unsigned char> executeBufferKernel(cl_command_queue cmd_q, cl_kernel kernel, size_t global_size[], size_t local_size[], unsigned new_w, unsigned new_h, cl_mem out_cl);
+/*
+* \brief Sets the arguments of cross_fill, sizing the local memory for the tile from the work-group size and the search radius
+* \param kernel cross_fill kernel
+* \param left_cl Disparity map with im0 as the left image
+* \param right_cl Disparity map with im1 as the left image
+* \param cross_cl Cross checked disparity map is written here
+* \param fill_cl Occlusion filled disparity map is written here
+* \param range_cl Buffer of four unsigned ints, the minimum and maximum of cross_cl and fill_cl are stored here
+* \param w Image width
+* \param h Image height
+* \param threshold Largest difference the cross check allows
+* \param radius Search radius of the occlusion fill in local memory. Farther pixels are searched from global memory
+* \param group_size Work-group width and height
+* \param global_size Global work size, rounded up to whole work-groups, is stored here
+* \return OpenCL error code
+*/
+cl_int setCrossFillArgs(cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem cross_cl, cl_mem fill_cl, cl_mem range_cl,
+	unsigned w, unsigned h, int threshold, int radius, const size_t group_size[], size_t global_size[]);
+
+/*
+* \brief Resets range_cl, sets the arguments of cross_fill and enqueues it
+* \param cmd_q OpenCL command queue
+* \param kernel cross_fill kernel
+* \param left_cl Disparity map with im0 as the left image
+* \param right_cl Disparity map with im1 as the left image
+* \param cross_cl Cross checked disparity map is written here
+* \param fill_cl Occlusion filled disparity map is written here
+* \param range_cl Buffer of four unsigned ints for normalize_cross_fill
+* \param w Image width
+* \param h Image height
+* \param threshold Largest difference the cross check allows
+* \param radius Search radius of the occlusion fill in local memory
+* \param group_size Work-group width and height
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the kernel starts, for example both CalcZNCC kernels. Can be NULL if wait_count is 0
+* \return Event of the kernel, NULL if failed
+*/
+cl_event enqueueCrossFill(cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem cross_cl, cl_mem fill_cl, cl_mem range_cl,
+	unsigned w, unsigned h, int threshold, int radius, const size_t group_size[], cl_uint wait_count, const cl_event* wait_list);
+
+/*
+* \brief Sets the arguments of sgm_aggregate and enqueues it with one work-group per scanline of the path. The work-group size is the
+* largest power of two the kernel can run with that is not above the number of disparities
+* \param cmd_q OpenCL command queue
+* \param kernel sgm_aggregate kernel built with sgmBuildOptions
+* \param cost_cl Costs of the band from sgm_cost
+* \param sum_cl Path sums of the band. The path is added to them
+* \param carry_in_cl Aggregated costs of the last row of the previous band, from the same path
+* \param carry_out_cl Aggregated costs of the last row of this band are stored here by paths going down. Must not be carry_in_cl
+* \param w Image width
+* \param rows Rows in cost_cl, the band and the overlap rows below it
+* \param sum_rows Rows in the band
+* \param dx Step of the path along x, -1, 0 or 1
+* \param dy Step of the path along y, -1, 0 or 1
+* \param p1 Penalty of a disparity change of one
+* \param p2 Penalty of larger disparity changes
+* \param disparity_count Number of disparities the kernel was built with
+* \param first_path 1 if the path sums are overwritten instead of added to. Only for a path going along x, which covers every pixel
+* \param has_carry 0 for the first band, so paths going down do not read carry_in_cl
+* \param wait_count Number of events in wait_list
+* \param wait_list Events that must be finished before the kernel starts. Can be NULL if wait_count is 0
+* \return Event of the kernel, NULL if failed
+*/
+cl_event enqueueSGMAggregate(cl_command_queue cmd_q, cl_kernel kernel, cl_mem cost_cl, cl_mem sum_cl, cl_mem carry_in_cl, cl_mem carry_out_cl,
+	unsigned w, int rows, int sum_rows, int dx, int dy, int p1, int p2, int disparity_count, int first_path, int has_carry, cl_uint wait_count, const cl_event* wait_list);
+
+/*
+* \brief Returns the build options that set the window size and disparity range of calc_zncc.cl and calc_zncc_tiled.cl
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return Options for clBuildProgram
+*/
+std::string znccBuildOptions(int window_y, int window_x, int min_disparity, int max_disparity);
+
+/*
+* \brief Returns the build options of sgm.cl, the ones of znccBuildOptions and the cost of the worst ZNCC score
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \param cost_scale Cost of the worst ZNCC score, SGM_COST_SCALE
+* \return Options for clBuildProgram
+*/
+std::string sgmBuildOptions(int window_y, int window_x, int min_disparity, int max_disparity, int cost_scale);
+
+/*
+* \brief Returns how long the command of a finished event ran. The command queue must have profiling enabled
+* \param event Finished event
+* \return Execution time in milliseconds
+*/
+double eventMilliseconds(cl_event event);
+
+/*
+* \brief Returns the time from the start of one finished command to the end of another, for stages of several kernels
+* \param first_event Event of the first command
+* \param last_event Event of the last command
+* \return Time in milliseconds
+*/
+double eventMilliseconds(cl_event first_event, cl_event last_event);
 
 #endif
\ No newline at end of file
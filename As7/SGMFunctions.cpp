@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <vector>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include "SGMFunctions.h"
+#include "ZNCCFunctions.h"
+#include "Timer.h"
+
+#include <omp.h>
+
+/* Sources:
+* "Stereo Processing by Semiglobal Matching and Mutual Information" - https://core.ac.uk/download/pdf/11134866.pdf
+* "Intel Intrinsics Guide" - https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+*/
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SGM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define SGM_TARGET(isa) // MSVC allows intrinsics of any instruction set without extra flags
+#else
+#define SGM_TARGET(isa) __attribute__((target(isa)))
+#endif
+#else
+#define SGM_X86 0
+#endif
+
+#define SGM_COST_ROWS 16 // Rows of one ComputeCostVolume call. Their float scores are turned into int16 costs right away
+#define SGM_SENTINEL 0x3FFF // Aggregated cost on both sides of the disparity range. Above any real one, and adding P1 does not overflow
+
+const sgm_path sgm_paths[SGM_MAX_PATHS] = {
+	{ 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 },
+	{ 1, 1 }, { -1, 1 }, { 1, -1 }, { -1, -1 },
+};
+
+/*
+* \brief Kernel that aggregates one pixel of a path. prev and out have an SGM_SENTINEL before and after their disparity_count values
+* \param cost Matching costs of the pixel
+* \param prev Aggregated costs of the previous pixel on the path
+* \param prev_min Smallest value of prev
+* \param out Aggregated costs of the pixel are stored here
+* \param sum out is added to these path sums. NULL for rows below the band
+* \return Smallest value of out
+*/
+typedef short (*sgm_path_kernel)(const short* cost, const short* prev, short prev_min, int p1, int p2, int disparity_count, short* out, short* sum);
+
+/*
+* \brief Costs and path sums of one band of rows. Both are pixel-major, the disparity_count values of pixel (x, y) start at ((y - y0) * w + x) * disparity_count
+* \param cost Costs of rows [y0, y_end)
+* \param sum Path sums of rows [y0, y1)
+*/
+typedef struct {
+	std::vector<short> cost;
+	std::vector<short> sum;
+	int w;
+	int y0;
+	int y1;
+	int y_end;
+	int disparity_count;
+} sgm_band;
+
+
+short SGMCost(float score) {
+	// Flat windows and windows outside the image already have the worst score, -1. Rounding can take scores a little past 1
+	float cost = (1.0f - score) * (SGM_COST_SCALE / 2) + 0.5f;
+	return (short)std::min(std::max(cost, 0.0f), (float)SGM_COST_SCALE);
+}
+
+/*
+* \brief Scalar aggregation of disparities [d0, d1) of one pixel, the same as the kernels
+* \return Smallest aggregated cost, SHRT_MAX if the range is empty
+*/
+static int AggregateRange(const short* cost, const short* prev, short prev_min, int p1, int p2, int d0, int d1, short* out, short* sum) {
+	int jump = prev_min + p2;
+	int out_min = SHRT_MAX;
+	for (int d = d0; d < d1; d++) {
+		int best = std::min(std::min((int)prev[d], prev[d - 1] + p1), std::min(prev[d + 1] + p1, jump));
+		int value = cost[d] + best - prev_min;
+		out[d] = (short)value;
+		if (sum != NULL) sum[d] += (short)value;
+		out_min = std::min(out_min, value);
+	}
+	return out_min;
+}
+
+static short AggregatePixelScalar(const short* cost, const short* prev, short prev_min, int p1, int p2, int disparity_count, short* out, short* sum) {
+	return (short)AggregateRange(cost, prev, prev_min, p1, p2, 0, disparity_count, out, sum);
+}
+
+#if SGM_X86
+/*
+* \brief Aggregates 8 disparities at once. Disparities left over at the end use the scalar code
+*/
+SGM_TARGET("sse4.1")
+static short AggregatePixelSSE41(const short* cost, const short* prev, short prev_min, int p1, int p2, int disparity_count, short* out, short* sum) {
+	__m128i v_p1 = _mm_set1_epi16((short)p1);
+	__m128i v_jump = _mm_set1_epi16((short)(prev_min + p2));
+	__m128i v_prev_min = _mm_set1_epi16(prev_min);
+	__m128i v_min = _mm_set1_epi16(SHRT_MAX);
+	int d = 0;
+	for (; d + 8 <= disparity_count; d += 8) {
+		// The neighbors come from unaligned loads one value to the left and right, the sentinels cover both ends
+		__m128i same = _mm_loadu_si128((const __m128i*)(prev + d));
+		__m128i lower = _mm_adds_epi16(_mm_loadu_si128((const __m128i*)(prev + d - 1)), v_p1);
+		__m128i upper = _mm_adds_epi16(_mm_loadu_si128((const __m128i*)(prev + d + 1)), v_p1);
+		__m128i best = _mm_min_epi16(_mm_min_epi16(same, lower), _mm_min_epi16(upper, v_jump));
+		__m128i value = _mm_add_epi16(_mm_sub_epi16(best, v_prev_min), _mm_loadu_si128((const __m128i*)(cost + d)));
+		_mm_storeu_si128((__m128i*)(out + d), value);
+		if (sum != NULL) _mm_storeu_si128((__m128i*)(sum + d), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(sum + d)), value));
+		v_min = _mm_min_epi16(v_min, value);
+	}
+	// Aggregated costs are never negative, so the unsigned minpos finds the smallest one
+	int out_min = _mm_extract_epi16(_mm_minpos_epu16(v_min), 0);
+	return (short)std::min(out_min, AggregateRange(cost, prev, prev_min, p1, p2, d, disparity_count, out, sum));
+}
+
+/*
+* \brief Aggregates 16 disparities at once. Disparities left over at the end use the scalar code
+*/
+SGM_TARGET("avx2")
+static short AggregatePixelAVX2(const short* cost, const short* prev, short prev_min, int p1, int p2, int disparity_count, short* out, short* sum) {
+	__m256i v_p1 = _mm256_set1_epi16((short)p1);
+	__m256i v_jump = _mm256_set1_epi16((short)(prev_min + p2));
+	__m256i v_prev_min = _mm256_set1_epi16(prev_min);
+	__m256i v_min = _mm256_set1_epi16(SHRT_MAX);
+	int d = 0;
+	for (; d + 16 <= disparity_count; d += 16) {
+		__m256i same = _mm256_loadu_si256((const __m256i*)(prev + d));
+		__m256i lower = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i*)(prev + d - 1)), v_p1);
+		__m256i upper = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i*)(prev + d + 1)), v_p1);
+		__m256i best = _mm256_min_epi16(_mm256_min_epi16(same, lower), _mm256_min_epi16(upper, v_jump));
+		__m256i value = _mm256_add_epi16(_mm256_sub_epi16(best, v_prev_min), _mm256_loadu_si256((const __m256i*)(cost + d)));
+		_mm256_storeu_si256((__m256i*)(out + d), value);
+		if (sum != NULL) _mm256_storeu_si256((__m256i*)(sum + d), _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(sum + d)), value));
+		v_min = _mm256_min_epi16(v_min, value);
+	}
+	__m128i halves_min = _mm_min_epi16(_mm256_castsi256_si128(v_min), _mm256_extracti128_si256(v_min, 1));
+	int out_min = _mm_extract_epi16(_mm_minpos_epu16(halves_min), 0);
+	return (short)std::min(out_min, AggregateRange(cost, prev, prev_min, p1, p2, d, disparity_count, out, sum));
+}
+#endif
+
+/*
+* \brief Sets the aggregated costs of a row of pixels to zero, what the first pixel of a path starts from, and the sentinels around them
+*/
+static void ResetPathState(std::vector<short>& state, std::vector<short>& state_min, int w, int disparity_count) {
+	int stride = disparity_count + 2;
+	state.assign((size_t)w * stride, 0);
+	state_min.assign(w, 0);
+	for (int x = 0; x < w; x++) {
+		state[(size_t)x * stride] = SGM_SENTINEL;
+		state[(size_t)x * stride + stride - 1] = SGM_SENTINEL;
+	}
+}
+
+/*
+* \brief Fills the costs of image rows [y_from, y_to) of the band, SGM_COST_ROWS rows per ComputeCostVolume call
+*/
+static void FillBandCosts(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity, int y_from, int y_to, sgm_band& band) {
+	int w = band.w, count = band.disparity_count;
+	int chunk_count = (y_to - y_from + SGM_COST_ROWS - 1) / SGM_COST_ROWS;
+
+#pragma omp parallel
+	{
+		// One volume per thread, reused for every chunk the thread handles
+		cost_volume volume;
+#pragma omp for schedule(dynamic)
+		for (int chunk = 0; chunk < chunk_count; chunk++) {
+			int y0 = y_from + chunk * SGM_COST_ROWS;
+			int y1 = std::min(y_to, y0 + SGM_COST_ROWS);
+			ComputeCostVolume(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity, y0, y1, &volume);
+			// The volume is disparity-major, but the paths want the disparities of a pixel next to each other
+			for (int i = 0; i < count; i++) {
+				for (int y = y0; y < y1; y++) {
+					const float* scores = &volume.scores[((size_t)i * volume.rows + y - y0) * w];
+					short* cost = &band.cost[(size_t)(y - band.y0) * w * count + i];
+					for (int x = 0; x < w; x++) cost[(size_t)x * count] = SGMCost(scores[x]);
+				}
+			}
+		}
+	}
+}
+
+/*
+* \brief Aggregates a horizontal path along every row of the band and adds it to the sums. Rows are independent, so they run in parallel
+*/
+static void AggregateRows(sgm_band& band, sgm_path path, int p1, int p2, sgm_path_kernel kernel) {
+	int w = band.w, count = band.disparity_count;
+
+#pragma omp parallel
+	{
+		// Aggregated costs of the previous and the current pixel
+		std::vector<short> prev, out, prev_mins, out_mins;
+		ResetPathState(out, out_mins, 1, count);
+#pragma omp for
+		for (int y = band.y0; y < band.y1; y++) {
+			ResetPathState(prev, prev_mins, 1, count);
+			short prev_min = 0;
+			for (int i = 0; i < w; i++) {
+				int x = path.dx > 0 ? i : w - 1 - i;
+				size_t pixel = ((size_t)(y - band.y0) * w + x) * count;
+				prev_min = kernel(&band.cost[pixel], &prev[1], prev_min, p1, p2, count, &out[1], &band.sum[pixel]);
+				prev.swap(out);
+			}
+		}
+	}
+}
+
+/*
+* \brief Aggregates a path going down or up one row at a time and adds it to the sums. Paths going down cover the band's rows,
+* paths going up also the overlap rows below it, but only add the band's rows to the sums
+* \param state Aggregated costs of the row the path comes from, see ResetPathState. The last row is left here
+* \param state_min Smallest aggregated cost of every pixel in state
+*/
+static void AggregateColumns(sgm_band& band, sgm_path path, int p1, int p2, sgm_path_kernel kernel, std::vector<short>& state, std::vector<short>& state_min) {
+	int w = band.w, count = band.disparity_count, stride = count + 2;
+	// Pixels whose previous pixel is outside the image start from zeros, like the first pixel of a row
+	std::vector<short> next, next_min, zeros, zeros_min;
+	ResetPathState(next, next_min, w, count);
+	ResetPathState(zeros, zeros_min, 1, count);
+	int first = path.dy > 0 ? band.y0 : band.y_end - 1;
+	int rows = path.dy > 0 ? band.y1 - band.y0 : band.y_end - band.y0;
+
+	for (int i = 0; i < rows; i++) {
+		int y = first + i * path.dy;
+		const short* cost = &band.cost[(size_t)(y - band.y0) * w * count];
+		short* sum = y < band.y1 ? &band.sum[(size_t)(y - band.y0) * w * count] : NULL;
+#pragma omp parallel for
+		for (int x = 0; x < w; x++) {
+			int prev_x = x - path.dx;
+			bool inside = prev_x >= 0 && prev_x < w;
+			const short* prev = inside ? &state[(size_t)prev_x * stride + 1] : &zeros[1];
+			short prev_min = inside ? state_min[prev_x] : 0;
+			next_min[x] = kernel(cost + (size_t)x * count, prev, prev_min, p1, p2, count, &next[(size_t)x * stride + 1], sum != NULL ? sum + (size_t)x * count : NULL);
+		}
+		state.swap(next);
+		state_min.swap(next_min);
+	}
+}
+
+/*
+* \brief Picks the disparity with the smallest path sum for every pixel of the band. Ties go to the smallest disparity
+*/
+static void WinnerTakeAllSGM(const sgm_band& band, int min_disparity, ImageSpan disparity_map) {
+	int w = band.w, count = band.disparity_count;
+
+#pragma omp parallel for
+	for (int y = band.y0; y < band.y1; y++) {
+		unsigned char* dst = disparity_map.Row(y);
+		for (int x = 0; x < w; x++) {
+			const short* sum = &band.sum[((size_t)(y - band.y0) * w + x) * count];
+			int best = 0;
+			for (int i = 1; i < count; i++) best = sum[i] < sum[best] ? i : best;
+			dst[x] = abs(min_disparity + best); // Use absolute value of the disparity
+		}
+	}
+}
+
+Image CalcZNCCSGM(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity, int paths, int p1, int p2) {
+	int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	int count = std::max(1, max_disparity - min_disparity);
+	paths = paths >= SGM_MAX_PATHS ? SGM_MAX_PATHS : 4;
+	p2 = std::min(p2, SGM_MAX_P2);
+	p1 = std::min(p1, p2);
+
+	// Pick the aggregation kernel. AVX-512 CPUs use the AVX2 one
+	const char* level_names[] = { "scalar", "SSE4.1", "AVX2", "AVX2" };
+	simd_level level = DetectSimdLevel();
+	sgm_path_kernel kernel = AggregatePixelScalar;
+#if SGM_X86
+	if (level >= SIMD_AVX2) kernel = AggregatePixelAVX2;
+	else if (level >= SIMD_SSE41) kernel = AggregatePixelSSE41;
+#endif
+	printf("Using the %s SGM kernel, %d paths\n", level_names[level], paths);
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	integral_image left_table, right_table;
+	BuildIntegralImage(img_left, &left_table);
+	BuildIntegralImage(img_right, &right_table);
+
+	// Paths going down carry their last row from band to band
+	std::vector<short> states[SGM_MAX_PATHS], state_mins[SGM_MAX_PATHS];
+	for (int p = 0; p < paths; p++) {
+		if (sgm_paths[p].dy > 0) ResetPathState(states[p], state_mins[p], w, count);
+	}
+	std::vector<short> up_state, up_state_min;
+	size_t row_size = (size_t)w * count;
+	sgm_band band;
+	band.w = w;
+	band.disparity_count = count;
+	band.y0 = band.y_end = 0;
+
+	for (int y0 = 0; y0 < h; y0 += SGM_BAND_HEIGHT) {
+		int y1 = std::min(h, y0 + SGM_BAND_HEIGHT);
+		int y_end = std::min(h, y1 + SGM_BAND_OVERLAP);
+		// The overlap rows of the previous band are the first rows of this one, so their costs are moved instead of calculated again
+		int kept = std::max(0, band.y_end - y0);
+		if (kept > 0) std::copy(band.cost.begin() + (y0 - band.y0) * row_size, band.cost.begin() + (band.y_end - band.y0) * row_size, band.cost.begin());
+		band.cost.resize((y_end - y0) * row_size);
+		band.y0 = y0;
+		band.y1 = y1;
+		band.y_end = y_end;
+		FillBandCosts(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity, y0 + kept, y_end, band);
+		band.sum.assign((y1 - y0) * row_size, 0);
+
+		for (int p = 0; p < paths; p++) {
+			if (sgm_paths[p].dy == 0) {
+				AggregateRows(band, sgm_paths[p], p1, p2, kernel);
+			}
+			else if (sgm_paths[p].dy > 0) {
+				AggregateColumns(band, sgm_paths[p], p1, p2, kernel, states[p], state_mins[p]);
+			}
+			else {
+				ResetPathState(up_state, up_state_min, w, count);
+				AggregateColumns(band, sgm_paths[p], p1, p2, kernel, up_state, up_state_min);
+			}
+		}
+		WinnerTakeAllSGM(band, min_disparity, disparity_map.Span());
+	}
+
+	StopTimer(&timer, "ZNCC calculated with SGM aggregation");
+	return disparity_map;
+}
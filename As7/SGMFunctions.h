@@ -0,0 +1,60 @@
+#ifndef SGMFUNCTIONS_H_INCLUDED
+#define SGMFUNCTIONS_H_INCLUDED
+
+/*********************************************************
+* SEMI-GLOBAL MATCHING ON TOP OF THE ZNCC COST VOLUME
+* ZNCC scores are turned into int16 matching costs, and the costs are aggregated along 4 or 8 scanline paths
+* with the P1 and P2 smoothness penalties before the winner-take-all
+*********************************************************/
+
+#include "Image.h"
+
+#define SGM_COST_SCALE 1024 // Cost of the worst ZNCC score, -1. The best score, 1, costs 0
+#define SGM_MAX_P2 (32767 / 8 - SGM_COST_SCALE) // Largest P2, so the sum of 8 paths fits in int16
+#define SGM_BAND_HEIGHT 64 // Rows aggregated at once. Memory use depends on this, not on the image height
+#define SGM_BAND_OVERLAP 16 // Extra rows below a band where the bottom-up paths start
+#define SGM_MAX_PATHS 8
+
+/*
+* \brief Direction of one aggregation path. Every pixel takes the aggregated cost of the pixel (x - dx, y - dy)
+* \param dx Step along x, -1, 0 or 1
+* \param dy Step along y, -1, 0 or 1
+*/
+typedef struct {
+	int dx;
+	int dy;
+} sgm_path;
+
+/*
+* \brief The aggregation paths. The first 4 are the horizontal and vertical ones, all 8 add the diagonals
+*/
+extern const sgm_path sgm_paths[SGM_MAX_PATHS];
+
+/*
+* \brief Turns a ZNCC score into a matching cost. Windows without a score, ZNCC_NO_SCORE, get the worst cost
+* \param score ZNCC score between -1 and 1
+* \return Cost between 0 and SGM_COST_SCALE
+*/
+short SGMCost(float score);
+
+/*
+* \brief Calculates the disparity map with semi-global matching. The ZNCC scores come from ComputeCostVolume and the
+* costs are aggregated with L(p, d) = C(p, d) + min(L(p - r, d), L(p - r, d +- 1) + P1, min L(p - r) + P2) - min L(p - r)
+* along every path r. The minimum over the disparities is taken with int16 SSE4.1 or AVX2 instructions when the CPU has them.
+* Rows are aggregated in bands of SGM_BAND_HEIGHT. Paths going down carry their last row over to the next band, so they are exact.
+* Paths going up start SGM_BAND_OVERLAP rows below each band, so they only see that far down
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \param paths Number of aggregation paths, 4 or 8
+* \param p1 Penalty of a disparity change of one
+* \param p2 Penalty of larger disparity changes. Limited to SGM_MAX_P2
+* \return The result
+*/
+Image CalcZNCCSGM(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity, int paths, int p1, int p2);
+
+
+#endif
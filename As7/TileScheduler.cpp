@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include "TileScheduler.h"
+
+/* Sources:
+* "Scheduling Multithreaded Computations by Work Stealing" - http://supertech.csail.mit.edu/papers/steal.pdf
+*/
+
+typedef std::chrono::steady_clock steady_clock;
+
+
+TileScheduler::TileScheduler(unsigned int thread_count) : job(NULL), busy_workers(0), generation(0), stopping(false), run_seconds(0), utilization_totals(NULL) {
+	thread_count = std::max(1u, thread_count);
+	for (unsigned int i = 0; i < thread_count; i++) {
+		queues.push_back(std::unique_ptr<tile_queue>(new tile_queue()));
+	}
+	busy_seconds.assign(thread_count, 0);
+	tiles_done.assign(thread_count, 0);
+	tiles_stolen.assign(thread_count, 0);
+	// The thread calling Run is worker 0
+	for (unsigned int i = 1; i < thread_count; i++) {
+		threads.push_back(std::thread(&TileScheduler::WorkerLoop, this, i));
+	}
+}
+
+TileScheduler::~TileScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_ready.notify_all();
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+unsigned int TileScheduler::Size() const {
+	return queues.size();
+}
+
+void TileScheduler::Run(unsigned int w, unsigned int h, int tile_w, int tile_h, const std::function<void(const tile&)>& body) {
+	std::lock_guard<std::mutex> submit_lock(submit_mutex);
+	steady_clock::time_point start = steady_clock::now();
+	unsigned int thread_count = queues.size();
+	int tiles_x = (w + tile_w - 1) / tile_w;
+	int tiles_y = (h + tile_h - 1) / tile_h;
+	int tile_count = tiles_x * tiles_y;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// Give every thread a contiguous run of tiles, so neighbouring tiles stay on the same thread until stolen
+		for (int i = 0; i < tile_count; i++) {
+			tile t;
+			t.x0 = (i % tiles_x) * tile_w;
+			t.y0 = (i / tiles_x) * tile_h;
+			t.x1 = std::min((int)w, t.x0 + tile_w);
+			t.y1 = std::min((int)h, t.y0 + tile_h);
+			tile_queue& queue = *queues[(long long)i * thread_count / tile_count];
+			std::lock_guard<std::mutex> queue_lock(queue.mutex);
+			// Pushed to the front, so the owner pops them in image order from the back
+			queue.tiles.push_front(t);
+		}
+		std::fill(busy_seconds.begin(), busy_seconds.end(), 0);
+		std::fill(tiles_done.begin(), tiles_done.end(), 0);
+		std::fill(tiles_stolen.begin(), tiles_stolen.end(), 0);
+		job = &body;
+		busy_workers = threads.size();
+		generation++;
+	}
+	work_ready.notify_all();
+
+	// Work as thread 0, then wait for the others
+	RunTiles(0);
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [this] { return busy_workers == 0; });
+	job = NULL;
+	run_seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+bool TileScheduler::TakeTile(unsigned int worker, tile* out, bool* stolen) {
+	{
+		// Own tiles first, from the back
+		tile_queue& own = *queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tiles.empty()) {
+			*out = own.tiles.back();
+			own.tiles.pop_back();
+			*stolen = false;
+			return true;
+		}
+	}
+	// Steal from the front of the other threads' deques, which is the work they would reach last
+	for (unsigned int i = 1; i < queues.size(); i++) {
+		tile_queue& victim = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tiles.empty()) {
+			*out = victim.tiles.front();
+			victim.tiles.pop_front();
+			*stolen = true;
+			return true;
+		}
+	}
+	// Tiles are only added by Run, so every deque being empty means this thread is done
+	return false;
+}
+
+void TileScheduler::RunTiles(unsigned int worker) {
+	tile t;
+	bool stolen;
+	double busy = 0;
+	int done = 0, steals = 0;
+	while (TakeTile(worker, &t, &stolen)) {
+		steady_clock::time_point start = steady_clock::now();
+		(*job)(t);
+		busy += std::chrono::duration<double>(steady_clock::now() - start).count();
+		done++;
+		if (stolen) steals++;
+	}
+	// Every thread only writes its own entry
+	busy_seconds[worker] = busy;
+	tiles_done[worker] = done;
+	tiles_stolen[worker] = steals;
+}
+
+void TileScheduler::WorkerLoop(unsigned int worker) {
+	unsigned int seen_generation = 0;
+	while (true) {
+		{
+			// Sleep until Run hands out new tiles
+			std::unique_lock<std::mutex> lock(mutex);
+			work_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+			if (stopping) return;
+			seen_generation = generation;
+		}
+		RunTiles(worker);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy_workers--;
+			if (busy_workers == 0) work_done.notify_one();
+		}
+	}
+}
+
+void TileScheduler::PrintUtilization(const char* stage) const {
+	if (utilization_totals != NULL) {
+		utilization_total& total = (*utilization_totals)[stage];
+		total.run_seconds += run_seconds;
+		for (unsigned int i = 0; i < queues.size(); i++) total.busy_seconds += busy_seconds[i];
+		total.threads = queues.size();
+		total.runs++;
+		return;
+	}
+	printf("%s thread utilization over %.1f ms:\n", stage, run_seconds * 1000);
+	for (unsigned int i = 0; i < queues.size(); i++) {
+		double utilization = run_seconds > 0 ? 100 * busy_seconds[i] / run_seconds : 0;
+		printf("  Thread %u: %5.1f%% busy, %d tiles, %d stolen\n", i, utilization, tiles_done[i], tiles_stolen[i]);
+	}
+}
+
+void TileScheduler::CollectUtilization(std::map<std::string, utilization_total>* totals) {
+	utilization_totals = totals;
+}
+
+static thread_local TileScheduler* thread_scheduler = NULL; // Set by SetThreadTileScheduler
+
+TileScheduler& GetTileScheduler() {
+	if (thread_scheduler != NULL) return *thread_scheduler;
+	// hardware_concurrency() may return 0 if it is not known
+	static TileScheduler scheduler(std::thread::hardware_concurrency());
+	return scheduler;
+}
+
+void SetThreadTileScheduler(TileScheduler* scheduler) {
+	thread_scheduler = scheduler;
+}
@@ -0,0 +1,132 @@
+#ifndef TILESCHEDULER_H_INCLUDED
+#define TILESCHEDULER_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*
+* \brief Rectangle of pixels [x0, x1) x [y0, y1) handled as one unit of work
+*/
+typedef struct {
+	int x0, y0;
+	int x1, y1;
+} tile;
+
+/*
+* \brief How busy the threads of one stage were, summed over its Runs
+* \param run_seconds Time the Runs took
+* \param busy_seconds Time the threads spent running tiles, summed over the threads
+* \param threads Threads of the scheduler
+* \param runs Number of Runs
+*/
+typedef struct {
+	double run_seconds;
+	double busy_seconds;
+	unsigned int threads;
+	int runs;
+} utilization_total;
+
+/*
+* \brief Runs a function over the tiles of an image with a fixed set of threads. Every thread has its own deque of
+* tiles. A thread takes tiles from the back of its own deque, and once it is empty, steals from the front of the others.
+* Textured and flat regions take different amounts of time, so this keeps all threads busy until the image is done
+*/
+class TileScheduler {
+public:
+	/*
+	* \brief Starts the worker threads
+	* \param thread_count Total number of threads running tiles, including the thread calling Run
+	*/
+	explicit TileScheduler(unsigned int thread_count);
+
+	/*
+	* \brief Stops and joins the worker threads
+	*/
+	~TileScheduler();
+
+	/*
+	* \brief Splits the image into tiles, runs body on every tile, and returns once all of them are done.
+	* Calls from inside body are not supported
+	* \param w Image width
+	* \param h Image height
+	* \param tile_w Tile width
+	* \param tile_h Tile height
+	* \param body Function called for every tile
+	* \return Nothing
+	*/
+	void Run(unsigned int w, unsigned int h, int tile_w, int tile_h, const std::function<void(const tile&)>& body);
+
+	/*
+	* \brief Prints how busy every thread was during the last Run, and how many tiles it ran and stole
+	* \param stage Name of the stage, printed with the results
+	* \return Nothing
+	*/
+	void PrintUtilization(const char* stage) const;
+
+	/*
+	* \brief Makes PrintUtilization add the last Run to totals instead of printing it. Schedulers of pipelines running side by
+	* side can then be reported once at the end, instead of mixing their lines
+	* \param totals Totals keyed by the stage. NULL goes back to printing
+	* \return Nothing
+	*/
+	void CollectUtilization(std::map<std::string, utilization_total>* totals);
+
+	/*
+	* \brief Number of threads running tiles, including the thread calling Run
+	*/
+	unsigned int Size() const;
+
+private:
+	typedef struct {
+		std::deque<tile> tiles;
+		std::mutex mutex;
+	} tile_queue;
+
+	void WorkerLoop(unsigned int worker);
+	void RunTiles(unsigned int worker);
+	bool TakeTile(unsigned int worker, tile* out, bool* stolen);
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<tile_queue>> queues; // One per thread, index 0 belongs to the thread calling Run
+	std::mutex mutex;
+	std::mutex submit_mutex; // Only one Run at a time
+	std::condition_variable work_ready;
+	std::condition_variable work_done;
+	const std::function<void(const tile&)>* job;
+	unsigned int busy_workers;
+	unsigned int generation; // Incremented for every Run, so the workers know when new tiles arrive
+	bool stopping;
+
+	// Statistics of the last Run, one entry per thread
+	std::vector<double> busy_seconds;
+	std::vector<int> tiles_done;
+	std::vector<int> tiles_stolen;
+	double run_seconds;
+	std::map<std::string, utilization_total>* utilization_totals; // Set by CollectUtilization
+};
+
+/*
+* \brief Returns the scheduler shared by the CPU stages. It is created on the first call and sized with
+* std::thread::hardware_concurrency()
+* \return The shared TileScheduler
+*/
+TileScheduler& GetTileScheduler();
+
+/*
+* \brief Makes GetTileScheduler return the given scheduler on the calling thread only. Threads running whole pipelines
+* side by side can then have their own threads instead of waiting for each other's Run
+* \param scheduler Scheduler of the calling thread. NULL goes back to the shared one
+* \return Nothing
+*/
+void SetThreadTileScheduler(TileScheduler* scheduler);
+
+
+#endif
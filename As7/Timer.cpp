@@ -2,6 +2,8 @@
 #include <Windows.h>
 #include "Timer.h"
 
+static thread_local std::map<std::string, timer_total>* thread_totals = NULL; // Set by SetThreadTimerTotals
+
 void StartTimer(timer_struct* timer) {
 	QueryPerformanceFrequency(&timer->freq);
 	QueryPerformanceCounter(&timer->start);
@@ -12,5 +14,15 @@ void StopTimer(timer_struct* timer, const char* action) {
 	timer->elapsed.QuadPart = timer->end.QuadPart - timer->start.QuadPart;
 	timer->elapsed.QuadPart *= 1000000;
 	timer->elapsed.QuadPart /= timer->freq.QuadPart;
+	if (thread_totals != NULL) {
+		timer_total& total = (*thread_totals)[action];
+		total.microseconds += timer->elapsed.QuadPart;
+		total.count++;
+		return;
+	}
 	printf("%s. Took %ld microseconds\n", action, timer->elapsed);
+}
+
+void SetThreadTimerTotals(std::map<std::string, timer_total>* totals) {
+	thread_totals = totals;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define TIMER_H_INCLUDED
 
 #include <Windows.h>
+#include <map>
+#include <string>
 
 /*
 * \brief This struct contians all the variables needed for timining executions with QueryPerformanceCounter
@@ -26,5 +28,21 @@ void StartTimer(timer_struct* timer);
 */
 void StopTimer(timer_struct* timer, const char* action);
 
+/*
+* \brief Time of one timed action summed over every StopTimer call, and the number of calls
+*/
+typedef struct {
+	long long microseconds;
+	int count;
+} timer_total;
+
+/*
+* \brief Makes StopTimer add the times of the calling thread to totals instead of printing them. Threads running whole
+* pipelines side by side can then print their timings once, instead of mixing their lines
+* \param totals Totals of the calling thread, keyed by the action. NULL goes back to printing
+* \return Nothing
+*/
+void SetThreadTimerTotals(std::map<std::string, timer_total>* totals);
+
 
 #endif
\ No newline at end of file
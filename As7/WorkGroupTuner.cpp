@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "WorkGroupTuner.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#endif
+
+/* Sources:
+* "clGetKernelWorkGroupInfo" - https://registry.khronos.org/OpenCL/sdk/1.2/docs/man/xhtml/clGetKernelWorkGroupInfo.html
+*/
+
+
+/*
+* \brief Returns a string valued device info with every character that cannot be in a file name replaced by '_'
+*/
+static std::string DeviceFileString(cl_device_id device_id, cl_device_info param) {
+	size_t size = 0;
+	if (clGetDeviceInfo(device_id, param, 0, NULL, &size) != CL_SUCCESS || size == 0) return "unknown";
+	std::vector<char> value(size);
+	clGetDeviceInfo(device_id, param, size, value.data(), NULL);
+	std::string out(value.data());
+	for (size_t i = 0; i < out.size(); i++) {
+		char c = out[i];
+		if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-')) out[i] = '_';
+	}
+	return out;
+}
+
+/*
+* \brief Local sizes to try along one axis. If uniform, the divisors of global_size, otherwise powers of two and the preferred multiple
+*/
+static std::vector<size_t> AxisCandidates(size_t global_size, bool uniform, size_t max_items, size_t multiple) {
+	std::vector<size_t> sizes;
+	for (size_t s = 1; s <= max_items && s <= global_size; s++) {
+		bool power_of_two = (s & (s - 1)) == 0;
+		if (uniform ? global_size % s == 0 : (power_of_two || s == multiple)) sizes.push_back(s);
+	}
+	return sizes;
+}
+
+
+WorkGroupTuner::WorkGroupTuner(cl_device_id device_id, const char* tuning_dir) : device_id(device_id) {
+	// Fails harmlessly if the directory already exists
+	make_dir(tuning_dir);
+	file_name = std::string(tuning_dir) + "/" + DeviceFileString(device_id, CL_DEVICE_NAME) + "_" + DeviceFileString(device_id, CL_DRIVER_VERSION) + ".txt";
+	Load();
+}
+
+void WorkGroupTuner::LocalSize(cl_command_queue cmd_q, cl_kernel kernel, const std::string& key, const size_t global_size[2], size_t local_size[2]) {
+	tuner_launch launch = [&](const size_t local[2], cl_event* event) {
+		return clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global_size, local, 0, NULL, event);
+	};
+	LocalSize(kernel, key, global_size, true, launch, local_size);
+}
+
+void WorkGroupTuner::LocalSize(cl_kernel kernel, const std::string& key, const size_t global_size[2], bool uniform,
+	const tuner_launch& launch, size_t local_size[2]) {
+	char size_str[64];
+	snprintf(size_str, sizeof(size_str), " %ux%u", (unsigned int)global_size[0], (unsigned int)global_size[1]);
+	std::string full_key = key + size_str;
+	std::map<std::string, tuned_size>::iterator found = tuned.find(full_key);
+	if (found != tuned.end()) {
+		local_size[0] = found->second.local_size[0];
+		local_size[1] = found->second.local_size[1];
+		return;
+	}
+
+	// Limits of the device and of this kernel
+	size_t device_max = 1, kernel_max = 1, multiple = 1;
+	size_t item_sizes[3] = { 1, 1, 1 };
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &device_max, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(item_sizes), item_sizes, NULL);
+	clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_max, NULL);
+	clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &multiple, NULL);
+	size_t max_group = std::max((size_t)1, std::min(device_max, kernel_max));
+	multiple = std::max((size_t)1, multiple);
+
+	// Every pair that fits. Groups filling whole multiples of the preferred size are tried first, bigger ones before smaller
+	std::vector<size_t> xs = AxisCandidates(global_size[0], uniform, item_sizes[0], multiple);
+	std::vector<size_t> ys = AxisCandidates(global_size[1], uniform, item_sizes[1], multiple);
+	std::vector<std::pair<double, std::pair<size_t, size_t> > > candidates;
+	for (size_t i = 0; i < xs.size(); i++) {
+		for (size_t j = 0; j < ys.size(); j++) {
+			size_t group = xs[i] * ys[j];
+			if (group > max_group) continue;
+			size_t padded = (group + multiple - 1) / multiple * multiple;
+			double score = (double)group / padded + (double)group / max_group * 1e-3;
+			candidates.push_back(std::make_pair(-score, std::make_pair(xs[i], ys[j])));
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+	if (candidates.size() > TUNER_MAX_CANDIDATES) candidates.resize(TUNER_MAX_CANDIDATES);
+
+	printf("Tuning the work-group size of %s, %d candidates\n", full_key.c_str(), (int)candidates.size());
+	tuned_size best;
+	best.local_size[0] = best.local_size[1] = 1;
+	best.milliseconds = -1;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		size_t local[2] = { candidates[i].second.first, candidates[i].second.second };
+		double fastest = -1;
+		for (int run = 0; run < TUNER_RUNS; run++) {
+			cl_event event = NULL;
+			// Sizes the kernel cannot run with, for example because of its local memory, are skipped
+			if (launch(local, &event) != CL_SUCCESS) break;
+			if (clWaitForEvents(1, &event) != CL_SUCCESS) {
+				clReleaseEvent(event);
+				break;
+			}
+			cl_ulong start = 0, end = 0;
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+			clReleaseEvent(event);
+			double milliseconds = (cl_double)(end - start) * (cl_double)(1e-06);
+			if (fastest < 0 || milliseconds < fastest) fastest = milliseconds;
+		}
+		if (fastest >= 0 && (best.milliseconds < 0 || fastest < best.milliseconds)) {
+			best.local_size[0] = local[0];
+			best.local_size[1] = local[1];
+			best.milliseconds = fastest;
+		}
+	}
+	printf("Best work-group size %ux%u, %f milliseconds\n", (unsigned int)best.local_size[0], (unsigned int)best.local_size[1], best.milliseconds);
+
+	local_size[0] = best.local_size[0];
+	local_size[1] = best.local_size[1];
+	// Only sizes that actually ran are remembered
+	if (best.milliseconds >= 0) {
+		tuned[full_key] = best;
+		Save();
+	}
+}
+
+void WorkGroupTuner::Load() {
+	FILE* fp = NULL;
+	if (fopen_s(&fp, file_name.c_str(), "r") != 0 || !fp) return;
+	// One kernel per line: key, a tab, the local size and its time
+	char line[512];
+	while (fgets(line, sizeof(line), fp)) {
+		char* tab = strchr(line, '\t');
+		if (tab == NULL) continue;
+		*tab = '\0';
+		tuned_size entry;
+		unsigned int x, y;
+		if (sscanf_s(tab + 1, "%u %u %lf", &x, &y, &entry.milliseconds) != 3 || x == 0 || y == 0) continue;
+		entry.local_size[0] = x;
+		entry.local_size[1] = y;
+		tuned[line] = entry;
+	}
+	fclose(fp);
+	printf("Loaded %d tuned work-group sizes from %s\n", (int)tuned.size(), file_name.c_str());
+}
+
+void WorkGroupTuner::Save() const {
+	FILE* fp = NULL;
+	if (fopen_s(&fp, file_name.c_str(), "w") != 0 || !fp) {
+		printf("Could not write the tuning file %s\n", file_name.c_str());
+		return;
+	}
+	for (std::map<std::string, tuned_size>::const_iterator it = tuned.begin(); it != tuned.end(); ++it) {
+		fprintf(fp, "%s\t%u %u %f\n", it->first.c_str(), (unsigned int)it->second.local_size[0], (unsigned int)it->second.local_size[1], it->second.milliseconds);
+	}
+	fclose(fp);
+}
@@ -0,0 +1,796 @@
+#include <vector>
+#include <math.h>
+#include <algorithm>
+#include "ZNCCFunctions.h"
+#include "ImageFunctions.h"
+#include "TileScheduler.h"
+#include "Timer.h"
+
+#include <omp.h>
+
+#define ZNCC_BAND_HEIGHT 64 // Rows of one TileScheduler tile
+#define ZNCC_VOLUME_BAND_HEIGHT 16 // Rows in one cost volume band. 16 rows of 735 pixels and 65 disparities is 3 MB
+#define ZNCC_NO_SCORE -1.0f // Score for windows without any pixel inside the image
+#define TEMPORAL_MAX_REFRESH 0.25 // Above this share of fully searched pixels CalcZNCCTemporal searches the whole frame with the product tables
+
+
+void BuildIntegralImage(ImageView img, integral_image* out) {
+	unsigned int w = img.width, h = img.height;
+	unsigned int stride = w + 1;
+	out->w = w;
+	out->h = h;
+	// First row and column stay zero
+	out->sum.assign(stride * (h + 1), 0);
+	out->sum_sq.assign(stride * (h + 1), 0);
+
+	for (unsigned int y = 0; y < h; y++) {
+		// Running sums of the current row
+		unsigned int row_sum = 0, row_sum_sq = 0;
+		const unsigned char* row = img.Row(y);
+		for (unsigned int x = 0; x < w; x++) {
+			unsigned int val = row[x];
+			row_sum += val;
+			row_sum_sq += val * val;
+			// Add the row sum to the value above
+			out->sum[(y + 1) * stride + x + 1] = out->sum[y * stride + x + 1] + row_sum;
+			out->sum_sq[(y + 1) * stride + x + 1] = out->sum_sq[y * stride + x + 1] + row_sum_sq;
+		}
+	}
+}
+
+/*
+* \brief Sums the box of rows [y0, y1) and columns [x0, x1) from a summed-area table
+*/
+static inline unsigned int BoxSum(const unsigned int* table, unsigned int stride, int y0, int y1, int x0, int x1) {
+	// Unsigned arithmetic, so wrapped table values still give the exact sum
+	return table[y1 * stride + x1] - table[y0 * stride + x1] - table[y1 * stride + x0] + table[y0 * stride + x0];
+}
+
+double ZNCCFromSums(double sum_l, double sum_r, double sum_ll, double sum_rr, double sum_lr, double count, int window_size) {
+	// Window means
+	double lw_mean = sum_l / window_size;
+	double rw_mean = sum_r / window_size;
+	// Sum((L - lw_mean) * (R - rw_mean)) and the squared sums, expanded so they only need the window sums
+	double upper_sum = sum_lr - rw_mean * sum_l - lw_mean * sum_r + count * lw_mean * rw_mean;
+	double lower_sum_0 = sum_ll - 2 * lw_mean * sum_l + count * lw_mean * lw_mean;
+	double lower_sum_1 = sum_rr - 2 * rw_mean * sum_r + count * rw_mean * rw_mean;
+	return upper_sum / (sqrt(lower_sum_0) * sqrt(lower_sum_1));
+}
+
+/*
+* \brief Builds a summed-area table of L(x, y) * R(x - d, y) for image rows [y0, y1). Pixels where x - d is outside of
+* the image are left out, just like the boundary check in CalcZNCC does
+*/
+static void BuildProductTable(ImageView left, ImageView right, int y0, int y1, int d, std::vector<unsigned int>& table) {
+	unsigned int w = left.width;
+	unsigned int stride = w + 1;
+	int x_start = std::max(0, d);
+	int x_end = std::min((int)w, (int)w + d);
+	table.assign(stride * (y1 - y0 + 1), 0);
+
+	for (int y = y0; y < y1; y++) {
+		const unsigned char* l_row = left.Row(y);
+		const unsigned char* r_row = right.Row(y);
+		unsigned int* above = &table[(y - y0) * stride + 1];
+		unsigned int* current = &table[(y - y0 + 1) * stride + 1];
+		unsigned int row_sum = 0;
+		for (int x = 0; x < (int)w; x++) {
+			if (x >= x_start && x < x_end) {
+				row_sum += l_row[x] * r_row[x - d];
+			}
+			current[x] = above[x] + row_sum;
+		}
+	}
+}
+
+Image CalcZNCCIntegral(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity) {
+	// Tables for the window means and variances only have to be built once per image
+	integral_image left_table, right_table;
+	BuildIntegralImage(img_left, &left_table);
+	BuildIntegralImage(img_right, &right_table);
+	return CalcZNCCIntegralTables(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity);
+}
+
+Image CalcZNCCIntegralTables(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	int window_size = window_y * window_x; // Size of the whole window, used as the divisor just like in CalcZNCC
+	// Window spans [-window / 2, window / 2) on both axes, same as the loops in CalcZNCC
+	int win_y0 = -window_y / 2, win_y1 = window_y / 2;
+	int win_x0 = -window_x / 2, win_x1 = window_x / 2;
+	unsigned int stride = w + 1;
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	// Every tile is a band of whole rows, so the product table of a band is built once per disparity
+	GetTileScheduler().Run(w, h, w, ZNCC_BAND_HEIGHT, [&](const tile& t) {
+		// Pixel rows handled in this band, and the image rows their windows touch
+		int band_y0 = t.y0;
+		int band_y1 = t.y1;
+		int table_y0 = std::max(0, band_y0 + win_y0);
+		int table_y1 = std::min((int)h, band_y1 - 1 + win_y1);
+		int band_size = (band_y1 - band_y0) * w;
+
+		// Best score so far for every pixel of the band
+		std::vector<double> max_sum(band_size, -1);
+		std::vector<int> best_disparity(band_size, max_disparity);
+		std::vector<unsigned int> product_table;
+
+		for (int d = min_disparity; d < max_disparity; d++) { // Loop to maximum disparity value
+			// Product table is the only one that depends on d
+			BuildProductTable(img_left, img_right, table_y0, std::max(table_y0, table_y1), d, product_table);
+			// Columns where both L(x) and R(x - d) are inside the image
+			int valid_x0 = std::max(0, d);
+			int valid_x1 = std::min((int)w, (int)w + d);
+
+			for (int y = band_y0; y < band_y1; y++) {
+				// Clip the window rows to the image
+				int y0 = std::max(0, y + win_y0);
+				int y1 = std::min((int)h, y + win_y1);
+				if (y1 <= y0) continue;
+
+				for (int x = 0; x < (int)w; x++) {
+					// Clip the window columns to the image, for both the left and the shifted right window
+					int x0 = std::max(valid_x0, x + win_x0);
+					int x1 = std::min(valid_x1, x + win_x1);
+					if (x1 <= x0) continue;
+					double count = (double)(y1 - y0) * (x1 - x0);
+
+					// Window sums from the tables
+					double sum_l = BoxSum(&left_table.sum[0], stride, y0, y1, x0, x1);
+					double sum_ll = BoxSum(&left_table.sum_sq[0], stride, y0, y1, x0, x1);
+					double sum_r = BoxSum(&right_table.sum[0], stride, y0, y1, x0 - d, x1 - d);
+					double sum_rr = BoxSum(&right_table.sum_sq[0], stride, y0, y1, x0 - d, x1 - d);
+					double sum_lr = BoxSum(&product_table[0], stride, y0 - table_y0, y1 - table_y0, x0, x1);
+					double zncc_val = ZNCCFromSums(sum_l, sum_r, sum_ll, sum_rr, sum_lr, count, window_size);
+
+					// Check if maximum sum and best disparity should be updated based on current zncc value
+					int i = (y - band_y0) * w + x;
+					if (zncc_val > max_sum[i]) {
+						best_disparity[i] = d;
+						max_sum[i] = zncc_val;
+					}
+				}
+			}
+		}
+		// Add resulting best disparity values to the disparity map
+		for (int i = 0; i < band_size; i++) {
+			disparity_map[band_y0 * w + i] = abs(best_disparity[i]); // Use absolute value of the disparity
+		}
+	});
+
+	StopTimer(&timer, "ZNCC calculated with integral images");
+	GetTileScheduler().PrintUtilization("ZNCC, integral images");
+	return disparity_map;
+}
+
+Image CalcZNCCBidirectional(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity, Image* right_map) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	*right_map = Image(w, h);
+	int window_size = window_y * window_x; // Size of the whole window, used as the divisor just like in CalcZNCC
+	// Window spans [-window / 2, window / 2) on both axes, same as the loops in CalcZNCC
+	int win_y0 = -window_y / 2, win_y1 = window_y / 2;
+	int win_x0 = -window_x / 2, win_x1 = window_x / 2;
+	unsigned int stride = w + 1;
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	// Every tile is a band of whole rows, so the product table of a band is built once per disparity
+	GetTileScheduler().Run(w, h, w, ZNCC_BAND_HEIGHT, [&](const tile& t) {
+		// Pixel rows handled in this band, and the image rows their windows touch
+		int band_y0 = t.y0;
+		int band_y1 = t.y1;
+		int table_y0 = std::max(0, band_y0 + win_y0);
+		int table_y1 = std::min((int)h, band_y1 - 1 + win_y1);
+		int band_size = (band_y1 - band_y0) * w;
+
+		// Best score so far for every pixel of the band in both maps. The right map keeps d, its disparity is -d
+		std::vector<double> left_max(band_size, -1), right_max(band_size, -1);
+		std::vector<int> left_best(band_size, max_disparity), right_best(band_size, min_disparity);
+		std::vector<unsigned int> product_table;
+
+		// The left map uses d in [min_disparity, max_disparity), the right map d in (min_disparity, max_disparity]
+		for (int d = min_disparity; d <= max_disparity; d++) {
+			bool left = d < max_disparity;
+			bool right = d > min_disparity;
+			BuildProductTable(img_left, img_right, table_y0, std::max(table_y0, table_y1), d, product_table);
+			// Columns where both L(x) and R(x - d) are inside the image. The right map clips its windows to the same columns
+			int valid_x0 = std::max(0, d);
+			int valid_x1 = std::min((int)w, (int)w + d);
+			// Pair x is needed by left map pixel x and by right map pixel x - d
+			int x_start = left ? (right ? std::min(0, d) : 0) : d;
+			int x_end = left ? (right ? std::max((int)w, (int)w + d) : (int)w) : (int)w + d;
+
+			for (int y = band_y0; y < band_y1; y++) {
+				// Clip the window rows to the image
+				int y0 = std::max(0, y + win_y0);
+				int y1 = std::min((int)h, y + win_y1);
+				if (y1 <= y0) continue;
+
+				for (int x = x_start; x < x_end; x++) {
+					// Clip the window columns to the image, for both the left and the shifted right window
+					int x0 = std::max(valid_x0, x + win_x0);
+					int x1 = std::min(valid_x1, x + win_x1);
+					if (x1 <= x0) continue;
+					double count = (double)(y1 - y0) * (x1 - x0);
+
+					// Window sums from the tables
+					double sum_l = BoxSum(&left_table.sum[0], stride, y0, y1, x0, x1);
+					double sum_ll = BoxSum(&left_table.sum_sq[0], stride, y0, y1, x0, x1);
+					double sum_r = BoxSum(&right_table.sum[0], stride, y0, y1, x0 - d, x1 - d);
+					double sum_rr = BoxSum(&right_table.sum_sq[0], stride, y0, y1, x0 - d, x1 - d);
+					double sum_lr = BoxSum(&product_table[0], stride, y0 - table_y0, y1 - table_y0, x0, x1);
+					double zncc_val = ZNCCFromSums(sum_l, sum_r, sum_ll, sum_rr, sum_lr, count, window_size);
+
+					int i = (y - band_y0) * w + x;
+					if (left && x >= 0 && x < (int)w && zncc_val > left_max[i]) {
+						left_best[i] = d;
+						left_max[i] = zncc_val;
+					}
+					// CalcZNCC of the right map goes through this loop backwards and keeps the first of equal scores.
+					// Going forwards that is the last one, and -1 must still never win
+					if (right && x - d >= 0 && x - d < (int)w && zncc_val > -1 && zncc_val >= right_max[i - d]) {
+						right_best[i - d] = d;
+						right_max[i - d] = zncc_val;
+					}
+				}
+			}
+		}
+		// Add resulting best disparity values to the disparity maps
+		for (int i = 0; i < band_size; i++) {
+			disparity_map[band_y0 * w + i] = abs(left_best[i]); // Use absolute value of the disparity
+			(*right_map)[band_y0 * w + i] = abs(right_best[i]);
+		}
+	});
+
+	StopTimer(&timer, "ZNCC calculated in both directions with integral images");
+	GetTileScheduler().PrintUtilization("ZNCC, both directions");
+	return disparity_map;
+}
+
+Image CalcZNCCSliding(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	int window_size = window_y * window_x; // Size of the whole window, used as the divisor just like in CalcZNCC
+	// Window spans [-window / 2, window / 2) on both axes, same as the loops in CalcZNCC
+	int win_y0 = -window_y / 2, win_y1 = window_y / 2;
+	int win_x0 = -window_x / 2, win_x1 = window_x / 2;
+	int disparity_count = std::max(0, max_disparity - min_disparity);
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	// Every tile is a band of whole rows, the window slides down the band
+	GetTileScheduler().Run(w, h, w, ZNCC_BAND_HEIGHT, [&](const tile& t) {
+		int band_y0 = t.y0;
+		int band_y1 = t.y1;
+
+		// Column sums over the rows of the current window. L * R(x - d) sums are kept for every disparity
+		std::vector<int> col_l(w, 0), col_ll(w, 0), col_r(w, 0), col_rr(w, 0);
+		std::vector<int> col_lr(disparity_count * w, 0);
+		// Best score of every pixel on the current row
+		std::vector<double> max_sum(w);
+		std::vector<int> best_disparity(w);
+
+		for (int y = band_y0; y < band_y1; y++) {
+			// Rows entering and leaving the window. On the first row of the band the whole window is added
+			int add_y0 = (y == band_y0) ? y + win_y0 : y + win_y1 - 1;
+			int add_y1 = y + win_y1;
+			int drop_y = (y == band_y0) ? -1 : y + win_y0 - 1;
+			for (int row = std::max(0, add_y0); row < std::min((int)h, add_y1); row++) {
+				const unsigned char* l_row = img_left.Row(row);
+				const unsigned char* r_row = img_right.Row(row);
+				for (int x = 0; x < (int)w; x++) {
+					col_l[x] += l_row[x];
+					col_ll[x] += l_row[x] * l_row[x];
+					col_r[x] += r_row[x];
+					col_rr[x] += r_row[x] * r_row[x];
+				}
+				for (int i = 0; i < disparity_count; i++) {
+					int d = min_disparity + i;
+					int* col = &col_lr[i * w];
+					for (int x = std::max(0, d); x < std::min((int)w, (int)w + d); x++) {
+						col[x] += l_row[x] * r_row[x - d];
+					}
+				}
+			}
+			if (drop_y >= 0 && drop_y < (int)h) {
+				const unsigned char* l_row = img_left.Row(drop_y);
+				const unsigned char* r_row = img_right.Row(drop_y);
+				for (int x = 0; x < (int)w; x++) {
+					col_l[x] -= l_row[x];
+					col_ll[x] -= l_row[x] * l_row[x];
+					col_r[x] -= r_row[x];
+					col_rr[x] -= r_row[x] * r_row[x];
+				}
+				for (int i = 0; i < disparity_count; i++) {
+					int d = min_disparity + i;
+					int* col = &col_lr[i * w];
+					for (int x = std::max(0, d); x < std::min((int)w, (int)w + d); x++) {
+						col[x] -= l_row[x] * r_row[x - d];
+					}
+				}
+			}
+
+			// Window rows inside the image
+			int row_count = std::min((int)h, y + win_y1) - std::max(0, y + win_y0);
+			std::fill(max_sum.begin(), max_sum.end(), -1);
+			std::fill(best_disparity.begin(), best_disparity.end(), max_disparity);
+			if (row_count <= 0) {
+				for (int x = 0; x < (int)w; x++) disparity_map[y * w + x] = abs(max_disparity);
+				continue;
+			}
+
+			for (int i = 0; i < disparity_count; i++) { // Loop to maximum disparity value
+				int d = min_disparity + i;
+				const int* col = &col_lr[i * w];
+				// Columns where both L(x) and R(x - d) are inside the image
+				int valid_x0 = std::max(0, d);
+				int valid_x1 = std::min((int)w, (int)w + d);
+				// Sums of the window at x = 0
+				int sum_l = 0, sum_ll = 0, sum_r = 0, sum_rr = 0, sum_lr = 0;
+				for (int c = std::max(valid_x0, win_x0); c < std::min(valid_x1, win_x1); c++) {
+					sum_l += col_l[c];
+					sum_ll += col_ll[c];
+					sum_r += col_r[c - d];
+					sum_rr += col_rr[c - d];
+					sum_lr += col[c];
+				}
+
+				for (int x = 0; x < (int)w; x++) {
+					if (x > 0) {
+						// Slide the window one pixel right: add the entering column and drop the leaving one
+						int c_in = x + win_x1 - 1;
+						int c_out = x + win_x0 - 1;
+						if (c_in >= valid_x0 && c_in < valid_x1) {
+							sum_l += col_l[c_in];
+							sum_ll += col_ll[c_in];
+							sum_r += col_r[c_in - d];
+							sum_rr += col_rr[c_in - d];
+							sum_lr += col[c_in];
+						}
+						if (c_out >= valid_x0 && c_out < valid_x1) {
+							sum_l -= col_l[c_out];
+							sum_ll -= col_ll[c_out];
+							sum_r -= col_r[c_out - d];
+							sum_rr -= col_rr[c_out - d];
+							sum_lr -= col[c_out];
+						}
+					}
+					int col_count = std::min(valid_x1, x + win_x1) - std::max(valid_x0, x + win_x0);
+					if (col_count <= 0) continue;
+
+					double zncc_val = ZNCCFromSums(sum_l, sum_r, sum_ll, sum_rr, sum_lr, (double)row_count * col_count, window_size);
+					// Check if maximum sum and best disparity should be updated based on current zncc value
+					if (zncc_val > max_sum[x]) {
+						best_disparity[x] = d;
+						max_sum[x] = zncc_val;
+					}
+				}
+			}
+			// Add resulting best disparity values to the disparity map
+			for (int x = 0; x < (int)w; x++) {
+				disparity_map[y * w + x] = abs(best_disparity[x]); // Use absolute value of the disparity
+			}
+		}
+	});
+
+	StopTimer(&timer, "ZNCC calculated with sliding windows");
+	GetTileScheduler().PrintUtilization("ZNCC, sliding windows");
+	return disparity_map;
+}
+
+void ComputeCostVolume(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity, int y0, int y1, cost_volume* volume) {
+	int w = left_table.w, h = left_table.h;
+	int window_size = window_y * window_x;
+	int win_y0 = -window_y / 2, win_y1 = window_y / 2;
+	int win_x0 = -window_x / 2, win_x1 = window_x / 2;
+	unsigned int stride = w + 1;
+	// Image rows the windows of the band touch
+	int table_y0 = std::max(0, y0 + win_y0);
+	int table_y1 = std::max(table_y0, std::min(h, y1 - 1 + win_y1));
+	std::vector<unsigned int> product_table;
+
+	volume->w = w;
+	volume->y0 = y0;
+	volume->rows = y1 - y0;
+	volume->min_disparity = min_disparity;
+	volume->disparity_count = std::max(0, max_disparity - min_disparity);
+	volume->scores.resize((size_t)volume->disparity_count * volume->rows * w);
+
+	for (int i = 0; i < volume->disparity_count; i++) {
+		int d = min_disparity + i;
+		BuildProductTable(img_left, img_right, table_y0, table_y1, d, product_table);
+		int valid_x0 = std::max(0, d);
+		int valid_x1 = std::min(w, w + d);
+
+		for (int y = y0; y < y1; y++) {
+			float* scores = &volume->scores[((size_t)i * volume->rows + y - y0) * w];
+			int wy0 = std::max(0, y + win_y0);
+			int wy1 = std::min(h, y + win_y1);
+			for (int x = 0; x < w; x++) {
+				int wx0 = std::max(valid_x0, x + win_x0);
+				int wx1 = std::min(valid_x1, x + win_x1);
+				if (wy1 <= wy0 || wx1 <= wx0) {
+					scores[x] = ZNCC_NO_SCORE;
+					continue;
+				}
+				double sum_l = BoxSum(&left_table.sum[0], stride, wy0, wy1, wx0, wx1);
+				double sum_ll = BoxSum(&left_table.sum_sq[0], stride, wy0, wy1, wx0, wx1);
+				double sum_r = BoxSum(&right_table.sum[0], stride, wy0, wy1, wx0 - d, wx1 - d);
+				double sum_rr = BoxSum(&right_table.sum_sq[0], stride, wy0, wy1, wx0 - d, wx1 - d);
+				double sum_lr = BoxSum(&product_table[0], stride, wy0 - table_y0, wy1 - table_y0, wx0, wx1);
+				double zncc_val = ZNCCFromSums(sum_l, sum_r, sum_ll, sum_rr, sum_lr, (double)(wy1 - wy0) * (wx1 - wx0), window_size);
+				// Flat windows give NaN, which never wins in CalcZNCC either
+				scores[x] = (zncc_val == zncc_val) ? (float)zncc_val : ZNCC_NO_SCORE;
+			}
+		}
+	}
+}
+
+void WinnerTakeAll(const cost_volume& volume, ImageSpan disparity_map) {
+	int w = volume.w;
+	int max_disparity = volume.min_disparity + volume.disparity_count;
+	std::vector<float> max_sum(w);
+	std::vector<int> best_disparity(w);
+
+	for (int y = 0; y < volume.rows; y++) {
+		std::fill(max_sum.begin(), max_sum.end(), -1.0f);
+		std::fill(best_disparity.begin(), best_disparity.end(), max_disparity);
+		for (int i = 0; i < volume.disparity_count; i++) {
+			const float* scores = &volume.scores[((size_t)i * volume.rows + y) * w];
+			int d = volume.min_disparity + i;
+			for (int x = 0; x < w; x++) {
+				// Branchless select, so this loop vectorizes
+				bool better = scores[x] > max_sum[x];
+				max_sum[x] = better ? scores[x] : max_sum[x];
+				best_disparity[x] = better ? d : best_disparity[x];
+			}
+		}
+		unsigned char* dst = disparity_map.Row(volume.y0 + y);
+		for (int x = 0; x < w; x++) {
+			dst[x] = abs(best_disparity[x]); // Use absolute value of the disparity
+		}
+	}
+}
+
+void WinnerTakeAllSubpixel(const cost_volume& volume, ImageSpan disparity_map, ImageSpanF subpixel_map) {
+	int w = volume.w;
+	int max_disparity = volume.min_disparity + volume.disparity_count;
+	std::vector<float> max_sum(w), prev_score(w), left_score(w), right_score(w);
+	std::vector<int> best_disparity(w);
+
+	for (int y = 0; y < volume.rows; y++) {
+		std::fill(max_sum.begin(), max_sum.end(), -1.0f);
+		std::fill(prev_score.begin(), prev_score.end(), ZNCC_NO_SCORE);
+		std::fill(left_score.begin(), left_score.end(), ZNCC_NO_SCORE);
+		std::fill(right_score.begin(), right_score.end(), ZNCC_NO_SCORE);
+		std::fill(best_disparity.begin(), best_disparity.end(), max_disparity);
+		for (int i = 0; i < volume.disparity_count; i++) {
+			const float* scores = &volume.scores[((size_t)i * volume.rows + y) * w];
+			int d = volume.min_disparity + i;
+			for (int x = 0; x < w; x++) {
+				// Same update as WinnerTakeAll. The winner also takes the score before it, and the score after it arrives on the next disparity
+				bool better = scores[x] > max_sum[x];
+				right_score[x] = better ? ZNCC_NO_SCORE : (best_disparity[x] == d - 1 ? scores[x] : right_score[x]);
+				left_score[x] = better ? prev_score[x] : left_score[x];
+				max_sum[x] = better ? scores[x] : max_sum[x];
+				best_disparity[x] = better ? d : best_disparity[x];
+				prev_score[x] = scores[x];
+			}
+		}
+		unsigned char* dst = disparity_map.Row(volume.y0 + y);
+		float* sub_dst = subpixel_map.Row(volume.y0 + y);
+		for (int x = 0; x < w; x++) {
+			dst[x] = abs(best_disparity[x]); // Use absolute value of the disparity
+			// Vertex of the parabola through the three scores. Winners at the ends of the range or next to windows
+			// without a score are not refined. The winner is the largest score, so the offset is within half a pixel
+			float offset = 0;
+			float curvature = left_score[x] - 2 * max_sum[x] + right_score[x];
+			if (left_score[x] > ZNCC_NO_SCORE && right_score[x] > ZNCC_NO_SCORE && curvature < 0) {
+				offset = 0.5f * (left_score[x] - right_score[x]) / curvature;
+			}
+			sub_dst[x] = fabsf(best_disparity[x] + offset);
+		}
+	}
+}
+
+Image CalcZNCCSubpixel(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity, ImageF* subpixel_map) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	*subpixel_map = ImageF(w, h);
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	integral_image left_table, right_table;
+	BuildIntegralImage(img_left, &left_table);
+	BuildIntegralImage(img_right, &right_table);
+
+	// Every tile is a band of whole rows with a volume of its own
+	GetTileScheduler().Run(w, h, w, ZNCC_VOLUME_BAND_HEIGHT, [&](const tile& t) {
+		cost_volume volume;
+		ComputeCostVolume(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity, t.y0, t.y1, &volume);
+		WinnerTakeAllSubpixel(volume, disparity_map.Span(), subpixel_map->Span());
+	});
+
+	StopTimer(&timer, "ZNCC calculated with sub-pixel refinement");
+	GetTileScheduler().PrintUtilization("ZNCC, sub-pixel refinement");
+	return disparity_map;
+}
+
+Image CalcZNCCCostVolume(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	integral_image left_table, right_table;
+	BuildIntegralImage(img_left, &left_table);
+	BuildIntegralImage(img_right, &right_table);
+
+	// Every tile is a band of whole rows with a volume of its own
+	GetTileScheduler().Run(w, h, w, ZNCC_VOLUME_BAND_HEIGHT, [&](const tile& t) {
+		cost_volume volume;
+		ComputeCostVolume(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity, t.y0, t.y1, &volume);
+		WinnerTakeAll(volume, disparity_map.Span());
+	});
+
+	StopTimer(&timer, "ZNCC calculated with a cost volume");
+	GetTileScheduler().PrintUtilization("ZNCC, cost volume");
+	return disparity_map;
+}
+
+/*
+* \brief Floor of a / 2^shift, also for negative a
+*/
+static inline int ShiftFloor(int a, int shift) {
+	return a >= 0 ? a >> shift : -((-a + (1 << shift) - 1) >> shift);
+}
+
+/*
+* \brief Column sums of L * R(x - d) over the window rows of one image row, kept while the pixels of that row are matched.
+* Windows of neighboring pixels share most of their columns, so every column is only summed once per disparity
+* \param sums Column sum of disparity d and column x at (d - min_disparity) * w + x
+* \param rows Image row each column sum was calculated for, -1 if not yet
+* \param min_disparity Disparity of the first column sums
+*/
+typedef struct {
+	std::vector<unsigned int> sums;
+	std::vector<int> rows;
+	int min_disparity;
+} cross_columns;
+
+/*
+* \brief Best disparity of pixel (x, y) in [d0, d1), compared like in CalcZNCC. The window means and variances come from
+* the summed-area tables and only the cross term is summed, so the cost depends on how many disparities are searched
+* \param best_score Score of the best disparity is stored here, -1 if no window scored above it. Can be NULL
+* \param columns Column sums of the cross term reused from the pixels of the same row. Can be NULL
+* \return The best disparity, fallback if no window scored above -1
+*/
+static int MatchPixel(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int x, int y, int d0, int d1, int fallback, double* best_score, cross_columns* columns) {
+	int w = img_left.width, h = img_left.height;
+	unsigned int stride = w + 1;
+	int window_size = window_y * window_x;
+	// Clip the window rows to the image
+	int y0 = std::max(0, y - window_y / 2);
+	int y1 = std::min(h, y + window_y / 2);
+	double max_sum = -1;
+	int best_disparity = fallback;
+
+	for (int d = d0; d < d1; d++) {
+		// Clip the window columns to where both L(x) and R(x - d) are inside the image
+		int x0 = std::max(std::max(0, d), x - window_x / 2);
+		int x1 = std::min(std::min(w, w + d), x + window_x / 2);
+		if (y1 <= y0 || x1 <= x0) continue;
+		unsigned int sum_lr = 0;
+		if (columns != NULL) {
+			unsigned int* sums = &columns->sums[(size_t)(d - columns->min_disparity) * w];
+			int* rows = &columns->rows[(size_t)(d - columns->min_disparity) * w];
+			for (int col = x0; col < x1; col++) {
+				if (rows[col] != y) {
+					unsigned int column_sum = 0;
+					for (int row = y0; row < y1; row++) column_sum += img_left.Row(row)[col] * img_right.Row(row)[col - d];
+					sums[col] = column_sum;
+					rows[col] = y;
+				}
+				sum_lr += sums[col];
+			}
+		}
+		else {
+			for (int row = y0; row < y1; row++) {
+				const unsigned char* l_row = img_left.Row(row);
+				const unsigned char* r_row = img_right.Row(row);
+				for (int col = x0; col < x1; col++) {
+					sum_lr += l_row[col] * r_row[col - d];
+				}
+			}
+		}
+		double sum_l = BoxSum(&left_table.sum[0], stride, y0, y1, x0, x1);
+		double sum_ll = BoxSum(&left_table.sum_sq[0], stride, y0, y1, x0, x1);
+		double sum_r = BoxSum(&right_table.sum[0], stride, y0, y1, x0 - d, x1 - d);
+		double sum_rr = BoxSum(&right_table.sum_sq[0], stride, y0, y1, x0 - d, x1 - d);
+		double zncc_val = ZNCCFromSums(sum_l, sum_r, sum_ll, sum_rr, sum_lr, (double)(y1 - y0) * (x1 - x0), window_size);
+		if (zncc_val > max_sum) {
+			best_disparity = d;
+			max_sum = zncc_val;
+		}
+	}
+	if (best_score != NULL) *best_score = max_sum;
+	return best_disparity;
+}
+
+Image16 CalcZNCCPyramid(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity, int levels, int radius) {
+	timer_struct timer;
+	StartTimer(&timer);
+
+	// Level 0 is the given pair. Halving stops before the windows would not fit in the image anymore.
+	// Moving an Image keeps its pixels, so the views stay valid when the vectors grow
+	std::vector<Image> left_levels, right_levels;
+	std::vector<ImageView> left_views(1, img_left), right_views(1, img_right);
+	while ((int)left_views.size() < levels && (int)left_views.back().width / 2 >= window_x && (int)left_views.back().height / 2 >= window_y) {
+		left_levels.push_back(DownsampleImage(left_views.back()));
+		right_levels.push_back(DownsampleImage(right_views.back()));
+		left_views.push_back(left_levels.back());
+		right_views.push_back(right_levels.back());
+	}
+
+	// Signed disparities of the previous, coarser level
+	std::vector<int> coarse, current;
+	int coarse_w = 0, coarse_h = 0;
+	for (int level = (int)left_views.size() - 1; level >= 0; level--) {
+		ImageView left = left_views[level], right = right_views[level];
+		int w = left.width, h = left.height;
+		// Disparity range scaled to this level, rounded outwards
+		int level_min = ShiftFloor(min_disparity, level);
+		int level_max = -ShiftFloor(-max_disparity, level);
+		integral_image left_table, right_table;
+		BuildIntegralImage(left, &left_table);
+		BuildIntegralImage(right, &right_table);
+		bool coarsest = coarse.empty();
+		current.assign((size_t)w * h, 0);
+
+#pragma omp parallel
+		{
+		// Column sums of the cross term, one set per thread. Neighboring pixels search overlapping disparities, so they share most columns
+		cross_columns columns;
+		columns.sums.resize((size_t)(level_max - level_min) * w);
+		columns.rows.assign(columns.sums.size(), -1);
+		columns.min_disparity = level_min;
+#pragma omp for schedule(dynamic)
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				int i = y * w + x;
+				if (coarsest) {
+					// Full search, failed pixels get the maximum like in CalcZNCC
+					current[i] = MatchPixel(left, right, left_table, right_table, window_y, window_x, x, y, level_min, level_max, level_max, NULL, &columns);
+					continue;
+				}
+				// Upsampled disparity of the coarser level, searched radius pixels to both sides
+				int center = 2 * coarse[std::min(y / 2, coarse_h - 1) * coarse_w + std::min(x / 2, coarse_w - 1)];
+				int d0 = std::max(level_min, center - radius);
+				int d1 = std::min(level_max, center + radius + 1);
+				current[i] = MatchPixel(left, right, left_table, right_table, window_y, window_x, x, y, d0, d1, std::min(std::max(center, level_min), level_max), NULL, &columns);
+			}
+		}
+		}
+		coarse.swap(current);
+		coarse_w = w;
+		coarse_h = h;
+	}
+
+	Image16 disparity_map(img_left.width, img_left.height);
+	for (size_t i = 0; i < coarse.size(); i++) {
+		disparity_map[i] = abs(coarse[i]); // Use absolute value of the disparity
+	}
+	StopTimer(&timer, "ZNCC calculated with a disparity pyramid");
+	return disparity_map;
+}
+
+Image CalcZNCCTemporal(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	ImageView prev_left, ImageView prev_disparity, int window_y, int window_x, int min_disparity, int max_disparity,
+	int radius, float min_confidence, int max_frame_diff, temporal_stats* stats) {
+	int w = img_left.width, h = img_left.height;
+	stats->narrow = 0;
+	stats->full = w * h;
+	// The first frame, or a frame of another size, is searched fully
+	if (prev_left.Empty() || prev_disparity.Empty() || (int)prev_left.width != w || (int)prev_left.height != h ||
+		(int)prev_disparity.width != w || (int)prev_disparity.height != h) {
+		return CalcZNCCIntegralTables(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity);
+	}
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	// Mean absolute difference of every window to the previous frame, from a summed-area table of the differences
+	Image frame_diff(w, h);
+	for (int y = 0; y < h; y++) {
+		const unsigned char* cur_row = img_left.Row(y);
+		const unsigned char* prev_row = prev_left.Row(y);
+		unsigned char* diff_row = frame_diff.Span().Row(y);
+		for (int x = 0; x < w; x++) diff_row[x] = abs(cur_row[x] - prev_row[x]);
+	}
+	integral_image diff_table;
+	BuildIntegralImage(frame_diff, &diff_table);
+	unsigned int stride = w + 1;
+
+	// The maps only keep absolute values, so the sign comes from the disparity range
+	int sign = max_disparity <= 0 ? -1 : 1;
+	Image disparity_map(w, h);
+	std::vector<unsigned char> refresh((size_t)w * h, 0);
+	int full = 0;
+#pragma omp parallel reduction(+:full)
+	{
+	// Column sums of the cross term, one set per thread
+	cross_columns columns;
+	columns.sums.resize((size_t)(max_disparity - min_disparity) * w);
+	columns.rows.assign(columns.sums.size(), -1);
+	columns.min_disparity = min_disparity;
+#pragma omp for schedule(dynamic)
+	for (int y = 0; y < h; y++) {
+		const unsigned char* prev_row = prev_disparity.Row(y);
+		unsigned char* dst = disparity_map.Span().Row(y);
+		int wy0 = std::max(0, y - window_y / 2), wy1 = std::min(h, y + window_y / 2);
+		for (int x = 0; x < w; x++) {
+			int wx0 = std::max(0, x - window_x / 2), wx1 = std::min(w, x + window_x / 2);
+			int count = std::max(1, (wy1 - wy0) * (wx1 - wx0));
+			if (BoxSum(&diff_table.sum[0], stride, wy0, wy1, wx0, wx1) > (double)max_frame_diff * count) {
+				refresh[(size_t)y * w + x] = 1;
+				full++;
+				continue;
+			}
+			// Search radius disparities to both sides of the previous one, and fall back to a full search if the best score is too low
+			int center = sign * prev_row[x];
+			int d0 = std::max(min_disparity, center - radius);
+			int d1 = std::min(max_disparity, center + radius + 1);
+			double best_score;
+			int best = MatchPixel(img_left, img_right, left_table, right_table, window_y, window_x, x, y, d0, d1, max_disparity, &best_score, &columns);
+			if (best_score < min_confidence) {
+				refresh[(size_t)y * w + x] = 1;
+				full++;
+				continue;
+			}
+			dst[x] = abs(best); // Use absolute value of the disparity
+		}
+	}
+	}
+
+	if (full > TEMPORAL_MAX_REFRESH * w * h) {
+		// Too much changed, for example a scene cut, so the product tables are cheaper than searching pixel by pixel
+		Image full_map = CalcZNCCIntegralTables(img_left, img_right, left_table, right_table, window_y, window_x, min_disparity, max_disparity);
+		for (size_t i = 0; i < refresh.size(); i++) {
+			if (refresh[i]) disparity_map[i] = full_map[i];
+		}
+	}
+	else {
+#pragma omp parallel
+		{
+		cross_columns columns;
+		columns.sums.resize((size_t)(max_disparity - min_disparity) * w);
+		columns.rows.assign(columns.sums.size(), -1);
+		columns.min_disparity = min_disparity;
+#pragma omp for schedule(dynamic)
+		for (int y = 0; y < h; y++) {
+			unsigned char* dst = disparity_map.Span().Row(y);
+			for (int x = 0; x < w; x++) {
+				if (!refresh[(size_t)y * w + x]) continue;
+				// Failed pixels get the maximum like in CalcZNCC
+				dst[x] = abs(MatchPixel(img_left, img_right, left_table, right_table, window_y, window_x, x, y, min_disparity, max_disparity, max_disparity, NULL, &columns));
+			}
+		}
+		}
+	}
+	stats->full = full;
+	stats->narrow = w * h - full;
+
+	StopTimer(&timer, "ZNCC calculated from the previous frame");
+	return disparity_map;
+}
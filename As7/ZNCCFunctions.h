@@ -0,0 +1,294 @@
+#ifndef ZNCCFUNCTIONS_H_INCLUDED
+#define ZNCCFUNCTIONS_H_INCLUDED
+
+/*********************************************************
+* ALTERNATIVE CPU BACKENDS FOR CalcZNCC
+* Every backend has the same signature as CalcZNCC in ImageFunctions.h, and produces the same disparity map,
+* so main.cpp can switch between them with the ZNCC_BACKEND flag
+*********************************************************/
+
+#include <vector>
+#include "Image.h"
+
+/*
+* \brief Function pointer type shared by CalcZNCC and all of its alternative backends
+*/
+typedef Image(*zncc_backend)(ImageView, ImageView, int, int, int, int);
+
+/*
+* \brief Summed-area tables of an image and of its squared values. Both tables are (w + 1) * (h + 1) in size,
+* with a zero first row and column, so sum[y * (w + 1) + x] is the sum of all pixels above and left of (x, y).
+* The values are allowed to wrap around, box sums are still exact as long as a single window fits in 32 bits
+* \param sum Summed-area table of I
+* \param sum_sq Summed-area table of I^2
+* \param w Width of the image
+* \param h Height of the image
+*/
+typedef struct {
+	std::vector<unsigned int> sum;
+	std::vector<unsigned int> sum_sq;
+	unsigned int w;
+	unsigned int h;
+} integral_image;
+
+/*
+* \brief ZNCC scores of a band of image rows for every disparity. Scores are stored disparity-major, so the score of
+* pixel (x, y) at disparity min_disparity + i is scores[(i * rows + y - y0) * w + x]. Windows without any pixel inside
+* the image get the worst possible score, -1
+* \param scores The scores, disparity_count * rows * w values
+* \param w Image width
+* \param y0 First image row of the band
+* \param rows Number of rows in the band
+* \param min_disparity Disparity of the first slice
+* \param disparity_count Number of disparity slices
+*/
+typedef struct {
+	std::vector<float> scores;
+	unsigned int w;
+	int y0;
+	int rows;
+	int min_disparity;
+	int disparity_count;
+} cost_volume;
+
+/*
+* \brief Calculates the ZNCC value of a window from its plain sums. The means are divided by the full window size
+* and the sums only cover the pixels inside the image, exactly like the two window loops in CalcZNCC
+* \param sum_l Sum of the left window
+* \param sum_r Sum of the right window
+* \param sum_ll Sum of the squared left window
+* \param sum_rr Sum of the squared right window
+* \param sum_lr Sum of the left window multiplied by the right window
+* \param count Number of pixels that were summed
+* \param window_size Size of the whole window
+* \return ZNCC value, NaN for flat windows
+*/
+double ZNCCFromSums(double sum_l, double sum_r, double sum_ll, double sum_rr, double sum_lr, double count, int window_size);
+
+/*
+* \brief Builds the summed-area tables of I and I^2 for the given grayscale image
+* \param img Grayscale image
+* \param out The tables are stored here
+* \return Nothing
+*/
+void BuildIntegralImage(ImageView img, integral_image* out);
+
+/*
+* \brief Calculates ZNCC like CalcZNCC, but looks the window means, variances and the cross term up from
+* summed-area tables of I, I^2 and L * R(x - d). Cost is O(w * h * D) instead of O(w * h * D * window_x * window_y)
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The result
+*/
+Image CalcZNCCIntegral(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity);
+
+/*
+* \brief Same as CalcZNCCIntegral, but uses summed-area tables that were already built, for example by ResizeGrayScaleImage
+* \param img_left Left image
+* \param img_right Right image
+* \param left_table Summed-area tables of the left image
+* \param right_table Summed-area tables of the right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The result
+*/
+Image CalcZNCCIntegralTables(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity);
+
+/*
+* \brief Calculates both disparity maps at once, left=img_left with disparities [min_disparity, max_disparity) and
+* left=img_right with [-max_disparity, -min_disparity). The window pair of L(x) and R(x - d) is the same in both,
+* so every pair is scored once from the summed-area tables and offered to both maps, which halves the work of
+* two CalcZNCCIntegralTables calls. Ties go to the same disparities, the scores of the right map can only differ
+* from CalcZNCCIntegralTables in the last bit, as the sums are passed to ZNCCFromSums the other way around
+* \param img_left Left image
+* \param img_right Right image
+* \param left_table Summed-area tables of the left image
+* \param right_table Summed-area tables of the right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value of the left map
+* \param max_disparity Maximum disparity value of the left map
+* \param right_map Disparity map with img_right as the left image is stored here
+* \return Disparity map with img_left as the left image
+*/
+Image CalcZNCCBidirectional(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity, Image* right_map);
+
+/*
+* \brief Calculates ZNCC like CalcZNCC, but keeps running sums instead of re-summing every window. Column sums for
+* each disparity are updated by one row as y advances, and the window sums by one column as x advances, so the cost
+* does not depend on the window size
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The result
+*/
+Image CalcZNCCSliding(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity);
+
+/*
+* \brief Fills the cost volume of image rows [y0, y1), one disparity slice at a time. The window sums are looked up
+* from the summed-area tables, so the volume is written in order and the right image is read row by row
+* \param img_left Left image
+* \param img_right Right image
+* \param left_table Summed-area tables of the left image
+* \param right_table Summed-area tables of the right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \param y0 First row of the band
+* \param y1 End of the band, exclusive
+* \param volume The scores are stored here
+* \return Nothing
+*/
+void ComputeCostVolume(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	int window_y, int window_x, int min_disparity, int max_disparity, int y0, int y1, cost_volume* volume);
+
+/*
+* \brief Picks the best scoring disparity of every pixel in the cost volume. Runs over the disparity slices in order
+* with a branchless update, so the compiler can vectorize it over x
+* \param volume Cost volume of a band of rows
+* \param disparity_map Absolute values of the winning disparities are written to the band's rows of this map
+* \return Nothing
+*/
+void WinnerTakeAll(const cost_volume& volume, ImageSpan disparity_map);
+
+/*
+* \brief Same as WinnerTakeAll, but also keeps the scores on both sides of every winner while it runs, and fits a parabola
+* through the three scores to refine the disparity to a fraction of a pixel. Winners at the ends of the disparity range
+* or next to a window without a score keep their integer disparity
+* \param volume Cost volume of a band of rows
+* \param disparity_map Absolute values of the winning disparities are written to the band's rows of this map
+* \param subpixel_map Absolute values of the refined disparities are written to the band's rows of this map
+* \return Nothing
+*/
+void WinnerTakeAllSubpixel(const cost_volume& volume, ImageSpan disparity_map, ImageSpanF subpixel_map);
+
+/*
+* \brief Same as CalcZNCCCostVolume, but the winner-take-all pass also refines the disparities with WinnerTakeAllSubpixel
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \param subpixel_map The refined disparity map is stored here
+* \return The integer disparity map, the same as CalcZNCCCostVolume gives
+*/
+Image CalcZNCCSubpixel(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity, ImageF* subpixel_map);
+
+/*
+* \brief Calculates ZNCC like CalcZNCC, but first builds a disparity-major cost volume for a band of rows and then
+* runs a single winner-take-all pass over it. Memory use is bounded by the band height, not by the image size
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The result
+*/
+Image CalcZNCCCostVolume(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity);
+
+/*
+* \brief Calculates ZNCC coarse-to-fine, for example on full resolution images where an exhaustive search of every
+* disparity would be too slow. Both images are halved with DownsampleImage into a box pyramid of up to levels levels.
+* The coarsest level searches its whole scaled disparity range, and every finer level only searches radius disparities
+* to both sides of the doubled disparity of the coarser level. Windows keep their size on every level and are compared
+* like in CalcZNCC
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value at full resolution
+* \param max_disparity Maximum disparity value at full resolution
+* \param levels Number of pyramid levels, the given images included. Fewer are used if the windows would not fit
+* \param radius Disparities searched to both sides of the coarser level's estimate
+* \return The result, with 16 bits so disparities above 255 fit
+*/
+Image16 CalcZNCCPyramid(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity, int levels, int radius);
+
+/*
+* \brief How CalcZNCCTemporal searched the pixels of a frame
+* \param narrow Pixels only searched around the previous disparity
+* \param full Pixels searched over the whole disparity range
+*/
+typedef struct {
+	int narrow;
+	int full;
+} temporal_stats;
+
+/*
+* \brief Calculates ZNCC for a frame of a stereo video from the disparity map of the previous frame. Every pixel is searched
+* radius disparities to both sides of its previous disparity. The whole range is searched where the mean absolute difference
+* of the window to the previous frame is above max_frame_diff, or where the best score of the narrow search is below min_confidence.
+* Fully searched pixels get the same disparity as CalcZNCCIntegralTables gives. Without a previous frame the whole frame is searched
+* \param img_left Left image
+* \param img_right Right image
+* \param left_table Summed-area tables of the left image
+* \param right_table Summed-area tables of the right image
+* \param prev_left Left image of the previous frame. Can be empty
+* \param prev_disparity Disparity map of the previous frame, with the same disparity range. Can be empty
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \param radius Disparities searched to both sides of the previous disparity
+* \param min_confidence Lowest ZNCC score the narrow search may end with
+* \param max_frame_diff Largest mean absolute difference of a window to the previous frame
+* \param stats Numbers of narrow and fully searched pixels are stored here
+* \return The result
+*/
+Image CalcZNCCTemporal(ImageView img_left, ImageView img_right, const integral_image& left_table, const integral_image& right_table,
+	ImageView prev_left, ImageView prev_disparity, int window_y, int window_x, int min_disparity, int max_disparity,
+	int radius, float min_confidence, int max_frame_diff, temporal_stats* stats);
+
+/*
+* \brief Instruction sets CalcZNCCSimd can use, in increasing order
+*/
+typedef enum {
+	SIMD_SCALAR,
+	SIMD_SSE41,
+	SIMD_AVX2,
+	SIMD_AVX512,
+} simd_level;
+
+/*
+* \brief Checks with cpuid which instruction sets the CPU and the OS support
+* \return Best supported simd_level
+*/
+simd_level DetectSimdLevel();
+
+/*
+* \brief Limits the instruction set CalcZNCCSimd is allowed to use. Useful for comparing against the scalar kernel
+* \param level Highest allowed simd_level. The detected level is still used if it is lower
+* \return Nothing
+*/
+void SetMaxSimdLevel(simd_level level);
+
+/*
+* \brief Calculates ZNCC like CalcZNCC, with the window sums of 8 (SSE4.1), 16 (AVX2) or 32 (AVX-512) adjacent pixels
+* evaluated at once using uint8 -> int16 widening multiply-adds. The instruction set is picked at runtime. Pixels whose
+* window crosses the image border use the scalar kernel, which is also used on CPUs without SSE4.1
+* \param img_left Left image
+* \param img_right Right image
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The result
+*/
+Image CalcZNCCSimd(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity);
+
+
+#endif
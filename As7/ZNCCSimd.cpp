@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <vector>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include "ZNCCFunctions.h"
+#include "TileScheduler.h"
+#include "Timer.h"
+
+/* Sources:
+* "Intel Intrinsics Guide" - https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+* "Detecting AVX, AVX2 and AVX-512 support" - https://learn.microsoft.com/en-us/cpp/intrinsics/cpuid-cpuidex
+*/
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ZNCC_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ZNCC_TARGET(isa) // MSVC allows intrinsics of any instruction set without extra flags
+#else
+#include <cpuid.h>
+#define ZNCC_TARGET(isa) __attribute__((target(isa)))
+#endif
+#else
+#define ZNCC_X86 0
+#endif
+
+#define SIMD_MAX_LANES 32 // Pixels handled by one AVX-512 kernel call
+#define SIMD_BAND_HEIGHT 8 // Rows of one TileScheduler tile
+
+/*
+* \brief Window sums of adjacent pixels, one lane per pixel
+*/
+typedef struct {
+	int l[SIMD_MAX_LANES];
+	int r[SIMD_MAX_LANES];
+	int ll[SIMD_MAX_LANES];
+	int rr[SIMD_MAX_LANES];
+	int lr[SIMD_MAX_LANES];
+} lane_sums;
+
+/*
+* \brief Kernel that sums the full windows of pixels [x0, x0 + lanes) on row y at disparity d.
+* The caller makes sure all of the windows are inside the image
+*/
+typedef void (*window_sums_kernel)(ImageView left, ImageView right, int x0, int y, int d,
+	int win_y0, int win_y1, int win_x0, int win_x1, lane_sums* out);
+
+static std::atomic<int> max_simd_level(SIMD_AVX512); // Set by SetMaxSimdLevel, possibly from another thread than the one matching
+
+
+simd_level DetectSimdLevel() {
+#if ZNCC_X86
+	unsigned int regs[4] = { 0, 0, 0, 0 }; // eax, ebx, ecx, edx
+	unsigned int leaf7_ebx = 0;
+	unsigned long long xcr0 = 0;
+#ifdef _MSC_VER
+	__cpuid((int*)regs, 0);
+	unsigned int max_leaf = regs[0];
+	__cpuid((int*)regs, 1);
+	if (max_leaf >= 7) {
+		int regs7[4];
+		__cpuidex(regs7, 7, 0);
+		leaf7_ebx = regs7[1];
+	}
+	if (regs[2] & (1 << 27)) xcr0 = _xgetbv(0);
+#else
+	unsigned int max_leaf = __get_cpuid_max(0, NULL);
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+	if (max_leaf >= 7) {
+		unsigned int a, b, c, d;
+		__cpuid_count(7, 0, a, b, c, d);
+		leaf7_ebx = b;
+	}
+	if (regs[2] & (1 << 27)) {
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((unsigned long long)hi << 32) | lo;
+	}
+#endif
+	bool sse41 = regs[2] & (1 << 19);
+	// The OS has to save the YMM and ZMM registers too, not just the CPU support them
+	bool os_avx = (regs[2] & (1 << 28)) && (xcr0 & 0x6) == 0x6;
+	bool os_avx512 = os_avx && (xcr0 & 0xE0) == 0xE0;
+	bool avx2 = os_avx && (leaf7_ebx & (1 << 5));
+	bool avx512 = os_avx512 && (leaf7_ebx & (1 << 16)) && (leaf7_ebx & (1 << 30)); // AVX-512F + AVX-512BW
+
+	if (avx512) return SIMD_AVX512;
+	if (avx2) return SIMD_AVX2;
+	if (sse41) return SIMD_SSE41;
+#endif
+	return SIMD_SCALAR;
+}
+
+void SetMaxSimdLevel(simd_level level) {
+	max_simd_level.store(level);
+}
+
+/*
+* \brief Reference kernel for a single pixel. Sums only the part of the window that is inside the image, like CalcZNCC
+* \return Number of summed pixels
+*/
+static int WindowSumsScalar(ImageView left, ImageView right, int x, int y, int d,
+	int win_y0, int win_y1, int win_x0, int win_x1, lane_sums* out, int lane) {
+	int w = left.width, h = left.height;
+	int y0 = std::max(0, y + win_y0), y1 = std::min(h, y + win_y1);
+	int x0 = std::max(std::max(0, d), x + win_x0), x1 = std::min(std::min(w, w + d), x + win_x1);
+	int sum_l = 0, sum_r = 0, sum_ll = 0, sum_rr = 0, sum_lr = 0;
+
+	for (int row = y0; row < y1; row++) {
+		const unsigned char* l_row = left.Row(row);
+		const unsigned char* r_row = right.Row(row);
+		for (int col = x0; col < x1; col++) {
+			int l = l_row[col];
+			int r = r_row[col - d];
+			sum_l += l;
+			sum_r += r;
+			sum_ll += l * l;
+			sum_rr += r * r;
+			sum_lr += l * r;
+		}
+	}
+	out->l[lane] = sum_l;
+	out->r[lane] = sum_r;
+	out->ll[lane] = sum_ll;
+	out->rr[lane] = sum_rr;
+	out->lr[lane] = sum_lr;
+	return std::max(0, y1 - y0) * std::max(0, x1 - x0);
+}
+
+#if ZNCC_X86
+/*
+* \brief The kernels interleave window columns k and k + 1 with unpacklo/unpackhi, which work inside 128-bit lanes.
+* This puts the int32 results of the low and high halves back into pixel order
+*/
+static inline void StoreLanes(const int* lo, const int* hi, int count, int* dst) {
+	for (int i = 0; i < count; i++) {
+		dst[(i / 4) * 8 + i % 4] = lo[i];
+		dst[(i / 4) * 8 + 4 + i % 4] = hi[i];
+	}
+}
+
+ZNCC_TARGET("sse4.1")
+static void WindowSumsSSE41(ImageView left, ImageView right, int x0, int y, int d,
+	int win_y0, int win_y1, int win_x0, int win_x1, lane_sums* out) {
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i l_lo = _mm_setzero_si128(), l_hi = _mm_setzero_si128(), r_lo = _mm_setzero_si128(), r_hi = _mm_setzero_si128();
+	__m128i ll_lo = _mm_setzero_si128(), ll_hi = _mm_setzero_si128(), rr_lo = _mm_setzero_si128(), rr_hi = _mm_setzero_si128();
+	__m128i lr_lo = _mm_setzero_si128(), lr_hi = _mm_setzero_si128();
+	int columns = win_x1 - win_x0;
+
+	for (int row = y + win_y0; row < y + win_y1; row++) {
+		const unsigned char* l_ptr = left.Row(row) + x0 + win_x0;
+		const unsigned char* r_ptr = right.Row(row) + x0 + win_x0 - d;
+		// Two window columns per step, so madd sums column k and k + 1 of the same pixel
+		for (int k = 0; k < columns; k += 2) {
+			__m128i l0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(l_ptr + k)));
+			__m128i r0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r_ptr + k)));
+			__m128i l1 = _mm_setzero_si128(), r1 = _mm_setzero_si128();
+			if (k + 1 < columns) {
+				l1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(l_ptr + k + 1)));
+				r1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r_ptr + k + 1)));
+			}
+			__m128i lp_lo = _mm_unpacklo_epi16(l0, l1), lp_hi = _mm_unpackhi_epi16(l0, l1);
+			__m128i rp_lo = _mm_unpacklo_epi16(r0, r1), rp_hi = _mm_unpackhi_epi16(r0, r1);
+			l_lo = _mm_add_epi32(l_lo, _mm_madd_epi16(lp_lo, ones));
+			l_hi = _mm_add_epi32(l_hi, _mm_madd_epi16(lp_hi, ones));
+			r_lo = _mm_add_epi32(r_lo, _mm_madd_epi16(rp_lo, ones));
+			r_hi = _mm_add_epi32(r_hi, _mm_madd_epi16(rp_hi, ones));
+			ll_lo = _mm_add_epi32(ll_lo, _mm_madd_epi16(lp_lo, lp_lo));
+			ll_hi = _mm_add_epi32(ll_hi, _mm_madd_epi16(lp_hi, lp_hi));
+			rr_lo = _mm_add_epi32(rr_lo, _mm_madd_epi16(rp_lo, rp_lo));
+			rr_hi = _mm_add_epi32(rr_hi, _mm_madd_epi16(rp_hi, rp_hi));
+			lr_lo = _mm_add_epi32(lr_lo, _mm_madd_epi16(lp_lo, rp_lo));
+			lr_hi = _mm_add_epi32(lr_hi, _mm_madd_epi16(lp_hi, rp_hi));
+		}
+	}
+	int lo[4], hi[4];
+	_mm_storeu_si128((__m128i*)lo, l_lo); _mm_storeu_si128((__m128i*)hi, l_hi); StoreLanes(lo, hi, 4, out->l);
+	_mm_storeu_si128((__m128i*)lo, r_lo); _mm_storeu_si128((__m128i*)hi, r_hi); StoreLanes(lo, hi, 4, out->r);
+	_mm_storeu_si128((__m128i*)lo, ll_lo); _mm_storeu_si128((__m128i*)hi, ll_hi); StoreLanes(lo, hi, 4, out->ll);
+	_mm_storeu_si128((__m128i*)lo, rr_lo); _mm_storeu_si128((__m128i*)hi, rr_hi); StoreLanes(lo, hi, 4, out->rr);
+	_mm_storeu_si128((__m128i*)lo, lr_lo); _mm_storeu_si128((__m128i*)hi, lr_hi); StoreLanes(lo, hi, 4, out->lr);
+}
+
+ZNCC_TARGET("avx2")
+static void WindowSumsAVX2(ImageView left, ImageView right, int x0, int y, int d,
+	int win_y0, int win_y1, int win_x0, int win_x1, lane_sums* out) {
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i l_lo = _mm256_setzero_si256(), l_hi = _mm256_setzero_si256(), r_lo = _mm256_setzero_si256(), r_hi = _mm256_setzero_si256();
+	__m256i ll_lo = _mm256_setzero_si256(), ll_hi = _mm256_setzero_si256(), rr_lo = _mm256_setzero_si256(), rr_hi = _mm256_setzero_si256();
+	__m256i lr_lo = _mm256_setzero_si256(), lr_hi = _mm256_setzero_si256();
+	int columns = win_x1 - win_x0;
+
+	for (int row = y + win_y0; row < y + win_y1; row++) {
+		const unsigned char* l_ptr = left.Row(row) + x0 + win_x0;
+		const unsigned char* r_ptr = right.Row(row) + x0 + win_x0 - d;
+		for (int k = 0; k < columns; k += 2) {
+			__m256i l0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(l_ptr + k)));
+			__m256i r0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(r_ptr + k)));
+			__m256i l1 = _mm256_setzero_si256(), r1 = _mm256_setzero_si256();
+			if (k + 1 < columns) {
+				l1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(l_ptr + k + 1)));
+				r1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(r_ptr + k + 1)));
+			}
+			__m256i lp_lo = _mm256_unpacklo_epi16(l0, l1), lp_hi = _mm256_unpackhi_epi16(l0, l1);
+			__m256i rp_lo = _mm256_unpacklo_epi16(r0, r1), rp_hi = _mm256_unpackhi_epi16(r0, r1);
+			l_lo = _mm256_add_epi32(l_lo, _mm256_madd_epi16(lp_lo, ones));
+			l_hi = _mm256_add_epi32(l_hi, _mm256_madd_epi16(lp_hi, ones));
+			r_lo = _mm256_add_epi32(r_lo, _mm256_madd_epi16(rp_lo, ones));
+			r_hi = _mm256_add_epi32(r_hi, _mm256_madd_epi16(rp_hi, ones));
+			ll_lo = _mm256_add_epi32(ll_lo, _mm256_madd_epi16(lp_lo, lp_lo));
+			ll_hi = _mm256_add_epi32(ll_hi, _mm256_madd_epi16(lp_hi, lp_hi));
+			rr_lo = _mm256_add_epi32(rr_lo, _mm256_madd_epi16(rp_lo, rp_lo));
+			rr_hi = _mm256_add_epi32(rr_hi, _mm256_madd_epi16(rp_hi, rp_hi));
+			lr_lo = _mm256_add_epi32(lr_lo, _mm256_madd_epi16(lp_lo, rp_lo));
+			lr_hi = _mm256_add_epi32(lr_hi, _mm256_madd_epi16(lp_hi, rp_hi));
+		}
+	}
+	int lo[8], hi[8];
+	_mm256_storeu_si256((__m256i*)lo, l_lo); _mm256_storeu_si256((__m256i*)hi, l_hi); StoreLanes(lo, hi, 8, out->l);
+	_mm256_storeu_si256((__m256i*)lo, r_lo); _mm256_storeu_si256((__m256i*)hi, r_hi); StoreLanes(lo, hi, 8, out->r);
+	_mm256_storeu_si256((__m256i*)lo, ll_lo); _mm256_storeu_si256((__m256i*)hi, ll_hi); StoreLanes(lo, hi, 8, out->ll);
+	_mm256_storeu_si256((__m256i*)lo, rr_lo); _mm256_storeu_si256((__m256i*)hi, rr_hi); StoreLanes(lo, hi, 8, out->rr);
+	_mm256_storeu_si256((__m256i*)lo, lr_lo); _mm256_storeu_si256((__m256i*)hi, lr_hi); StoreLanes(lo, hi, 8, out->lr);
+}
+
+ZNCC_TARGET("avx512f,avx512bw")
+static void WindowSumsAVX512(ImageView left, ImageView right, int x0, int y, int d,
+	int win_y0, int win_y1, int win_x0, int win_x1, lane_sums* out) {
+	const __m512i ones = _mm512_set1_epi16(1);
+	__m512i l_lo = _mm512_setzero_si512(), l_hi = _mm512_setzero_si512(), r_lo = _mm512_setzero_si512(), r_hi = _mm512_setzero_si512();
+	__m512i ll_lo = _mm512_setzero_si512(), ll_hi = _mm512_setzero_si512(), rr_lo = _mm512_setzero_si512(), rr_hi = _mm512_setzero_si512();
+	__m512i lr_lo = _mm512_setzero_si512(), lr_hi = _mm512_setzero_si512();
+	int columns = win_x1 - win_x0;
+
+	for (int row = y + win_y0; row < y + win_y1; row++) {
+		const unsigned char* l_ptr = left.Row(row) + x0 + win_x0;
+		const unsigned char* r_ptr = right.Row(row) + x0 + win_x0 - d;
+		for (int k = 0; k < columns; k += 2) {
+			__m512i l0 = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(l_ptr + k)));
+			__m512i r0 = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(r_ptr + k)));
+			__m512i l1 = _mm512_setzero_si512(), r1 = _mm512_setzero_si512();
+			if (k + 1 < columns) {
+				l1 = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(l_ptr + k + 1)));
+				r1 = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(r_ptr + k + 1)));
+			}
+			__m512i lp_lo = _mm512_unpacklo_epi16(l0, l1), lp_hi = _mm512_unpackhi_epi16(l0, l1);
+			__m512i rp_lo = _mm512_unpacklo_epi16(r0, r1), rp_hi = _mm512_unpackhi_epi16(r0, r1);
+			l_lo = _mm512_add_epi32(l_lo, _mm512_madd_epi16(lp_lo, ones));
+			l_hi = _mm512_add_epi32(l_hi, _mm512_madd_epi16(lp_hi, ones));
+			r_lo = _mm512_add_epi32(r_lo, _mm512_madd_epi16(rp_lo, ones));
+			r_hi = _mm512_add_epi32(r_hi, _mm512_madd_epi16(rp_hi, ones));
+			ll_lo = _mm512_add_epi32(ll_lo, _mm512_madd_epi16(lp_lo, lp_lo));
+			ll_hi = _mm512_add_epi32(ll_hi, _mm512_madd_epi16(lp_hi, lp_hi));
+			rr_lo = _mm512_add_epi32(rr_lo, _mm512_madd_epi16(rp_lo, rp_lo));
+			rr_hi = _mm512_add_epi32(rr_hi, _mm512_madd_epi16(rp_hi, rp_hi));
+			lr_lo = _mm512_add_epi32(lr_lo, _mm512_madd_epi16(lp_lo, rp_lo));
+			lr_hi = _mm512_add_epi32(lr_hi, _mm512_madd_epi16(lp_hi, rp_hi));
+		}
+	}
+	int lo[16], hi[16];
+	_mm512_storeu_si512(lo, l_lo); _mm512_storeu_si512(hi, l_hi); StoreLanes(lo, hi, 16, out->l);
+	_mm512_storeu_si512(lo, r_lo); _mm512_storeu_si512(hi, r_hi); StoreLanes(lo, hi, 16, out->r);
+	_mm512_storeu_si512(lo, ll_lo); _mm512_storeu_si512(hi, ll_hi); StoreLanes(lo, hi, 16, out->ll);
+	_mm512_storeu_si512(lo, rr_lo); _mm512_storeu_si512(hi, rr_hi); StoreLanes(lo, hi, 16, out->rr);
+	_mm512_storeu_si512(lo, lr_lo); _mm512_storeu_si512(hi, lr_hi); StoreLanes(lo, hi, 16, out->lr);
+}
+#endif
+
+Image CalcZNCCSimd(ImageView img_left, ImageView img_right, int window_y, int window_x, int min_disparity, int max_disparity) {
+	unsigned int w = img_left.width, h = img_left.height;
+	Image disparity_map(w, h);
+	int window_size = window_y * window_x; // Size of the whole window, used as the divisor just like in CalcZNCC
+	int win_y0 = -window_y / 2, win_y1 = window_y / 2;
+	int win_x0 = -window_x / 2, win_x1 = window_x / 2;
+
+	// Pick the kernel
+	simd_level level = std::min(DetectSimdLevel(), (simd_level)max_simd_level.load());
+	window_sums_kernel kernel = NULL;
+	int lanes = 1;
+#if ZNCC_X86
+	if (level == SIMD_AVX512) { kernel = WindowSumsAVX512; lanes = 32; }
+	else if (level == SIMD_AVX2) { kernel = WindowSumsAVX2; lanes = 16; }
+	else if (level == SIMD_SSE41) { kernel = WindowSumsSSE41; lanes = 8; }
+#endif
+	const char* level_names[] = { "scalar", "SSE4.1", "AVX2", "AVX-512" };
+	printf("Using the %s ZNCC kernel\n", level_names[level]);
+
+	timer_struct timer;
+	StartTimer(&timer);
+
+	// Every tile is a band of whole rows
+	GetTileScheduler().Run(w, h, w, SIMD_BAND_HEIGHT, [&](const tile& t) {
+		for (int y = t.y0; y < t.y1; y++) {
+			std::vector<float> max_sum(w, -1); // Start with a small number, so values can update
+			std::vector<int> best_disparity(w, max_disparity);
+			lane_sums sums;
+			// Whole window rows are inside the image
+			bool rows_inside = y + win_y0 >= 0 && y + win_y1 <= (int)h;
+
+			for (int d = min_disparity; d < max_disparity; d++) { // Loop to maximum disparity value
+				// First and last pixel whose whole window is inside both images
+				int inner_x0 = std::max(0, d) - win_x0;
+				int inner_x1 = std::min((int)w, (int)w + d) - win_x1 + 1;
+				int x = 0;
+				while (x < (int)w) {
+					int count;
+					int block = 1;
+					if (kernel != NULL && rows_inside && x >= inner_x0 && x + lanes <= inner_x1) {
+						// The next block of pixels can skip the boundary checks
+						kernel(img_left, img_right, x, y, d, win_y0, win_y1, win_x0, win_x1, &sums);
+						count = (win_y1 - win_y0) * (win_x1 - win_x0);
+						block = lanes;
+					}
+					else {
+						count = WindowSumsScalar(img_left, img_right, x, y, d, win_y0, win_y1, win_x0, win_x1, &sums, 0);
+					}
+
+					for (int lane = 0; lane < block; lane++) {
+						if (count <= 0) continue;
+						float zncc_val = ZNCCFromSums(sums.l[lane], sums.r[lane], sums.ll[lane], sums.rr[lane], sums.lr[lane], count, window_size);
+						// Check if maximum sum and best disparity should be updated based on current zncc value
+						if (zncc_val > max_sum[x + lane]) {
+							best_disparity[x + lane] = d;
+							max_sum[x + lane] = zncc_val;
+						}
+					}
+					x += block;
+				}
+			}
+			// Add resulting best disparity values to the disparity map
+			for (int x = 0; x < (int)w; x++) {
+				disparity_map[y * w + x] = abs(best_disparity[x]); // Use absolute value of the disparity
+			}
+		}
+	});
+
+	StopTimer(&timer, "ZNCC calculated with SIMD kernels");
+	GetTileScheduler().PrintUtilization("ZNCC, SIMD kernels");
+	return disparity_map;
+}
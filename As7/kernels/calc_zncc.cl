@@ -1,7 +1,14 @@
+// Window size and disparity range are given as build options, for example
+// -D WINDOW_Y=13 -D WINDOW_X=11 -D MIN_DISPARITY=0 -D MAX_DISPARITY=65
+// so every loop has constant bounds and can be unrolled
+#if !defined(WINDOW_Y) || !defined(WINDOW_X) || !defined(MIN_DISPARITY) || !defined(MAX_DISPARITY)
+#error "calc_zncc.cl needs WINDOW_Y, WINDOW_X, MIN_DISPARITY and MAX_DISPARITY build options"
+#endif
+
 __kernel void calc_zncc(__global const unsigned char* img_left, 
 						__global const unsigned char* img_right,
 						__global unsigned char* dst,
-						int min_disparity, int max_disparity) {
+						unsigned int width, unsigned int height) {
 	// Calculates ZNCC between two given images
 	
 	// Previously took 1525.946368 milliseconds
@@ -10,8 +17,9 @@ __kernel void calc_zncc(__global const unsigned char* img_left,
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	
-	int w = 735, h = 504;
-	int window_y = 13, window_x = 11;
+	int w = width, h = height;
+	int window_y = WINDOW_Y, window_x = WINDOW_X;
+	int min_disparity = MIN_DISPARITY, max_disparity = MAX_DISPARITY;
 	int window_size = window_y * window_x;
 	int d, win_y, win_x;
 	
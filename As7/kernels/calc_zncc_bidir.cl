@@ -0,0 +1,115 @@
+// CalcZNCC for both disparity maps in one pass. The img_left window at x and the img_right window at x - d are
+// compared by calc_zncc left=img_left at disparity d and again by calc_zncc left=img_right at disparity -d, and the
+// ZNCC value does not depend on which one is the left image. Here every such pair is calculated once and offered to
+// both maps, which roughly halves the work of two calc_zncc runs.
+// The windows, the summing order and the float math are the same as in calc_zncc.cl, and ties go to the disparity
+// each of the two runs would pick, so the maps are the same. Indexes outside the whole image read 0 like in calc_zncc_tiled.
+// A work-group handles whole image rows, one per get_local_size(1), and keeps the best scores of both maps of its rows
+// in local memory. Window size and the disparity range of the left map are build options like in calc_zncc.cl,
+// the right map gets the range -MAX_DISPARITY to -MIN_DISPARITY
+
+#if !defined(WINDOW_Y) || !defined(WINDOW_X) || !defined(MIN_DISPARITY) || !defined(MAX_DISPARITY)
+#error "calc_zncc_bidir.cl needs WINDOW_Y, WINDOW_X, MIN_DISPARITY and MAX_DISPARITY build options"
+#endif
+
+int zncc_column_inside(int x, int w) {
+	// Same border check as in calc_zncc
+	return x - WINDOW_X / 2 >= 0 && WINDOW_X / 2 + x < w;
+}
+
+float zncc_pair(__global const unsigned char* img_left, __global const unsigned char* img_right, int w, int size, int x, int y, int d) {
+	// ZNCC of the img_left window at x and the img_right window at x - d, calculated like in calc_zncc
+	float lw_mean = 0, rw_mean = 0; // Left and right image mean
+	float lw_mean_diff, rw_mean_diff; // Pixel difference from the mean
+	float lower_sum_0 = 0, lower_sum_1 = 0, upper_sum = 0;
+	int window_size = WINDOW_Y * WINDOW_X;
+
+	for (int win_y = -WINDOW_Y / 2; win_y < WINDOW_Y / 2; win_y++) {
+		for (int win_x = -WINDOW_X / 2; win_x < WINDOW_X / 2; win_x++) {
+			int l = (win_y + y) * w + (win_x + x);
+			int r = l - d;
+			lw_mean += (l >= 0 && l < size) ? img_left[l] : 0;
+			rw_mean += (r >= 0 && r < size) ? img_right[r] : 0;
+		}
+	}
+	lw_mean = lw_mean / window_size;
+	rw_mean = rw_mean / window_size;
+
+	for (int win_y = -WINDOW_Y / 2; win_y < WINDOW_Y / 2; win_y++) {
+		for (int win_x = -WINDOW_X / 2; win_x < WINDOW_X / 2; win_x++) {
+			int l = (win_y + y) * w + (win_x + x);
+			int r = l - d;
+			lw_mean_diff = ((l >= 0 && l < size) ? img_left[l] : 0) - lw_mean;
+			rw_mean_diff = ((r >= 0 && r < size) ? img_right[r] : 0) - rw_mean;
+			lower_sum_0 += lw_mean_diff * lw_mean_diff;
+			lower_sum_1 += rw_mean_diff * rw_mean_diff;
+			upper_sum += lw_mean_diff * rw_mean_diff;
+		}
+	}
+	return upper_sum / (sqrt(lower_sum_0) * sqrt(lower_sum_1));
+}
+
+__kernel void calc_zncc_bidir(__global const unsigned char* img_left,
+							  __global const unsigned char* img_right,
+							  __global unsigned char* dst_left,
+							  __global unsigned char* dst_right,
+							  unsigned int width, unsigned int height,
+							  __local float* left_max,
+							  __local float* right_max,
+							  __local short* left_best,
+							  __local short* right_best) {
+	int tx = get_local_id(0);
+	int ty = get_local_id(1);
+	int group_w = get_local_size(0);
+	int y = get_global_id(1);
+	int w = width, h = height;
+	int size = w * h;
+	int min_disparity = MIN_DISPARITY, max_disparity = MAX_DISPARITY;
+	// Rows too close to the top or the bottom are not calculated, but their work-items still have to reach the barriers
+	int row_inside = y - WINDOW_Y / 2 >= 0 && WINDOW_Y / 2 + y < h;
+
+	// Best scores of this row, both maps start like calc_zncc does. The right map keeps d, its disparity is -d
+	__local float* l_max = left_max + ty * w;
+	__local float* r_max = right_max + ty * w;
+	__local short* l_best = left_best + ty * w;
+	__local short* r_best = right_best + ty * w;
+	for (int x = tx; x < w; x += group_w) {
+		l_max[x] = -1;
+		r_max[x] = -1;
+		l_best[x] = max_disparity;
+		r_best[x] = min_disparity;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// The left map uses d in [MIN_DISPARITY, MAX_DISPARITY), the right map d in (MIN_DISPARITY, MAX_DISPARITY]
+	for (int d = min_disparity; d <= max_disparity; d++) {
+		if (row_inside) {
+			// Pair x is needed by left map pixel x and by right map pixel x - d
+			for (int x = min(0, d) + tx; x < max(w, w + d); x += group_w) {
+				int left = d < max_disparity && zncc_column_inside(x, w);
+				int right = d > min_disparity && zncc_column_inside(x - d, w);
+				if (!left && !right) continue;
+				float zncc_val = zncc_pair(img_left, img_right, w, size, x, y, d);
+				if (left && zncc_val > l_max[x]) {
+					l_best[x] = d;
+					l_max[x] = zncc_val;
+				}
+				// The right map goes through its disparities from -MAX_DISPARITY up, i.e. this loop backwards, and keeps the
+				// first of equal scores. Going forwards that is the last one, and -1 must still never win
+				if (right && zncc_val > -1 && zncc_val >= r_max[x - d]) {
+					r_best[x - d] = d;
+					r_max[x - d] = zncc_val;
+				}
+			}
+		}
+		// Right map pixel x - d belongs to another work-item on the next disparity
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (!row_inside) return;
+
+	for (int x = tx; x < w; x += group_w) {
+		if (!zncc_column_inside(x, w)) continue;
+		dst_left[y * w + x] = abs((int)l_best[x]); // Use absolute value of the disparity
+		dst_right[y * w + x] = abs((int)r_best[x]);
+	}
+}
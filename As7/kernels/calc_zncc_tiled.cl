@@ -0,0 +1,95 @@
+// CalcZNCC with the images loaded to local memory once per work-group. Gives the same result as calc_zncc.cl:
+// the windows, the summing order and the float math are the same, only the pixels come from local memory.
+// Pixels are read with the same linear y * w + x index calc_zncc uses, so windows crossing the left or right edge
+// read the neighboring row exactly like it does. Indexes outside the whole image read 0.
+// Window size and disparity range are build options like in calc_zncc.cl
+
+#if !defined(WINDOW_Y) || !defined(WINDOW_X) || !defined(MIN_DISPARITY) || !defined(MAX_DISPARITY)
+#error "calc_zncc_tiled.cl needs WINDOW_Y, WINDOW_X, MIN_DISPARITY and MAX_DISPARITY build options"
+#endif
+
+__kernel void calc_zncc_tiled(__global const unsigned char* img_left,
+							  __global const unsigned char* img_right,
+							  __global unsigned char* dst,
+							  unsigned int w, unsigned int h,
+							  __local unsigned char* left_tile,
+							  __local unsigned char* right_tile) {
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int tx = get_local_id(0);
+	int ty = get_local_id(1);
+	int group_w = get_local_size(0);
+	int group_h = get_local_size(1);
+	int x0 = get_group_id(0) * group_w;
+	int y0 = get_group_id(1) * group_h;
+	int lid = ty * group_w + tx;
+	int group_size = group_w * group_h;
+	int size = w * h;
+
+	int min_disparity = MIN_DISPARITY, max_disparity = MAX_DISPARITY;
+	int window_size = WINDOW_Y * WINDOW_X;
+	// Windows cover [-WINDOW/2, WINDOW/2) around the pixel, like in calc_zncc
+	int tile_h = group_h + 2 * (WINDOW_Y / 2) - 1;
+	int left_w = group_w + 2 * (WINDOW_X / 2) - 1;
+	int right_w = left_w - 1 + max_disparity - min_disparity;
+	// First column of the tiles in image coordinates. The right strip also covers every disparity
+	int left_x0 = x0 - WINDOW_X / 2;
+	int right_x0 = x0 - WINDOW_X / 2 - (max_disparity - 1);
+	int tile_y0 = y0 - WINDOW_Y / 2;
+
+	// Every work-item loads a part of the tiles
+	for (int i = lid; i < tile_h * left_w; i += group_size) {
+		int index = (tile_y0 + i / left_w) * (int)w + left_x0 + i % left_w;
+		left_tile[i] = (index >= 0 && index < size) ? img_left[index] : 0;
+	}
+	for (int i = lid; i < tile_h * right_w; i += group_size) {
+		int index = (tile_y0 + i / right_w) * (int)w + right_x0 + i % right_w;
+		right_tile[i] = (index >= 0 && index < size) ? img_right[index] : 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Work-items outside the image or too close to its borders only helped with loading
+	if (y - WINDOW_Y / 2 < 0 || WINDOW_Y / 2 + y >= h || x - WINDOW_X / 2 < 0 || WINDOW_X / 2 + x >= w) return;
+
+	float lw_mean, rw_mean; // Left and right image mean
+	float lw_mean_diff, rw_mean_diff; // Pixel difference from the mean
+	float lower_sum_0, lower_sum_1, upper_sum;
+	float zncc_val;
+	float max_sum = -1; // Start with a small number, so values can update
+	float best_disparity = max_disparity;
+
+	// Pixel (x + win_x, y + win_y) of the left image is left_tile[(ty + win_y) * left_w + tx + win_x] after these offsets,
+	// and pixel (x + win_x - d, y + win_y) of the right image is right_tile[(ty + win_y) * right_w + tx + win_x + max_disparity - 1 - d]
+	__local const unsigned char* left = left_tile + (ty + WINDOW_Y / 2) * left_w + tx + WINDOW_X / 2;
+	__local const unsigned char* right_base = right_tile + (ty + WINDOW_Y / 2) * right_w + tx + WINDOW_X / 2 + max_disparity - 1;
+
+	for (int d = min_disparity; d < max_disparity; d++) {
+		__local const unsigned char* right = right_base - d;
+		lw_mean = 0, rw_mean = 0;
+		for (int win_y = -WINDOW_Y / 2; win_y < WINDOW_Y / 2; win_y++) {
+			for (int win_x = -WINDOW_X / 2; win_x < WINDOW_X / 2; win_x++) {
+				lw_mean += left[win_y * left_w + win_x];
+				rw_mean += right[win_y * right_w + win_x];
+			}
+		}
+		lw_mean = lw_mean / window_size;
+		rw_mean = rw_mean / window_size;
+
+		upper_sum = 0, lower_sum_0 = 0, lower_sum_1 = 0, zncc_val = 0;
+		for (int win_y = -WINDOW_Y / 2; win_y < WINDOW_Y / 2; win_y++) {
+			for (int win_x = -WINDOW_X / 2; win_x < WINDOW_X / 2; win_x++) {
+				lw_mean_diff = left[win_y * left_w + win_x] - lw_mean;
+				rw_mean_diff = right[win_y * right_w + win_x] - rw_mean;
+				lower_sum_0 += lw_mean_diff * lw_mean_diff;
+				lower_sum_1 += rw_mean_diff * rw_mean_diff;
+				upper_sum += lw_mean_diff * rw_mean_diff;
+			}
+		}
+		zncc_val = upper_sum / (sqrt(lower_sum_0) * sqrt(lower_sum_1));
+		if (zncc_val > max_sum) {
+			best_disparity = d;
+			max_sum = zncc_val;
+		}
+	}
+	dst[y * w + x] = abs((int)best_disparity); // Use absolute value of the disparity
+}
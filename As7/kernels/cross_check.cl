@@ -1,15 +1,14 @@
-__kernel void cross_check(__global const unsigned char* left, __global const unsigned char* right, __global unsigned char* dst, unsigned int w, unsigned int h, int th) {
-	// Perform cross check between two images
-	// Loop structure from the pure C++ implementation removed
+__kernel void cross_check(__global const unsigned char* left, __global const unsigned char* right, __global unsigned char* dst, unsigned int w, unsigned int h, int th, unsigned int invalid) {
+	// Left-right consistency check. Pixel x of the left disparity map matched pixel x - d of the right image,
+	// and the disparity the right map has there must be within th of d
 	
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int coord = y*w + x;
 	
-	int current_value = abs( (int) (left[coord]-right[coord]));
-	if (current_value > th) {
-		dst[coord] = 0;
-	} else {
-		dst[coord] = right[coord];
-	}	
+	// Neighboring work-items read neighboring left pixels, and their lookups stay on the same row of the right map
+	int d = left[coord];
+	int match = x - d;
+	int back = right[y*w + max(match, 0)];
+	dst[coord] = (match >= 0 && abs(d - back) <= th) ? d : invalid;
 }
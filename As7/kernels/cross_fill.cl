@@ -0,0 +1,117 @@
+// Cross check and occlusion fill in one pass. Every work-group cross checks its tile and a border of radius pixels
+// into local memory, and the zero pixels of the tile look for their nearest non-zero pixel there. The square rings are
+// searched in the same order find_nearest in ImageFunctions.cpp uses, so the fill is the same as OcclusionFill.
+// Pixels without a non-zero pixel within radius continue the search from global memory.
+// The minimum and maximum of both results are stored in range as { cross min, cross max, fill min, fill max },
+// so range must be { 255, 0, 255, 0 } before the kernel starts. normalize_cross_fill then normalizes both results
+
+unsigned char cross_value(__global const unsigned char* left, __global const unsigned char* right, unsigned int w, int x, int y, int th) {
+	// Same as cross_check.cl. Failed pixels are 0, the holes the fill looks for
+	int d = left[y * w + x];
+	int match = x - d;
+	int back = right[y * w + max(match, 0)];
+	return (match >= 0 && abs(d - back) <= th) ? d : 0;
+}
+
+unsigned char search_ring_local(__local const unsigned char* tile, int tile_w, int center, int spread) {
+	// Upper row first, then left column first. Rows between the top and the bottom only have their two ends in the ring
+	for (int dy = -spread; dy <= spread; dy++) {
+		int step = (dy == -spread || dy == spread) ? 1 : 2 * spread;
+		for (int dx = -spread; dx <= spread; dx += step) {
+			unsigned char value = tile[center + dy * tile_w + dx];
+			if (value != 0) return value;
+		}
+	}
+	return 0;
+}
+
+unsigned char search_ring_global(__global const unsigned char* left, __global const unsigned char* right, unsigned int w, unsigned int h, int th,
+								 int x, int y, int spread) {
+	// Same order as search_ring_local, cross checking the pixels on the fly
+	for (int dy = -spread; dy <= spread; dy++) {
+		int ny = y + dy;
+		if (ny < 0 || ny >= h) continue;
+		int step = (dy == -spread || dy == spread) ? 1 : 2 * spread;
+		for (int dx = -spread; dx <= spread; dx += step) {
+			int nx = x + dx;
+			if (nx < 0 || nx >= w) continue;
+			unsigned char value = cross_value(left, right, w, nx, ny, th);
+			if (value != 0) return value;
+		}
+	}
+	return 0;
+}
+
+__kernel void cross_fill(__global const unsigned char* left, __global const unsigned char* right,
+						 __global unsigned char* cross, __global unsigned char* fill, __global unsigned int* range,
+						 unsigned int w, unsigned int h, int th, int radius,
+						 __local unsigned char* tile) {
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int tx = get_local_id(0);
+	int ty = get_local_id(1);
+	int group_w = get_local_size(0);
+	int group_h = get_local_size(1);
+	int lid = ty * group_w + tx;
+	int tile_w = group_w + 2 * radius;
+	int tile_h = group_h + 2 * radius;
+	int tile_x0 = get_group_id(0) * group_w - radius;
+	int tile_y0 = get_group_id(1) * group_h - radius;
+	__local unsigned int group_range[4];
+
+	if (lid == 0) {
+		group_range[0] = 255, group_range[1] = 0;
+		group_range[2] = 255, group_range[3] = 0;
+	}
+	// Every work-item cross checks a part of the tile. Pixels outside the image are 0, so the search skips them like find_nearest does
+	for (int i = lid; i < tile_w * tile_h; i += group_w * group_h) {
+		int ix = tile_x0 + i % tile_w;
+		int iy = tile_y0 + i / tile_w;
+		tile[i] = (ix >= 0 && ix < w && iy >= 0 && iy < h) ? cross_value(left, right, w, ix, iy, th) : 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Work-items outside the image only helped with loading
+	if (x < w && y < h) {
+		int center = (ty + radius) * tile_w + tx + radius;
+		unsigned int cross_val = tile[center];
+		unsigned int fill_val = cross_val;
+		for (int spread = 1; spread <= radius && fill_val == 0; spread++) {
+			fill_val = search_ring_local(tile, tile_w, center, spread);
+		}
+		// The farthest ring that still has pixels of the image
+		int max_spread = max(max(x, (int)w - 1 - x), max(y, (int)h - 1 - y));
+		for (int spread = radius + 1; spread <= max_spread && fill_val == 0; spread++) {
+			fill_val = search_ring_global(left, right, w, h, th, x, y, spread);
+		}
+		cross[y * w + x] = cross_val;
+		fill[y * w + x] = fill_val;
+		atomic_min(&group_range[0], cross_val);
+		atomic_max(&group_range[1], cross_val);
+		atomic_min(&group_range[2], fill_val);
+		atomic_max(&group_range[3], fill_val);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// One global atomic per value and work-group
+	if (lid == 0) {
+		atomic_min(&range[0], group_range[0]);
+		atomic_max(&range[1], group_range[1]);
+		atomic_min(&range[2], group_range[2]);
+		atomic_max(&range[3], group_range[3]);
+	}
+}
+
+__kernel void normalize_cross_fill(__global const unsigned char* cross, __global const unsigned char* fill,
+								   __global unsigned char* cross_norm, __global unsigned char* fill_norm,
+								   unsigned int w, __global const unsigned int* range) {
+	// normalize_img for both results of cross_fill, with the ranges it found
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int coord = y*w+x;
+	unsigned int cross_min = range[0], cross_max = range[1];
+	unsigned int fill_min = range[2], fill_max = range[3];
+
+	cross_norm[coord] = cross_max > cross_min ? 255 * (cross[coord]-cross_min)/(cross_max-cross_min) : 0;
+	fill_norm[coord] = fill_max > fill_min ? 255 * (fill[coord]-fill_min)/(fill_max-fill_min) : 0;
+}
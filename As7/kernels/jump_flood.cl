@@ -0,0 +1,48 @@
+// Jump flooding occlusion fill. Every pixel keeps the index y*w+x of the nearest non-zero pixel found so far, or -1.
+// Distance is the same square ring distance the CPU OcclusionFill uses, and equally far seeds are ordered by index,
+// which is the order find_nearest scans them in
+
+int seed_distance(int seed, int x, int y, unsigned int w) {
+	return max(abs(seed % (int)w - x), abs(seed / (int)w - y));
+}
+
+__kernel void jfa_init(__global const unsigned char* cross, __global int* seeds, unsigned int w, unsigned int h) {
+	// Non-zero pixels are their own seeds
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int coord = y*w + x;
+	seeds[coord] = cross[coord] != 0 ? coord : -1;
+}
+
+__kernel void jfa_step(__global const int* src, __global int* dst, unsigned int w, unsigned int h, int step) {
+	// Look at the seeds of the 8 pixels step away, and keep the closest one
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int best = src[y*w + x];
+	int best_dist = best >= 0 ? seed_distance(best, x, y, w) : INT_MAX;
+
+	for (int dy = -step; dy <= step; dy += step) {
+		int ny = y + dy;
+		if (ny < 0 || ny >= h) continue;
+		for (int dx = -step; dx <= step; dx += step) {
+			int nx = x + dx;
+			if (nx < 0 || nx >= w || (dx == 0 && dy == 0)) continue;
+			int seed = src[ny*w + nx];
+			if (seed < 0) continue;
+			int dist = seed_distance(seed, x, y, w);
+			if (dist < best_dist || (dist == best_dist && seed < best)) {
+				best = seed;
+				best_dist = dist;
+			}
+		}
+	}
+	dst[y*w + x] = best;
+}
+
+__kernel void jfa_resolve(__global const unsigned char* cross, __global const int* seeds, __global unsigned char* dst, unsigned int w, unsigned int h) {
+	// Copy the value of the nearest seed. Stays 0 if the whole image was 0
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int seed = seeds[y*w + x];
+	dst[y*w + x] = seed >= 0 ? cross[seed] : 0;
+}
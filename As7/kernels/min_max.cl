@@ -0,0 +1,31 @@
+// Minimum and maximum of an 8-bit image, so the images can be normalized without reading them back.
+// Every work-item goes through the image with a stride of the global size, the work-group reduces
+// the values in local memory, and the first work-item merges the result of the group into min_max with atomics.
+// min_max must be { 255, 0 } before the kernel starts. The work-group size must be a power of two
+
+__kernel void min_max(__global const unsigned char* src, unsigned int size, __global unsigned int* min_max,
+					  __local unsigned int* local_min, __local unsigned int* local_max) {
+	int lid = get_local_id(0);
+	unsigned int min_val = 255, max_val = 0;
+	for (unsigned int i = get_global_id(0); i < size; i += get_global_size(0)) {
+		unsigned int value = src[i];
+		min_val = min(min_val, value);
+		max_val = max(max_val, value);
+	}
+	local_min[lid] = min_val;
+	local_max[lid] = max_val;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Halve the active work-items every round
+	for (int offset = get_local_size(0) / 2; offset > 0; offset /= 2) {
+		if (lid < offset) {
+			local_min[lid] = min(local_min[lid], local_min[lid + offset]);
+			local_max[lid] = max(local_max[lid], local_max[lid + offset]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) {
+		atomic_min(&min_max[0], local_min[0]);
+		atomic_max(&min_max[1], local_max[0]);
+	}
+}
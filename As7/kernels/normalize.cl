@@ -1,8 +1,12 @@
-__kernel void normalize_img(__global const unsigned char* src, __global unsigned char* dst, unsigned int w, unsigned int min, unsigned int max) {
+__kernel void normalize_img(__global const unsigned char* src, __global unsigned char* dst, unsigned int w, __global const unsigned int* min_max) {
 	
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int coord = y*w+x;
+	// Minimum and maximum from the min_max kernel
+	unsigned int min = min_max[0];
+	unsigned int max = min_max[1];
 	
-	dst[coord] = 255 * (src[coord]-min)/(max-min);
-}
\ No newline at end of file
+	// An image with a single value has nothing to stretch
+	dst[coord] = max > min ? 255 * (src[coord]-min)/(max-min) : 0;
+}
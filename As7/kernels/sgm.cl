@@ -0,0 +1,156 @@
+// Semi-global matching, the same aggregation as CalcZNCCSGM. A band of image rows is done at a time:
+// sgm_cost turns the ZNCC scores of the band into int16 costs, sgm_aggregate is run once for every path and adds it to
+// the path sums, and sgm_wta picks the disparity with the smallest sum. Costs and sums are pixel-major, the
+// DISPARITY_COUNT values of band pixel (x, y) start at (y * w + x) * DISPARITY_COUNT.
+// Window size, the disparity range and SGM_COST_SCALE are build options
+
+#if !defined(WINDOW_Y) || !defined(WINDOW_X) || !defined(MIN_DISPARITY) || !defined(MAX_DISPARITY) || !defined(SGM_COST_SCALE)
+#error "sgm.cl needs WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY and SGM_COST_SCALE build options"
+#endif
+
+#define DISPARITY_COUNT (MAX_DISPARITY - MIN_DISPARITY)
+
+__kernel void sgm_cost(__global const unsigned char* img_left,
+					   __global const unsigned char* img_right,
+					   __global short* cost,
+					   unsigned int width, unsigned int height,
+					   int y0, int rows) {
+	int x = get_global_id(0);
+	int band_y = get_global_id(1);
+	int w = width, h = height;
+	int y = y0 + band_y;
+	if (x >= w || band_y >= rows) return;
+	int window_size = WINDOW_Y * WINDOW_X;
+
+	// Windows only sum the pixels inside both images, and the means are divided by the full window size like in CalcZNCC
+	int win_y0 = max(0, y - WINDOW_Y / 2), win_y1 = min(h, y + WINDOW_Y / 2);
+	for (int i = 0; i < DISPARITY_COUNT; i++) {
+		int d = MIN_DISPARITY + i;
+		int win_x0 = max(max(0, d), x - WINDOW_X / 2), win_x1 = min(min(w, w + d), x + WINDOW_X / 2);
+		float score = -1;
+		if (win_y1 > win_y0 && win_x1 > win_x0) {
+			float lw_mean = 0, rw_mean = 0;
+			for (int win_y = win_y0; win_y < win_y1; win_y++) {
+				for (int win_x = win_x0; win_x < win_x1; win_x++) {
+					lw_mean += img_left[win_y * w + win_x];
+					rw_mean += img_right[win_y * w + win_x - d];
+				}
+			}
+			lw_mean = lw_mean / window_size;
+			rw_mean = rw_mean / window_size;
+			float lower_sum_0 = 0, lower_sum_1 = 0, upper_sum = 0;
+			for (int win_y = win_y0; win_y < win_y1; win_y++) {
+				for (int win_x = win_x0; win_x < win_x1; win_x++) {
+					float lw_mean_diff = img_left[win_y * w + win_x] - lw_mean;
+					float rw_mean_diff = img_right[win_y * w + win_x - d] - rw_mean;
+					lower_sum_0 += lw_mean_diff * lw_mean_diff;
+					lower_sum_1 += rw_mean_diff * rw_mean_diff;
+					upper_sum += lw_mean_diff * rw_mean_diff;
+				}
+			}
+			float zncc_val = upper_sum / (sqrt(lower_sum_0) * sqrt(lower_sum_1));
+			// Flat windows give NaN and get the worst score
+			score = isnan(zncc_val) ? -1 : zncc_val;
+		}
+		// Same conversion as SGMCost
+		float value = (1.0f - score) * (SGM_COST_SCALE / 2) + 0.5f;
+		cost[((size_t)band_y * w + x) * DISPARITY_COUNT + i] = (short)clamp(value, 0.0f, (float)SGM_COST_SCALE);
+	}
+}
+
+int sgm_group_min(__local const int* values, __local int* scratch) {
+	// Minimum of the DISPARITY_COUNT values with a tree reduction. The work-group size must be a power of two
+	int lid = get_local_id(0);
+	int group_size = get_local_size(0);
+	int found = INT_MAX;
+	for (int d = lid; d < DISPARITY_COUNT; d += group_size) found = min(found, values[d]);
+	scratch[lid] = found;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int stride = group_size / 2; stride > 0; stride /= 2) {
+		if (lid < stride) scratch[lid] = min(scratch[lid], scratch[lid + stride]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	found = scratch[0];
+	// scratch is written again by the next call
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return found;
+}
+
+__kernel void sgm_aggregate(__global const short* cost,
+							__global short* sum,
+							__global const short* carry_in,
+							__global short* carry_out,
+							unsigned int width, int rows, int sum_rows,
+							int dx, int dy, int p1, int p2,
+							int first_path, int has_carry,
+							__local int* scratch) {
+	// One work-group walks one scanline of the path, its work-items share the disparities of every pixel
+	__local int costs_a[DISPARITY_COUNT];
+	__local int costs_b[DISPARITY_COUNT];
+	__local int* prev = costs_a;
+	__local int* cur = costs_b;
+	int lid = get_local_id(0);
+	int group_size = get_local_size(0);
+	int line = get_group_id(0);
+	int w = width;
+
+	// Scanlines start on the first row of the band, or its last row when going up, and on the column the path enters the image from.
+	// Paths going down stop at the end of the band, the next band continues them from carry_in
+	int x, y;
+	if (dy == 0) {
+		x = dx > 0 ? 0 : w - 1;
+		y = line;
+	}
+	else if (line < w) {
+		x = line;
+		y = dy > 0 ? 0 : rows - 1;
+	}
+	else {
+		x = dx > 0 ? 0 : w - 1;
+		y = dy > 0 ? line - w + 1 : rows - 2 - (line - w);
+	}
+	int y_end = dy > 0 ? sum_rows : rows;
+
+	// The first pixel starts from zeros, so its aggregated cost is its own cost
+	int prev_x = x - dx;
+	int carried = dy > 0 && y == 0 && has_carry && prev_x >= 0 && prev_x < w;
+	for (int d = lid; d < DISPARITY_COUNT; d += group_size) prev[d] = carried ? carry_in[prev_x * DISPARITY_COUNT + d] : 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	int prev_min = sgm_group_min(prev, scratch);
+
+	// The whole work-group takes the same steps, so every work-item reaches the barriers
+	while (x >= 0 && x < w && y >= 0 && y < y_end) {
+		size_t pixel = ((size_t)y * w + x) * DISPARITY_COUNT;
+		for (int d = lid; d < DISPARITY_COUNT; d += group_size) {
+			int best = min(prev[d], prev_min + p2);
+			if (d > 0) best = min(best, prev[d - 1] + p1);
+			if (d < DISPARITY_COUNT - 1) best = min(best, prev[d + 1] + p1);
+			int value = cost[pixel + d] + best - prev_min;
+			cur[d] = value;
+			if (y < sum_rows) sum[pixel + d] = first_path ? value : sum[pixel + d] + value;
+			if (dy > 0 && y == sum_rows - 1) carry_out[x * DISPARITY_COUNT + d] = value;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		prev_min = sgm_group_min(cur, scratch);
+		__local int* swap = prev;
+		prev = cur;
+		cur = swap;
+		x += dx;
+		y += dy;
+	}
+}
+
+__kernel void sgm_wta(__global const short* sum,
+					  __global unsigned char* dst,
+					  unsigned int width, int y0, int sum_rows) {
+	int x = get_global_id(0);
+	int band_y = get_global_id(1);
+	int w = width;
+	if (x >= w || band_y >= sum_rows) return;
+
+	// Ties go to the smallest disparity like in CalcZNCCSGM
+	__global const short* sums = sum + ((size_t)band_y * w + x) * DISPARITY_COUNT;
+	int best = 0;
+	for (int i = 1; i < DISPARITY_COUNT; i++) best = sums[i] < sums[best] ? i : best;
+	dst[(y0 + band_y) * w + x] = abs(MIN_DISPARITY + best); // Use absolute value of the disparity
+}
@@ -1,55 +1,845 @@
 #include <vector>
 #include <math.h>
 #include <algorithm>
+#include <functional>
 #include "lodepng.h"
 #include "ImageFunctions.h"
 #include "OpenCLFunctions.h"
+#include "KernelRegistry.h"
+#include "WorkGroupTuner.h"
+#include "ZNCCFunctions.h"
+#include "SGMFunctions.h"
+#include "BatchPipeline.h"
+#include "DisparityServer.h"
+#include "Timer.h"
 
 #define KERNEL_RESIZE_GRAYSCALE_FILE_NAME "kernels/resize_grayscale.cl" // Kernel file name
 #define KERNEL_RESIZE_GRAYSCALE "resize_and_grayscale"
 
 #define KERNEL_CALCZNCC_FILE_NAME "kernels/calc_zncc.cl"
 #define KERNEL_CALCZNCC "calc_zncc"
+#define KERNEL_CALCZNCC_TILED_FILE_NAME "kernels/calc_zncc_tiled.cl" // CalcZNCC from local memory tiles
+#define KERNEL_CALCZNCC_TILED "calc_zncc_tiled"
+#define KERNEL_CALCZNCC_BIDIR_FILE_NAME "kernels/calc_zncc_bidir.cl" // Both disparity maps from one pass
+#define KERNEL_CALCZNCC_BIDIR "calc_zncc_bidir"
+#define KERNEL_SGM_FILE_NAME "kernels/sgm.cl" // Semi-global matching, one band of rows at a time
+#define KERNEL_SGM_COST "sgm_cost"
+#define KERNEL_SGM_AGGREGATE "sgm_aggregate"
+#define KERNEL_SGM_WTA "sgm_wta"
 
 #define KERNEL_CROSS_CHECK_FILE_NAME "kernels/cross_check.cl"
 #define KERNEL_CROSS_CHECK "cross_check"
 
-#define KERNEL_OCCLUSION_FILL_FILE_NAME "kernels/occlusion_fill.cl"
-#define KERNEL_OCCLUSION_FILL "occlusion_fill"
+#define KERNEL_JUMP_FLOOD_FILE_NAME "kernels/jump_flood.cl" // Occlusion fill with jump flooding
+#define KERNEL_JFA_INIT "jfa_init"
+#define KERNEL_JFA_STEP "jfa_step"
+#define KERNEL_JFA_RESOLVE "jfa_resolve"
 
 #define KERNEL_NORMALIZE_FILE_NAME "kernels/normalize.cl"
 #define KERNEL_NORMALIZE "normalize_img"
+#define KERNEL_MIN_MAX_FILE_NAME "kernels/min_max.cl" // Minimum and maximum for normalize_img
+#define KERNEL_MIN_MAX "min_max"
+
+#define KERNEL_CROSS_FILL_FILE_NAME "kernels/cross_fill.cl" // CrossCheck, Occlusion Fill and their normalization fused
+#define KERNEL_CROSS_FILL "cross_fill"
+#define KERNEL_NORMALIZE_CROSS_FILL "normalize_cross_fill"
+
+#define KERNEL_CACHE_DIR "kernel_cache" // Built OpenCL programs are cached here. NULL disables the cache
+#define TUNING_DIR "tuning" // Tuned work-group sizes are saved here, one file per device
 
 #define WINDOW_Y 13 
 #define WINDOW_X 11 
 #define MIN_DISPARITY 0
 #define MAX_DISPARITY 65 // Scaled down. 260/4 as stated in the Assignment
 #define THRESHOLD 3
+#define CROSS_CHECK_INVALID 0 // Value of the pixels that fail the cross check. The occlusion fills fill the pixels that are 0
+#define ZNCC_GROUP_X 16 // Work-group size of calc_zncc_tiled when AUTOTUNE_WORK_GROUPS is 0
+#define ZNCC_GROUP_Y 8
+#define ZNCC_BIDIR_GROUP_X 64 // Work-group size of calc_zncc_bidir when AUTOTUNE_WORK_GROUPS is 0. The height is the number of rows per work-group
+#define ZNCC_BIDIR_GROUP_Y 1
+#define FILL_RADIUS 16 // Occlusion fill search radius of cross_fill in local memory
+#define CROSS_FILL_GROUP_X 16 // Work-group size of cross_fill when AUTOTUNE_WORK_GROUPS is 0
+#define CROSS_FILL_GROUP_Y 8
 
-int main() {
-	// Set image dimensions
-	unsigned w = 2940;
-	unsigned h = 2016;
-	unsigned new_w = floor(w / 4);
-	unsigned new_h = floor(h / 4);
-	// Initialize original image vector
-	std::vector<unsigned char> im0, im1;
+#define PYRAMID_MODE 0 // Full resolution disparity maps with the coarse-to-fine search of CalcZNCCPyramid on the CPU, instead of the downscaled pipelines
+#define PYRAMID_MAX_DISPARITY 260 // Maximum disparity at full resolution, as stated in the Assignment
+#define PYRAMID_LEVELS 4 // Pyramid levels including the full resolution one. The coarsest level searches every disparity
+#define PYRAMID_RADIUS 2 // Disparities searched on both sides of the coarser level's estimate
+#define PYRAMID_THRESHOLD 12 // Cross check threshold at full resolution, THRESHOLD scaled up by 4
+#define SEQUENCE_MODE 0 // Process a stereo video frame by frame on the CPU, searching around the previous frame's disparities with CalcZNCCTemporal
+#define SEQUENCE_LEFT "seq/im0_%04d.png" // Left frames, numbered from 0 until the first missing one
+#define SEQUENCE_RIGHT "seq/im1_%04d.png" // Right frames
+#define SEQUENCE_OUTPUT "imgs/seq_fill_%04d.png" // Normalized occlusion fill of every frame
+#define TEMPORAL_RADIUS 2 // Disparities searched on both sides of the previous frame's disparity
+#define TEMPORAL_MIN_CONFIDENCE 0.5f // Pixels whose best ZNCC score around the previous disparity is lower are searched fully
+#define TEMPORAL_MAX_FRAME_DIFF 8 // Pixels whose window changed more than this on average since the previous frame are searched fully
+#define BATCH_MODE 0 // Run every pair directory in BATCH_INPUT_DIR through the CPU pipeline with RunBatch, decoding, computing and encoding different pairs at the same time
+#define BATCH_INPUT_DIR "batch" // Directory of pair directories, each with an im0.png and an im1.png
+#define BATCH_OUTPUT_DIR "batch_out" // The normalized results of every pair are saved to a directory of the same name here
+#define BATCH_DECODE_THREADS 2 // Threads decoding PNGs
+#define BATCH_COMPUTE_WORKERS 2 // Pairs computed at the same time
+#define BATCH_THREADS_PER_WORKER 2 // TileScheduler threads of every compute worker, used by the cross check, occlusion fill and normalization
+#define BATCH_ENCODE_THREADS 2 // Threads encoding PNGs
+#define BATCH_QUEUE_CAPACITY 4 // Pairs waiting between two stages at most. Bounds the memory use of a batch
+#define DAEMON_MODE 0 // Keep the OpenCL device, kernels and buffers of the device resident pipeline and serve stereo pairs with RunServer until told to quit
+#define DAEMON_SOCKET "as7.sock" // Unix domain socket the jobs are sent to. NULL to only use DAEMON_SPOOL_DIR
+#define DAEMON_SPOOL_DIR "spool" // Directory watched for job directories. NULL to only use DAEMON_SOCKET
+#define DAEMON_POLL_MS 100 // How often DAEMON_SPOOL_DIR is checked
+#define DAEMON_OUTPUTS (OUTPUT_ZNCC | OUTPUT_FILL | OUTPUT_FILL_NORM) // Images saved for every job
+#define USE_OPENCL 1 // Set to 0 to run the CPU pipeline from ImageFunctions.cpp instead of the OpenCL kernels
+#define OPENCL_DEVICE_RESIDENT 1 // Keep the OpenCL intermediate results on the device and only read back the images in OPENCL_OUTPUTS
+#define OUTPUT_GRAY 0x01 // Resized and grayscaled im0 and im1
+#define OUTPUT_ZNCC 0x02 // Both disparity maps
+#define OUTPUT_CROSS 0x04
+#define OUTPUT_FILL 0x08
+#define OUTPUT_ZNCC_NORM 0x10
+#define OUTPUT_CROSS_NORM 0x20
+#define OUTPUT_FILL_NORM 0x40
+#define OPENCL_OUTPUTS (OUTPUT_ZNCC_NORM | OUTPUT_CROSS_NORM | OUTPUT_FILL_NORM) // Images the device resident pipeline saves
+#define ZNCC_BACKEND CalcZNCCIntegral // CPU CalcZNCC backend. CalcZNCC, CalcZNCCIntegral, CalcZNCCSliding, CalcZNCCCostVolume or CalcZNCCSimd. Only used when FUSED_PREPROCESSING, ZNCC_BIDIRECTIONAL and SGM_AGGREGATION are 0
+#define FUSED_PREPROCESSING 1 // Resize, grayscale and build the integral images of the CPU pipeline in one pass. CalcZNCC is then done with CalcZNCCIntegralTables, whatever ZNCC_BACKEND is
+#define SUBPIXEL_REFINEMENT 0 // Calculate the left=im0 map of the CPU pipeline with CalcZNCCSubpixel and save the refined map as a 16-bit PNG and a PFM
+#define SUBPIXEL_SCALE 64 // Fixed point scale of the 16-bit sub-pixel PNG, the stored value is the disparity * SUBPIXEL_SCALE
+#define OCCLUSION_FILL_BACKEND OcclusionFillDistance // CPU occlusion fill. OcclusionFill, OcclusionFillDistance or OcclusionFillScanline
+#define ZNCC_TILED 1 // Use calc_zncc_tiled instead of calc_zncc in the OpenCL pipelines
+#define ZNCC_BIDIRECTIONAL 1 // Calculate both disparity maps in one pass, scoring every window pair once. CalcZNCCBidirectional on the CPU, calc_zncc_bidir with OpenCL
+#define SGM_AGGREGATION 0 // Aggregate the ZNCC costs with semi-global matching before picking the disparities. CalcZNCCSGM on the CPU, the sgm.cl kernels in RunOpenCLPipeline
+#define SGM_PATHS 8 // Aggregation paths, 4 or 8
+#define SGM_P1 64 // Penalty of a disparity change of one. A ZNCC score of -1 costs SGM_COST_SCALE
+#define SGM_P2 512 // Penalty of larger disparity changes
+#define FUSED_POST_PROCESSING 1 // Device resident pipeline does CrossCheck and Occlusion Fill with cross_fill, and normalizes both with one more launch
+#define AUTOTUNE_WORK_GROUPS 1 // Time the work-group sizes of the OpenCL kernels on the first run. If 0, every kernel but calc_zncc_tiled uses 1x1
+#define CHECK_OPENCL_ZNCC 0 // Compare calc_zncc_tiled and calc_zncc_bidir against calc_zncc. The results must be identical. Runs the slow 1x1 calc_zncc twice more
+#define CHECK_OPENCL_FILL 0 // Compare the jump flooding fill against the CPU occlusion fill. Runs the whole CPU fill again
+#define FILL_TOLERANCE 0 // Largest disparity difference allowed by the check
+#define FILL_MAX_MISMATCH 0.1 // Percentage of pixels allowed to exceed FILL_TOLERANCE. Jump flooding is not exact, a few pixels can get a slightly further seed
 
-	// Read the images into memory
-	if (ReadImage(im0, "im0.png", w, h)) return 1;
-	if (ReadImage(im1, "im1.png", w, h)) return 1;
+
+/*
+* \brief Runs the whole pipeline on the CPU. CalcZNCC and the occlusion fill are done with the backends selected by ZNCC_BACKEND and OCCLUSION_FILL_BACKEND
+* \param im0 Left RGBA image
+* \param im1 Right RGBA image
+* \return 0 if successful; 1 otherwise
+*/
+int RunCPUPipeline(Image& im0, Image& im1) {
+	occlusion_fill_backend occlusion_fill = OCCLUSION_FILL_BACKEND;
+#if FUSED_PREPROCESSING || SGM_AGGREGATION || (ZNCC_BIDIRECTIONAL && !SUBPIXEL_REFINEMENT)
+	// These flags pick their own matcher, so a changed ZNCC_BACKEND would otherwise be ignored without a word
+	printf("ZNCC_BACKEND is not used, FUSED_PREPROCESSING, ZNCC_BIDIRECTIONAL or SGM_AGGREGATION selects the matcher\n\n");
+#endif
+
+#if FUSED_PREPROCESSING
+	// Resize and grayscale the images, and build the tables for CalcZNCCIntegralTables
+	integral_image im0_table, im1_table;
+	printf("Resizing and grayscaling im0.png\n");
+	Image im0_gray = ResizeGrayScaleImage(im0, &im0_table);
+	printf("Resizing and grayscaling im1.png\n");
+	Image im1_gray = ResizeGrayScaleImage(im1, &im1_table);
+	printf("\n");
+
+	// Free the original images
+	FreeImage(im0);
+	FreeImage(im1);
+#else
+	// Resize the images
+	printf("Resizing im0.png\n");
+	Image im0_resized = ResizeImage(im0);
+	printf("Resizing im1.png\n");
+	Image im1_resized = ResizeImage(im1);
+	printf("\n");
+
+	// Grayscale the images
+	printf("Grayscaling im0.png\n");
+	Image im0_gray = GrayScaleImage(im0_resized);
+	printf("Grayscaling im1.png\n");
+	Image im1_gray = GrayScaleImage(im1_resized);
+	printf("\n");
+
+	// Free the resized and original images
+	FreeImage(im0);
+	FreeImage(im1);
+	FreeImage(im0_resized);
+	FreeImage(im1_resized);
+#endif
+
+	// Calculate ZNCC
+#if SGM_AGGREGATION
+	printf("Calculating ZNCC with SGM aggregation, left=im0, right=im1\n");
+	Image im0_zncc = CalcZNCCSGM(im0_gray, im1_gray, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY, SGM_PATHS, SGM_P1, SGM_P2);
+	printf("Calculating ZNCC with SGM aggregation, left=im1, right=im0\n");
+	Image im1_zncc = CalcZNCCSGM(im1_gray, im0_gray, WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY, SGM_PATHS, SGM_P1, SGM_P2);
+#elif SUBPIXEL_REFINEMENT
+	// Scores are kept in a cost volume, so the winner-take-all pass can refine the left=im0 map on the way
+	printf("Calculating ZNCC with sub-pixel refinement, left=im0, right=im1\n");
+	ImageF im0_subpixel;
+	Image im0_zncc = CalcZNCCSubpixel(im0_gray, im1_gray, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY, &im0_subpixel);
+	WriteImage16(FixedPointImage(im0_subpixel, SUBPIXEL_SCALE), "imgs/im0_zncc_subpixel.png");
+	WritePFM(im0_subpixel, "imgs/im0_zncc_subpixel.pfm");
+	im0_subpixel.Free();
+	printf("Calculating ZNCC, left=im1, right=im0\n");
+#if FUSED_PREPROCESSING
+	Image im1_zncc = CalcZNCCIntegralTables(im1_gray, im0_gray, im1_table, im0_table, WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY);
+#else
+	zncc_backend calc_zncc = ZNCC_BACKEND;
+	Image im1_zncc = calc_zncc(im1_gray, im0_gray, WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY);
+#endif
+#elif ZNCC_BIDIRECTIONAL
+	printf("Calculating ZNCC, left=im0 and left=im1 in one pass\n");
+#if !FUSED_PREPROCESSING
+	integral_image im0_table, im1_table;
+	BuildIntegralImage(im0_gray, &im0_table);
+	BuildIntegralImage(im1_gray, &im1_table);
+#endif
+	Image im1_zncc;
+	Image im0_zncc = CalcZNCCBidirectional(im0_gray, im1_gray, im0_table, im1_table, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY, &im1_zncc);
+#else
+	printf("Calculating ZNCC, left=im0, right=im1\n");
+#if FUSED_PREPROCESSING
+	Image im0_zncc = CalcZNCCIntegralTables(im0_gray, im1_gray, im0_table, im1_table, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY);
+#else
+	zncc_backend calc_zncc = ZNCC_BACKEND;
+	Image im0_zncc = calc_zncc(im0_gray, im1_gray, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY);
+#endif
+	printf("Calculating ZNCC, left=im1, right=im0\n");
+#if FUSED_PREPROCESSING
+	Image im1_zncc = CalcZNCCIntegralTables(im1_gray, im0_gray, im1_table, im0_table, WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY);
+#else
+	Image im1_zncc = calc_zncc(im1_gray, im0_gray, WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY);
+#endif
+#endif
+	printf("\n");
+
+	// Cross Check
+	printf("Performing the cross check\n");
+	Image cross = CrossCheck(im0_zncc, im1_zncc, THRESHOLD, CROSS_CHECK_INVALID);
+	printf("\n");
+
+	// Occlusion Fill
+	printf("Performing the occlusion fill\n");
+	Image fill = occlusion_fill(cross);
+	if (fill.Empty()) return 1;
 	printf("\n");
 
+	// Image Normalization
+	printf("Normalizing the images\n");
+	im0_zncc = NormalizeImage(im0_zncc);
+	im1_zncc = NormalizeImage(im1_zncc);
+	cross = NormalizeImage(cross);
+	fill = NormalizeImage(fill);
+	printf("\n");
+
+	// Save results
+	WriteImage(im0_zncc, "imgs/im0_zncc_norm.png", LCT_GREY, 8);
+	WriteImage(im1_zncc, "imgs/im1_zncc_norm.png", LCT_GREY, 8);
+	WriteImage(cross, "imgs/cross_check_norm.png", LCT_GREY, 8);
+	WriteImage(fill, "imgs/occlusion_fill_norm.png", LCT_GREY, 8);
+	return 0;
+}
+
+/*
+* \brief Calculates full resolution disparity maps with CalcZNCCPyramid and cross checks them. The maps are 16-bit, since
+* disparities go up to PYRAMID_MAX_DISPARITY. They are saved as 16-bit PNGs and normalized to 8 bits
+* \param im0 Left RGBA image
+* \param im1 Right RGBA image
+* \return 0 if successful; 1 otherwise
+*/
+int RunPyramidPipeline(Image& im0, Image& im1) {
+	// Grayscale the images, keeping the full resolution
+	printf("Grayscaling im0.png\n");
+	Image im0_gray = GrayScaleImage(im0);
+	printf("Grayscaling im1.png\n");
+	Image im1_gray = GrayScaleImage(im1);
+	printf("\n");
+
+	// Free the original images
+	FreeImage(im0);
+	FreeImage(im1);
+
+	// Calculate ZNCC
+	printf("Calculating ZNCC with a disparity pyramid, left=im0, right=im1\n");
+	Image16 im0_zncc = CalcZNCCPyramid(im0_gray, im1_gray, WINDOW_Y, WINDOW_X, MIN_DISPARITY, PYRAMID_MAX_DISPARITY, PYRAMID_LEVELS, PYRAMID_RADIUS);
+	printf("Calculating ZNCC with a disparity pyramid, left=im1, right=im0\n");
+	Image16 im1_zncc = CalcZNCCPyramid(im1_gray, im0_gray, WINDOW_Y, WINDOW_X, -PYRAMID_MAX_DISPARITY, MIN_DISPARITY, PYRAMID_LEVELS, PYRAMID_RADIUS);
+	printf("\n");
+
+	// Cross Check
+	printf("Performing the cross check\n");
+	Image16 cross = CrossCheck16(im0_zncc, im1_zncc, PYRAMID_THRESHOLD, CROSS_CHECK_INVALID);
+	printf("\n");
 
-	// Initialize kernel sources
-	kernel_source resize_grayscale_src, calc_zncc_src, cross_check_src, occlusion_fill_src, normalize_src;
-	// Load Kernel sources into memory
-	printf("Loadng Kernel sources from .cl files\n");
-	if(!loadKernel(KERNEL_RESIZE_GRAYSCALE_FILE_NAME, &resize_grayscale_src));
-	if(!loadKernel(KERNEL_CALCZNCC_FILE_NAME, &calc_zncc_src));
-	if(!loadKernel(KERNEL_CROSS_CHECK_FILE_NAME, &cross_check_src));
-	if(!loadKernel(KERNEL_OCCLUSION_FILL_FILE_NAME, &occlusion_fill_src));
-	if(!loadKernel(KERNEL_NORMALIZE_FILE_NAME, &normalize_src));
+	// Save results
+	if (WriteImage16(im0_zncc, "imgs/im0_zncc_full.png")) return 1;
+	if (WriteImage16(im1_zncc, "imgs/im1_zncc_full.png")) return 1;
+	if (WriteImage16(cross, "imgs/cross_check_full.png")) return 1;
+	printf("Normalizing the images\n");
+	WriteImage(NormalizeImage16(im0_zncc), "imgs/im0_zncc_full_norm.png", LCT_GREY, 8);
+	WriteImage(NormalizeImage16(im1_zncc), "imgs/im1_zncc_full_norm.png", LCT_GREY, 8);
+	WriteImage(NormalizeImage16(cross), "imgs/cross_check_full_norm.png", LCT_GREY, 8);
+	return 0;
+}
+
+/*
+* \brief Runs the CPU pipeline on every frame of a stereo video, SEQUENCE_LEFT and SEQUENCE_RIGHT. After the first frame the
+* disparities are searched with CalcZNCCTemporal around the ones of the previous frame. Only the normalized occlusion fill is saved
+* \return 0 if successful; 1 otherwise
+*/
+int RunSequencePipeline() {
+	occlusion_fill_backend occlusion_fill = OCCLUSION_FILL_BACKEND;
+	// Grayscaled images and disparity maps of the previous frame, left=im0 first
+	Image prev_gray[2], prev_zncc[2];
+	long long total_microseconds = 0, narrow = 0, full = 0;
+	char left_name[256], right_name[256], out_name[256];
+	int frame = 0;
+
+	for (;; frame++) {
+		snprintf(left_name, sizeof(left_name), SEQUENCE_LEFT, frame);
+		snprintf(right_name, sizeof(right_name), SEQUENCE_RIGHT, frame);
+		snprintf(out_name, sizeof(out_name), SEQUENCE_OUTPUT, frame);
+		// ReadImage waits for a key when a file is missing, so the end of the sequence is found with fopen
+		FILE* fp = fopen(left_name, "rb");
+		if (fp == NULL) break;
+		fclose(fp);
+		Image im0, im1;
+		if (ReadImage(im0, left_name)) return 1;
+		if (ReadImage(im1, right_name)) return 1;
+
+		timer_struct timer;
+		StartTimer(&timer);
+		integral_image im0_table, im1_table;
+		Image im0_gray = ResizeGrayScaleImage(im0, &im0_table);
+		Image im1_gray = ResizeGrayScaleImage(im1, &im1_table);
+		FreeImage(im0);
+		FreeImage(im1);
+
+		temporal_stats stats[2];
+		Image im0_zncc = CalcZNCCTemporal(im0_gray, im1_gray, im0_table, im1_table, prev_gray[0], prev_zncc[0], WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY,
+			TEMPORAL_RADIUS, TEMPORAL_MIN_CONFIDENCE, TEMPORAL_MAX_FRAME_DIFF, &stats[0]);
+		Image im1_zncc = CalcZNCCTemporal(im1_gray, im0_gray, im1_table, im0_table, prev_gray[1], prev_zncc[1], WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY,
+			TEMPORAL_RADIUS, TEMPORAL_MIN_CONFIDENCE, TEMPORAL_MAX_FRAME_DIFF, &stats[1]);
+		Image cross = CrossCheck(im0_zncc, im1_zncc, THRESHOLD, CROSS_CHECK_INVALID);
+		Image fill = occlusion_fill(cross);
+		if (fill.Empty()) return 1;
+		fill = NormalizeImage(fill);
+		StopTimer(&timer, "Frame processed");
+		total_microseconds += timer.elapsed.QuadPart;
+		for (int i = 0; i < 2; i++) {
+			narrow += stats[i].narrow;
+			full += stats[i].full;
+		}
+		WriteImage(fill, out_name, LCT_GREY, 8);
+		printf("\n");
+
+		// The next frame searches around the disparities of this one
+		prev_gray[0] = std::move(im0_gray);
+		prev_gray[1] = std::move(im1_gray);
+		prev_zncc[0] = std::move(im0_zncc);
+		prev_zncc[1] = std::move(im1_zncc);
+	}
+
+	if (frame == 0) {
+		printf("No frames found, %s is missing\n", left_name);
+		return 1;
+	}
+	printf("Processed %d frames, %f frames per second without reading and writing the images\n", frame, frame / (total_microseconds / 1e6));
+	printf("%f%% of the pixels were only searched around the previous disparity\n", 100.0 * narrow / (narrow + full));
+	return 0;
+}
+
+/*
+* \brief Compute stage of the batch mode. Same as RunCPUPipeline with FUSED_PREPROCESSING and ZNCC_BIDIRECTIONAL, and the
+* four normalized images are handed to the encode stage instead of being saved
+* \param pair Pair to compute
+* \return 0 if successful; 1 otherwise
+*/
+int ComputeBatchPair(batch_pair& pair) {
+	occlusion_fill_backend occlusion_fill = OCCLUSION_FILL_BACKEND;
+	integral_image im0_table, im1_table;
+	Image im0_gray = ResizeGrayScaleImage(pair.im0, &im0_table);
+	Image im1_gray = ResizeGrayScaleImage(pair.im1, &im1_table);
+	Image im1_zncc;
+	Image im0_zncc = CalcZNCCBidirectional(im0_gray, im1_gray, im0_table, im1_table, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY, &im1_zncc);
+	Image cross = CrossCheck(im0_zncc, im1_zncc, THRESHOLD, CROSS_CHECK_INVALID);
+	Image fill = occlusion_fill(cross);
+	if (fill.Empty()) return 1;
+	pair.outputs.push_back(std::make_pair(std::string("im0_zncc_norm.png"), NormalizeImage(im0_zncc)));
+	pair.outputs.push_back(std::make_pair(std::string("im1_zncc_norm.png"), NormalizeImage(im1_zncc)));
+	pair.outputs.push_back(std::make_pair(std::string("cross_check_norm.png"), NormalizeImage(cross)));
+	pair.outputs.push_back(std::make_pair(std::string("occlusion_fill_norm.png"), NormalizeImage(fill)));
+	return 0;
+}
+
+/*
+* \brief Enqueues the whole jump flooding occlusion fill without waiting for it. Every kernel waits for the previous one,
+* so this also works on an out of order command queue
+* \param cmd_q OpenCL command queue
+* \param jfa_init Kernel that turns non-zero pixels into seeds
+* \param jfa_step Kernel for a single jump flooding step
+* \param jfa_resolve Kernel that copies the values of the nearest seeds
+* \param cross_cl Cross checked disparity map
+* \param seeds_cl Two w * h int buffers the steps ping-pong between
+* \param fill_cl The result is written here
+* \param w Image width
+* \param h Image height
+* \param global_size Global work size
+* \param local_size Local work size
+* \param wait_event Event that must be finished before the fill starts, for example the cross check. Can be NULL
+* \param first_event If not NULL, the event of jfa_init is stored here for timing the whole fill. The caller releases it.
+* Left unchanged if failed
+* \return Event of the last kernel, NULL if failed
+*/
+cl_event enqueueJumpFlood(cl_command_queue cmd_q, cl_kernel jfa_init, cl_kernel jfa_step, cl_kernel jfa_resolve, cl_mem cross_cl, cl_mem seeds_cl[2], cl_mem fill_cl,
+	unsigned w, unsigned h, size_t global_size[], size_t local_size[], cl_event wait_event, cl_event* first_event) {
+	/* Sources:
+	* "Jump Flooding in GPU with Applications to Voronoi Diagram and Distance Transform" - https://www.comp.nus.edu.sg/~tants/jfa/i3d06.pdf
+	*/
+	// Non-zero pixels become the seeds
+	int err_num = clSetKernelArg(jfa_init, 0, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(jfa_init, 1, sizeof(cl_mem), &seeds_cl[0]);
+	err_num |= clSetKernelArg(jfa_init, 2, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(jfa_init, 3, sizeof(unsigned int), &h);
+	if (!errorCheck(err_num)) return NULL;
+	cl_event event = enqueueKernel(cmd_q, jfa_init, global_size, local_size, wait_event != NULL ? 1 : 0, wait_event != NULL ? &wait_event : NULL);
+	if (event == NULL) return NULL;
+	cl_event init_event = event;
+	clRetainEvent(init_event);
+	// Steps go from the largest power of two below the image size down to 1. One extra step of 1 fixes most of the pixels plain jump flooding gets wrong
+	int largest_step = 1;
+	while (largest_step * 2 < (int)std::max(w, h)) largest_step *= 2;
+	int current = 0;
+	for (int step = largest_step; step >= 1; step /= 2) {
+		for (int repeat = 0; repeat < (step == 1 ? 2 : 1); repeat++) {
+			err_num = clSetKernelArg(jfa_step, 0, sizeof(cl_mem), &seeds_cl[current]);
+			err_num |= clSetKernelArg(jfa_step, 1, sizeof(cl_mem), &seeds_cl[1 - current]);
+			err_num |= clSetKernelArg(jfa_step, 2, sizeof(unsigned int), &w);
+			err_num |= clSetKernelArg(jfa_step, 3, sizeof(unsigned int), &h);
+			err_num |= clSetKernelArg(jfa_step, 4, sizeof(int), &step);
+			if (!errorCheck(err_num)) {
+				clReleaseEvent(event);
+				clReleaseEvent(init_event);
+				return NULL;
+			}
+			cl_event step_event = enqueueKernel(cmd_q, jfa_step, global_size, local_size, 1, &event);
+			clReleaseEvent(event);
+			if (step_event == NULL) {
+				clReleaseEvent(init_event);
+				return NULL;
+			}
+			event = step_event;
+			current = 1 - current;
+		}
+	}
+	// Copy the values of the nearest seeds
+	err_num = clSetKernelArg(jfa_resolve, 0, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(jfa_resolve, 1, sizeof(cl_mem), &seeds_cl[current]);
+	err_num |= clSetKernelArg(jfa_resolve, 2, sizeof(cl_mem), &fill_cl);
+	err_num |= clSetKernelArg(jfa_resolve, 3, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(jfa_resolve, 4, sizeof(unsigned int), &h);
+	if (!errorCheck(err_num)) {
+		clReleaseEvent(event);
+		clReleaseEvent(init_event);
+		return NULL;
+	}
+	cl_event resolve_event = enqueueKernel(cmd_q, jfa_resolve, global_size, local_size, 1, &event);
+	clReleaseEvent(event);
+	if (resolve_event != NULL && first_event != NULL) *first_event = init_event;
+	else clReleaseEvent(init_event);
+	return resolve_event;
+}
+
+/*
+* \brief Stores the tuned work-group size of the jump flooding kernels in local_size. Only jfa_step is timed, since it is run most,
+* and enqueueJumpFlood uses the same size for all three kernels. Unchanged if AUTOTUNE_WORK_GROUPS is 0
+* \param tuner Work-group size tuner of the device
+* \param cmd_q OpenCL command queue with nothing else running
+* \param jfa_init Kernel that turns non-zero pixels into seeds
+* \param jfa_step Kernel for a single jump flooding step
+* \param cross_cl Cross checked disparity map the seeds are made from
+* \param seeds_cl Two w * h int buffers, overwritten while tuning
+* \param w Image width
+* \param h Image height
+* \param global_size Global work size
+* \param local_size Local work size
+* \return 0 if successful; 1 otherwise
+*/
+int tuneJumpFlood(WorkGroupTuner& tuner, cl_command_queue cmd_q, cl_kernel jfa_init, cl_kernel jfa_step, cl_mem cross_cl, cl_mem seeds_cl[2],
+	unsigned w, unsigned h, size_t global_size[], size_t local_size[]) {
+#if AUTOTUNE_WORK_GROUPS
+	// The step is timed on real seeds
+	int err_num = clSetKernelArg(jfa_init, 0, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(jfa_init, 1, sizeof(cl_mem), &seeds_cl[0]);
+	err_num |= clSetKernelArg(jfa_init, 2, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(jfa_init, 3, sizeof(unsigned int), &h);
+	if (!errorCheck(err_num)) return 1;
+	cl_event event = enqueueKernel(cmd_q, jfa_init, global_size, local_size, 0, NULL);
+	if (event == NULL) return 1;
+	clWaitForEvents(1, &event);
+	clReleaseEvent(event);
+	int step = 1;
+	err_num = clSetKernelArg(jfa_step, 0, sizeof(cl_mem), &seeds_cl[0]);
+	err_num |= clSetKernelArg(jfa_step, 1, sizeof(cl_mem), &seeds_cl[1]);
+	err_num |= clSetKernelArg(jfa_step, 2, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(jfa_step, 3, sizeof(unsigned int), &h);
+	err_num |= clSetKernelArg(jfa_step, 4, sizeof(int), &step);
+	if (!errorCheck(err_num)) return 1;
+	tuner.LocalSize(cmd_q, jfa_step, KERNEL_JFA_STEP, global_size, local_size);
+#endif
+	return 0;
+}
+
+/*
+* \brief Returns calc_zncc or calc_zncc_tiled built for the given window and disparity range. Every combination is built once
+* \param registry Kernel registry of the context
+* \param tiled 1 for calc_zncc_tiled, 0 for calc_zncc
+* \param window_y Size of window's y axis
+* \param window_x Size of window's x axis
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The kernel or NULL if failed to build
+*/
+cl_kernel getZNCCKernel(KernelRegistry& registry, int tiled, int window_y, int window_x, int min_disparity, int max_disparity) {
+	std::string options = znccBuildOptions(window_y, window_x, min_disparity, max_disparity);
+	if (tiled) return registry.GetKernel(KERNEL_CALCZNCC_TILED_FILE_NAME, KERNEL_CALCZNCC_TILED, options.c_str());
+	return registry.GetKernel(KERNEL_CALCZNCC_FILE_NAME, KERNEL_CALCZNCC, options.c_str());
+}
+
+/*
+* \brief Stores the tuned work-group size of a kernel whose arguments are set in local_size. Unchanged if AUTOTUNE_WORK_GROUPS is 0
+* \param tuner Work-group size tuner of the device
+* \param cmd_q OpenCL command queue with nothing else running
+* \param kernel The kernel
+* \param key Name of the kernel in the tuning file
+* \param global_size Global work size the kernel is run with. Every tried size divides it
+* \param local_size Local work size
+* \return Nothing
+*/
+void tuneLocalSize(WorkGroupTuner& tuner, cl_command_queue cmd_q, cl_kernel kernel, const char* key, const size_t global_size[], size_t local_size[]) {
+#if AUTOTUNE_WORK_GROUPS
+	tuner.LocalSize(cmd_q, kernel, key, global_size, local_size);
+#endif
+}
+
+/*
+* \brief Sets the arguments of calc_zncc or calc_zncc_tiled and stores its tuned work-group size in local_size. Unchanged if AUTOTUNE_WORK_GROUPS is 0.
+* The tiled kernel skips work-items outside the image, so its sizes do not have to divide the image size
+* \param tuner Work-group size tuner of the device
+* \param cmd_q OpenCL command queue with nothing else running
+* \param kernel calc_zncc or calc_zncc_tiled kernel from getZNCCKernel
+* \param tiled 1 if kernel is calc_zncc_tiled
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_cl Disparity map buffer, overwritten while tuning
+* \param w Image width
+* \param h Image height
+* \param min_disparity Minimum disparity value the kernel was built with
+* \param max_disparity Maximum disparity value the kernel was built with
+* \param local_size Local work size
+* \return 0 if successful; 1 otherwise
+*/
+int tuneZNCCKernel(WorkGroupTuner& tuner, cl_command_queue cmd_q, cl_kernel kernel, int tiled, cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl,
+	unsigned w, unsigned h, int min_disparity, int max_disparity, size_t local_size[]) {
+#if AUTOTUNE_WORK_GROUPS
+	size_t global_size[] = { w, h };
+	// The build options are part of the key, as the window and the disparity range change the best size
+	std::string key = std::string(tiled ? KERNEL_CALCZNCC_TILED : KERNEL_CALCZNCC) + znccBuildOptions(WINDOW_Y, WINDOW_X, min_disparity, max_disparity);
+	if (tiled) {
+		// The local memory arguments and the rounded up global size depend on the tried size
+		tuner_launch launch = [&](const size_t local[2], cl_event* event) {
+			size_t rounded[2];
+			cl_int err = setTiledZNCCArgs(kernel, left_cl, right_cl, dst_cl, w, h, WINDOW_Y, WINDOW_X, min_disparity, max_disparity, local, rounded);
+			if (err != CL_SUCCESS) return err;
+			return clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, rounded, local, 0, NULL, event);
+		};
+		tuner.LocalSize(kernel, key, global_size, false, launch, local_size);
+		return 0;
+	}
+	int err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &left_cl);
+	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &right_cl);
+	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &dst_cl);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &w);
+	err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &h);
+	if (!errorCheck(err_num)) return 1;
+	tuner.LocalSize(cmd_q, kernel, key, global_size, local_size);
+#endif
+	return 0;
+}
+
+/*
+* \brief Stores the tuned work-group size of calc_zncc_bidir in local_size. Unchanged if AUTOTUNE_WORK_GROUPS is 0.
+* Sizes whose local memory does not fit are skipped by the tuner
+* \param tuner Work-group size tuner of the device
+* \param cmd_q OpenCL command queue with nothing else running
+* \param kernel calc_zncc_bidir kernel
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_left_cl Disparity map buffer with left_cl as the left image, overwritten while tuning
+* \param dst_right_cl Disparity map buffer with right_cl as the left image, overwritten while tuning
+* \param w Image width
+* \param h Image height
+* \param local_size Local work size
+* \return Nothing
+*/
+void tuneBidirectionalZNCC(WorkGroupTuner& tuner, cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem dst_left_cl, cl_mem dst_right_cl,
+	unsigned w, unsigned h, size_t local_size[]) {
+#if AUTOTUNE_WORK_GROUPS
+	size_t global_size[] = { w, h };
+	std::string key = std::string(KERNEL_CALCZNCC_BIDIR) + znccBuildOptions(WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY);
+	// The local memory arguments and the global size depend on the tried size
+	tuner_launch launch = [&](const size_t local[2], cl_event* event) {
+		size_t global[2];
+		cl_int err = setBidirectionalZNCCArgs(kernel, left_cl, right_cl, dst_left_cl, dst_right_cl, w, h, local, global);
+		if (err != CL_SUCCESS) return err;
+		return clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, global, local, 0, NULL, event);
+	};
+	tuner.LocalSize(kernel, key, global_size, false, launch, local_size);
+#endif
+}
+
+/*
+* \brief Sets the arguments of cross_fill and stores its tuned work-group size in local_size. Unchanged if AUTOTUNE_WORK_GROUPS is 0.
+* cross_fill skips work-items outside the image, so the sizes do not have to divide the image size
+* \param tuner Work-group size tuner of the device
+* \param cmd_q OpenCL command queue with nothing else running
+* \param kernel cross_fill kernel
+* \param left_cl Disparity map with im0 as the left image
+* \param right_cl Disparity map with im1 as the left image
+* \param cross_cl Cross check buffer, overwritten while tuning
+* \param fill_cl Occlusion fill buffer, overwritten while tuning
+* \param range_cl Range buffer of four unsigned ints, overwritten while tuning
+* \param w Image width
+* \param h Image height
+* \param threshold Largest difference the cross check allows
+* \param radius Search radius of the occlusion fill in local memory
+* \param local_size Local work size
+* \return Nothing
+*/
+void tuneCrossFill(WorkGroupTuner& tuner, cl_command_queue cmd_q, cl_kernel kernel, cl_mem left_cl, cl_mem right_cl, cl_mem cross_cl, cl_mem fill_cl, cl_mem range_cl,
+	unsigned w, unsigned h, int threshold, int radius, size_t local_size[]) {
+#if AUTOTUNE_WORK_GROUPS
+	size_t global_size[] = { w, h };
+	// The local memory argument and the rounded up global size depend on the tried size
+	tuner_launch launch = [&](const size_t local[2], cl_event* event) {
+		size_t rounded[2];
+		cl_int err = setCrossFillArgs(kernel, left_cl, right_cl, cross_cl, fill_cl, range_cl, w, h, threshold, radius, local, rounded);
+		if (err != CL_SUCCESS) return err;
+		return clEnqueueNDRangeKernel(cmd_q, kernel, 2, NULL, rounded, local, 0, NULL, event);
+	};
+	// The radius sets the size of the tile in local memory, so every radius is tuned on its own
+	std::string key = std::string(KERNEL_CROSS_FILL) + " -D FILL_RADIUS=" + std::to_string(radius);
+	tuner.LocalSize(kernel, key, global_size, false, launch, local_size);
+#endif
+}
+
+/*
+* \brief Runs calc_zncc or calc_zncc_tiled and reads the result. The result buffer is cleared first, since neither kernel writes the borders
+* \param cmd_q OpenCL command queue
+* \param kernel calc_zncc or calc_zncc_tiled kernel from getZNCCKernel
+* \param tiled 1 if kernel is calc_zncc_tiled
+* \param local_size Local work size. The work-group size of calc_zncc_tiled
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_cl Disparity map buffer
+* \param w Image width
+* \param h Image height
+* \param min_disparity Minimum disparity value the kernel was built with
+* \param max_disparity Maximum disparity value the kernel was built with
+* \return The disparity map, empty if failed
+*/
+Image executeZNCCKernel(cl_command_queue cmd_q, cl_kernel kernel, int tiled, const size_t local_size[], cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl, unsigned w, unsigned h, int min_disparity, int max_disparity) {
+	Image out;
+	unsigned char zero = 0;
+	cl_event clear_event, zncc_event;
+	int err_num = clEnqueueFillBuffer(cmd_q, dst_cl, &zero, sizeof(unsigned char), 0, w * h * sizeof(unsigned char), 0, NULL, &clear_event);
+	if (!errorCheck(err_num)) return out;
+	if (tiled) {
+		zncc_event = enqueueTiledZNCC(cmd_q, kernel, left_cl, right_cl, dst_cl, w, h, WINDOW_Y, WINDOW_X, min_disparity, max_disparity, local_size, 1, &clear_event);
+	}
+	else {
+		size_t global_size[] = { w, h };
+		err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &left_cl);
+		err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &right_cl);
+		err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &dst_cl);
+		err_num |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &w);
+		err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &h);
+		if (!errorCheck(err_num)) return out;
+		zncc_event = enqueueKernel(cmd_q, kernel, global_size, local_size, 1, &clear_event);
+	}
+	clReleaseEvent(clear_event);
+	if (zncc_event == NULL) return out;
+	cl_event read_event = readBufferAsync(cmd_q, dst_cl, w, h, out, 1, &zncc_event);
+	if (read_event == NULL) return Image();
+	clWaitForEvents(1, &read_event);
+	printf("Kernel execution done, took %f milliseconds\n", eventMilliseconds(zncc_event));
+	clReleaseEvent(zncc_event);
+	clReleaseEvent(read_event);
+	return out;
+}
+
+/*
+* \brief Runs calc_zncc_bidir and reads both results. The result buffers are cleared first, since the kernel does not write the borders
+* \param cmd_q OpenCL command queue
+* \param kernel calc_zncc_bidir kernel
+* \param local_size Local work size
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_left_cl Disparity map buffer with left_cl as the left image
+* \param dst_right_cl Disparity map buffer with right_cl as the left image
+* \param w Image width
+* \param h Image height
+* \param dst_left Disparity map with left_cl as the left image is stored here
+* \param dst_right Disparity map with right_cl as the left image is stored here
+* \return 0 if successful; 1 otherwise
+*/
+int executeBidirectionalZNCC(cl_command_queue cmd_q, cl_kernel kernel, const size_t local_size[], cl_mem left_cl, cl_mem right_cl, cl_mem dst_left_cl, cl_mem dst_right_cl,
+	unsigned w, unsigned h, Image& dst_left, Image& dst_right) {
+	unsigned char zero = 0;
+	cl_event clear_events[2];
+	int err_num = clEnqueueFillBuffer(cmd_q, dst_left_cl, &zero, sizeof(unsigned char), 0, w * h * sizeof(unsigned char), 0, NULL, &clear_events[0]);
+	err_num |= clEnqueueFillBuffer(cmd_q, dst_right_cl, &zero, sizeof(unsigned char), 0, w * h * sizeof(unsigned char), 0, NULL, &clear_events[1]);
+	if (!errorCheck(err_num)) return 1;
+	cl_event zncc_event = enqueueBidirectionalZNCC(cmd_q, kernel, left_cl, right_cl, dst_left_cl, dst_right_cl, w, h, local_size, 2, clear_events);
+	clReleaseEvent(clear_events[0]);
+	clReleaseEvent(clear_events[1]);
+	if (zncc_event == NULL) return 1;
+	cl_event read_events[2];
+	read_events[0] = readBufferAsync(cmd_q, dst_left_cl, w, h, dst_left, 1, &zncc_event);
+	read_events[1] = readBufferAsync(cmd_q, dst_right_cl, w, h, dst_right, 1, &zncc_event);
+	if (read_events[0] == NULL || read_events[1] == NULL) return 1;
+	clWaitForEvents(2, read_events);
+	printf("Kernel execution done, took %f milliseconds\n", eventMilliseconds(zncc_event));
+	clReleaseEvent(zncc_event);
+	clReleaseEvent(read_events[0]);
+	clReleaseEvent(read_events[1]);
+	return 0;
+}
+
+/*
+* \brief Calculates a disparity map with the sgm.cl kernels and reads it. Rows are done in bands of SGM_BAND_HEIGHT like in CalcZNCCSGM,
+* so the cost and path sum buffers do not depend on the image height. Every kernel waits for the previous one
+* \param context OpenCL context
+* \param cmd_q OpenCL command queue
+* \param registry Kernel registry of the context
+* \param left_cl Left grayscale image buffer
+* \param right_cl Right grayscale image buffer
+* \param dst_cl Disparity map buffer
+* \param w Image width
+* \param h Image height
+* \param min_disparity Minimum disparity value
+* \param max_disparity Maximum disparity value
+* \return The disparity map, empty if failed
+*/
+Image executeSGM(cl_context context, cl_command_queue cmd_q, KernelRegistry& registry, cl_mem left_cl, cl_mem right_cl, cl_mem dst_cl,
+	unsigned w, unsigned h, int min_disparity, int max_disparity) {
+	Image out;
+	std::string options = sgmBuildOptions(WINDOW_Y, WINDOW_X, min_disparity, max_disparity, SGM_COST_SCALE);
+	cl_kernel cost_kernel = registry.GetKernel(KERNEL_SGM_FILE_NAME, KERNEL_SGM_COST, options.c_str());
+	cl_kernel aggregate_kernel = registry.GetKernel(KERNEL_SGM_FILE_NAME, KERNEL_SGM_AGGREGATE, options.c_str());
+	cl_kernel wta_kernel = registry.GetKernel(KERNEL_SGM_FILE_NAME, KERNEL_SGM_WTA, options.c_str());
+	if (cost_kernel == NULL || aggregate_kernel == NULL || wta_kernel == NULL) return out;
+	int count = max_disparity - min_disparity;
+	int paths = SGM_PATHS >= SGM_MAX_PATHS ? SGM_MAX_PATHS : 4;
+	int p2 = std::min(SGM_P2, SGM_MAX_P2);
+	int p1 = std::min(SGM_P1, p2);
+	size_t row_size = (size_t)w * count * sizeof(cl_short);
+
+	// Costs of a band and the overlap rows below it, and the path sums of a band.
+	// Paths going down continue from the last row of the previous band. The bands take turns reading and writing the two buffers of a path
+	cl_mem cost_cl = NULL, sum_cl = NULL;
+	cl_mem carry_cl[SGM_MAX_PATHS][2] = {};
+	cl_event event = NULL; // Last enqueued command, every command waits for the one before it
+	// Returns 1 as soon as something fails, what was already enqueued is waited for below
+	auto enqueue_bands = [&]() {
+		int err_num;
+		cost_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, row_size * (SGM_BAND_HEIGHT + SGM_BAND_OVERLAP), NULL, &err_num);
+		if (!errorCheck(err_num)) return 1;
+		sum_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, row_size * SGM_BAND_HEIGHT, NULL, &err_num);
+		if (!errorCheck(err_num)) return 1;
+		for (int p = 0; p < paths; p++) {
+			if (sgm_paths[p].dy <= 0) continue;
+			for (int i = 0; i < 2; i++) {
+				carry_cl[p][i] = clCreateBuffer(context, CL_MEM_READ_WRITE, row_size, NULL, &err_num);
+				if (!errorCheck(err_num)) return 1;
+			}
+		}
+
+		timer_struct timer;
+		StartTimer(&timer);
+		for (int y0 = 0, band = 0; y0 < (int)h; y0 += SGM_BAND_HEIGHT, band++) {
+			int sum_rows = std::min((int)h - y0, SGM_BAND_HEIGHT);
+			int rows = std::min((int)h - y0, SGM_BAND_HEIGHT + SGM_BAND_OVERLAP);
+			// Costs of the band, after the previous band is done with the buffers
+			err_num = clSetKernelArg(cost_kernel, 0, sizeof(cl_mem), &left_cl);
+			err_num |= clSetKernelArg(cost_kernel, 1, sizeof(cl_mem), &right_cl);
+			err_num |= clSetKernelArg(cost_kernel, 2, sizeof(cl_mem), &cost_cl);
+			err_num |= clSetKernelArg(cost_kernel, 3, sizeof(unsigned int), &w);
+			err_num |= clSetKernelArg(cost_kernel, 4, sizeof(unsigned int), &h);
+			err_num |= clSetKernelArg(cost_kernel, 5, sizeof(int), &y0);
+			err_num |= clSetKernelArg(cost_kernel, 6, sizeof(int), &rows);
+			if (!errorCheck(err_num)) return 1;
+			size_t cost_global[] = { w, (size_t)rows };
+			cl_event next = enqueueKernel(cmd_q, cost_kernel, cost_global, NULL, event != NULL ? 1 : 0, event != NULL ? &event : NULL);
+			if (next == NULL) return 1;
+			if (event != NULL) clReleaseEvent(event);
+			event = next;
+
+			// Every path in turn, the first one overwrites the sums of the previous band. Paths not going down never touch the carry buffers
+			for (int p = 0; p < paths; p++) {
+				cl_mem carry_in = carry_cl[p][band % 2] != NULL ? carry_cl[p][band % 2] : cost_cl;
+				cl_mem carry_out = carry_cl[p][1 - band % 2] != NULL ? carry_cl[p][1 - band % 2] : cost_cl;
+				next = enqueueSGMAggregate(cmd_q, aggregate_kernel, cost_cl, sum_cl, carry_in, carry_out, w, rows, sum_rows,
+					sgm_paths[p].dx, sgm_paths[p].dy, p1, p2, count, p == 0, band > 0, 1, &event);
+				if (next == NULL) return 1;
+				clReleaseEvent(event);
+				event = next;
+			}
+
+			// Disparities of the band
+			err_num = clSetKernelArg(wta_kernel, 0, sizeof(cl_mem), &sum_cl);
+			err_num |= clSetKernelArg(wta_kernel, 1, sizeof(cl_mem), &dst_cl);
+			err_num |= clSetKernelArg(wta_kernel, 2, sizeof(unsigned int), &w);
+			err_num |= clSetKernelArg(wta_kernel, 3, sizeof(int), &y0);
+			err_num |= clSetKernelArg(wta_kernel, 4, sizeof(int), &sum_rows);
+			if (!errorCheck(err_num)) return 1;
+			size_t wta_global[] = { w, (size_t)sum_rows };
+			next = enqueueKernel(cmd_q, wta_kernel, wta_global, NULL, 1, &event);
+			if (next == NULL) return 1;
+			clReleaseEvent(event);
+			event = next;
+		}
+		cl_event read_event = readBufferAsync(cmd_q, dst_cl, w, h, out, 1, &event);
+		if (read_event == NULL) return 1;
+		clReleaseEvent(event);
+		event = read_event;
+		clWaitForEvents(1, &event);
+		StopTimer(&timer, "SGM kernels done");
+		return 0;
+	};
+	int err = enqueue_bands();
+
+	// Also after a failure, since the bands already enqueued still use the buffers
+	int err_num = clFinish(cmd_q);
+	if (event != NULL) err_num |= clReleaseEvent(event);
+	if (cost_cl != NULL) err_num |= clReleaseMemObject(cost_cl);
+	if (sum_cl != NULL) err_num |= clReleaseMemObject(sum_cl);
+	for (int p = 0; p < paths; p++) {
+		for (int i = 0; i < 2; i++) {
+			if (carry_cl[p][i] != NULL) err_num |= clReleaseMemObject(carry_cl[p][i]);
+		}
+	}
+	if (!errorCheck(err_num) || err) return Image();
+	return out;
+}
+
+/*
+* \brief Runs the whole pipeline with the OpenCL kernels
+* \param im0 Left RGBA image
+* \param im1 Right RGBA image
+* \return 0 if successful; 1 otherwise
+*/
+int RunOpenCLPipeline(Image& im0, Image& im1) {
+	unsigned w = im0.Width();
+	unsigned h = im0.Height();
+	unsigned new_w = floor(w / 4);
+	unsigned new_h = floor(h / 4);
 
 	// Device selection + context and command queue creation
 	int err_num;
@@ -60,12 +850,16 @@ int main() {
 	printf("Creating command queue\n");
 	cl_command_queue cmd_q = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err_num);
 	if (!errorCheck(err_num)) return 1;
+	// Every program is built once, or loaded from the kernel cache
+	KernelRegistry registry(context, device_id, KERNEL_CACHE_DIR);
+	// Work-group sizes are tuned on the first run and read from the tuning file after that
+	WorkGroupTuner tuner(device_id, TUNING_DIR);
 
 	// 2D image object creation for resize + grayscale
 	printf("Creating 2D RGBA image objects for im0 and im1\n");
-	cl_mem im0_cl = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, &getRGBAImageFormat(), w, h, 0, &im0[0], &err_num);
+	cl_mem im0_cl = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, &getRGBAImageFormat(), w, h, 0, im0.Data(), &err_num);
 	if (!errorCheck(err_num)) return 1;
-	cl_mem im1_cl = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, &getRGBAImageFormat(), w, h, 0, &im1[0], &err_num);
+	cl_mem im1_cl = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, &getRGBAImageFormat(), w, h, 0, im1.Data(), &err_num);
 	if (!errorCheck(err_num)) return 1;
 
 	// 2D image objects for the result of resize + grayscale
@@ -80,19 +874,23 @@ int main() {
 	// Resize & Grayscale im0 and im1
 	// Initialize parameters
 	cl_kernel kernel;
-	std::vector<unsigned char> im0_gray, im1_gray;
+	Image im0_gray, im1_gray;
+	size_t resize_global[] = { new_w, new_h };
+	size_t resize_local[] = { 1, 1 };
 	// Create the resize & grayscale kernel
-	kernel = createKernel(context, device_id, KERNEL_RESIZE_GRAYSCALE, (const char**)&resize_grayscale_src.source_str, (const size_t*)&resize_grayscale_src.source_size);
-	
+	kernel = registry.GetKernel(KERNEL_RESIZE_GRAYSCALE_FILE_NAME, KERNEL_RESIZE_GRAYSCALE);
+	if (kernel == NULL) return 1;
+
 	// Give im0 parameters to the kernel
 	printf("Using Resize & Grayscale kernel on im0\n");
 	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &im0_cl);
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &im0_gray_cl);
 	if (!errorCheck(err_num)) return 1;
+	tuneLocalSize(tuner, cmd_q, kernel, KERNEL_RESIZE_GRAYSCALE, resize_global, resize_local);
 	// Execute the kernel
-	im0_gray = executeImageKernel(cmd_q, kernel, new_w, new_h, im0_gray_cl);
+	im0_gray = executeImageKernel(cmd_q, kernel, new_w, new_h, resize_local, im0_gray_cl);
 	// Save result
-	WriteImage(im0_gray, "imgs/im0_grey.png", new_w, new_h, LCT_GREY, 8);
+	WriteImage(im0_gray, "imgs/im0_grey.png", LCT_GREY, 8);
 	
 	// Give im1 parameters to the kernel
 	printf("Using Resize & Grayscale kernel on im1\n");
@@ -100,38 +898,51 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &im1_gray_cl);
 	if (!errorCheck(err_num)) return 1;
 	// Execute the kernel
-	im1_gray = executeImageKernel(cmd_q, kernel, new_w, new_h, im1_gray_cl);
+	im1_gray = executeImageKernel(cmd_q, kernel, new_w, new_h, resize_local, im1_gray_cl);
 	// Save result
-	WriteImage(im1_gray, "imgs/im1_grey.png", new_w, new_h, LCT_GREY, 8);
+	WriteImage(im1_gray, "imgs/im1_grey.png", LCT_GREY, 8);
 	printf("\n");
 
 	// Free the unnecessary image objects from memory
 	err_num = clReleaseMemObject(im0_cl);
 	err_num |= clReleaseMemObject(im1_cl);
 	if (!errorCheck(err_num)) return 1;
-	FreeImageVector(im0);
-	FreeImageVector(im1);
+	FreeImage(im0);
+	FreeImage(im1);
 
 
 	// CalcZNCC
 	// Initialize related parameters
-	std::vector<unsigned char> dmap0(new_w * new_h);
-	std::vector<unsigned char> dmap1(new_w * new_h);
-	int min_disparity = 0;
-	int max_disparity = 65;
+	Image dmap0, dmap1;
+	int min_disparity = MIN_DISPARITY;
+	int max_disparity = MAX_DISPARITY;
+	// Range of the im1 to im0 direction, the bidirectional kernel derives it itself
+#if SGM_AGGREGATION || !ZNCC_BIDIRECTIONAL || CHECK_OPENCL_ZNCC
 	int neg_max_disparity = max_disparity * -1;
-	int window_x = 11, window_y = 13;
+#endif
 	size_t global_size[] = { new_w, new_h, };
-	size_t local_size[] = { 1, 1 };
 	
-	// Create Kernel
-	kernel = createKernel(context, device_id, KERNEL_CALCZNCC, (const char**)&calc_zncc_src.source_str, (const size_t*)&calc_zncc_src.source_size);
-	if (kernel == NULL) return 1;
+	// Create Kernels. The disparity range is built into the kernels, so both directions have their own variant.
+	// Only the kernels of the selected path are built, calc_zncc is also needed by CHECK_OPENCL_ZNCC
+#if !SGM_AGGREGATION && (CHECK_OPENCL_ZNCC || (!ZNCC_BIDIRECTIONAL && !ZNCC_TILED))
+	cl_kernel zncc0 = getZNCCKernel(registry, 0, WINDOW_Y, WINDOW_X, min_disparity, max_disparity);
+	cl_kernel zncc1 = getZNCCKernel(registry, 0, WINDOW_Y, WINDOW_X, neg_max_disparity, min_disparity);
+	if (zncc0 == NULL || zncc1 == NULL) return 1;
+#endif
+#if !SGM_AGGREGATION && !ZNCC_BIDIRECTIONAL && ZNCC_TILED
+	cl_kernel tiled0 = getZNCCKernel(registry, 1, WINDOW_Y, WINDOW_X, min_disparity, max_disparity);
+	cl_kernel tiled1 = getZNCCKernel(registry, 1, WINDOW_Y, WINDOW_X, neg_max_disparity, min_disparity);
+	if (tiled0 == NULL || tiled1 == NULL) return 1;
+#endif
+#if !SGM_AGGREGATION && ZNCC_BIDIRECTIONAL
+	cl_kernel bidir = registry.GetKernel(KERNEL_CALCZNCC_BIDIR_FILE_NAME, KERNEL_CALCZNCC_BIDIR, znccBuildOptions(WINDOW_Y, WINDOW_X, min_disparity, max_disparity).c_str());
+	if (bidir == NULL) return 1;
+#endif
 
 	// Create memory objects
-	im0_gray_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, new_w * new_h * sizeof(unsigned char), &im0_gray[0], &err_num);
+	im0_gray_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, new_w * new_h * sizeof(unsigned char), im0_gray.Data(), &err_num);
 	if (!errorCheck(err_num)) return 1;
-	im1_gray_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, new_w * new_h * sizeof(unsigned char), &im1_gray[0], &err_num);
+	im1_gray_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, new_w * new_h * sizeof(unsigned char), im1_gray.Data(), &err_num);
 	if (!errorCheck(err_num)) return 1;
 	cl_mem dmap0_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);
 	if (!errorCheck(err_num)) return 1;
@@ -148,39 +959,81 @@ int main() {
 	* https://stackoverflow.com/questions/18217512/do-global-work-size-and-local-work-size-have-any-effect-on-application-logic
 	*/
 	
-	// im0 left + im1 right parameters
-	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &im0_gray_cl);
-	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &im1_gray_cl);
-	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &dmap0_cl);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(int), &min_disparity);
-	err_num |= clSetKernelArg(kernel, 4, sizeof(int), &max_disparity);
+#if SGM_AGGREGATION
+	// The costs are aggregated along SGM_PATHS paths before the disparities are picked
+	printf("Using the SGM kernels, %d paths\n", SGM_PATHS);
+	dmap0 = executeSGM(context, cmd_q, registry, im0_gray_cl, im1_gray_cl, dmap0_cl, new_w, new_h, min_disparity, max_disparity);
+	if (dmap0.Empty()) return 1;
+	WriteImage(dmap0, "imgs/im0_zncc.png", LCT_GREY, 8);
+	dmap1 = executeSGM(context, cmd_q, registry, im1_gray_cl, im0_gray_cl, dmap1_cl, new_w, new_h, neg_max_disparity, min_disparity);
+	if (dmap1.Empty()) return 1;
+#elif ZNCC_BIDIRECTIONAL
+	// Both maps from one launch, every window pair is scored once
+	size_t bidir_local[] = { ZNCC_BIDIR_GROUP_X, ZNCC_BIDIR_GROUP_Y };
+	tuneBidirectionalZNCC(tuner, cmd_q, bidir, im0_gray_cl, im1_gray_cl, dmap0_cl, dmap1_cl, new_w, new_h, bidir_local);
+	printf("Using the bidirectional CalcZNCC kernel, work-groups %dx%d\n", (int)bidir_local[0], (int)bidir_local[1]);
+	if (executeBidirectionalZNCC(cmd_q, bidir, bidir_local, im0_gray_cl, im1_gray_cl, dmap0_cl, dmap1_cl, new_w, new_h, dmap0, dmap1)) return 1;
+	WriteImage(dmap0, "imgs/im0_zncc.png", LCT_GREY, 8);
+#if CHECK_OPENCL_ZNCC
+	// Run calc_zncc into a spare buffer and compare
+	printf("Checking the result against the CalcZNCC kernel\n");
+	cl_mem check_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	size_t check_local[] = { 1, 1 };
+	Image check0 = executeZNCCKernel(cmd_q, zncc0, 0, check_local, im0_gray_cl, im1_gray_cl, check_cl, new_w, new_h, min_disparity, max_disparity);
+	Image check1 = executeZNCCKernel(cmd_q, zncc1, 0, check_local, im1_gray_cl, im0_gray_cl, check_cl, new_w, new_h, neg_max_disparity, min_disparity);
+	if (CompareImages(dmap0, check0, 0) != 0 || CompareImages(dmap1, check1, 0) != 0) printf("Bidirectional CalcZNCC kernel differs from the CalcZNCC kernel!\n");
+	clReleaseMemObject(check_cl);
+#endif
+#elif ZNCC_TILED
+	// The windows of a whole work-group are loaded to local memory once
+	size_t zncc_local[2][2] = { { ZNCC_GROUP_X, ZNCC_GROUP_Y }, { ZNCC_GROUP_X, ZNCC_GROUP_Y } };
+	if (tuneZNCCKernel(tuner, cmd_q, tiled0, 1, im0_gray_cl, im1_gray_cl, dmap0_cl, new_w, new_h, min_disparity, max_disparity, zncc_local[0])) return 1;
+	if (tuneZNCCKernel(tuner, cmd_q, tiled1, 1, im1_gray_cl, im0_gray_cl, dmap1_cl, new_w, new_h, neg_max_disparity, min_disparity, zncc_local[1])) return 1;
+	printf("Using the tiled CalcZNCC kernel, work-groups %dx%d and %dx%d\n", (int)zncc_local[0][0], (int)zncc_local[0][1], (int)zncc_local[1][0], (int)zncc_local[1][1]);
+	dmap0 = executeZNCCKernel(cmd_q, tiled0, 1, zncc_local[0], im0_gray_cl, im1_gray_cl, dmap0_cl, new_w, new_h, min_disparity, max_disparity);
+	if (dmap0.Empty()) return 1;
+	WriteImage(dmap0, "imgs/im0_zncc.png", LCT_GREY, 8);
+	dmap1 = executeZNCCKernel(cmd_q, tiled1, 1, zncc_local[1], im1_gray_cl, im0_gray_cl, dmap1_cl, new_w, new_h, neg_max_disparity, min_disparity);
+	if (dmap1.Empty()) return 1;
+#if CHECK_OPENCL_ZNCC
+	// Run calc_zncc into a spare buffer and compare
+	printf("Checking the result against the CalcZNCC kernel\n");
+	cl_mem check_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);
 	if (!errorCheck(err_num)) return 1;
-	// Run the kernel
-	dmap0 = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, dmap0_cl);
+	size_t check_local[] = { 1, 1 };
+	Image check0 = executeZNCCKernel(cmd_q, zncc0, 0, check_local, im0_gray_cl, im1_gray_cl, check_cl, new_w, new_h, min_disparity, max_disparity);
+	Image check1 = executeZNCCKernel(cmd_q, zncc1, 0, check_local, im1_gray_cl, im0_gray_cl, check_cl, new_w, new_h, neg_max_disparity, min_disparity);
+	if (CompareImages(dmap0, check0, 0) != 0 || CompareImages(dmap1, check1, 0) != 0) printf("Tiled CalcZNCC kernel differs from the CalcZNCC kernel!\n");
+	clReleaseMemObject(check_cl);
+#endif
+#else
+	size_t zncc_local[2][2] = { { 1, 1 }, { 1, 1 } };
+	if (tuneZNCCKernel(tuner, cmd_q, zncc0, 0, im0_gray_cl, im1_gray_cl, dmap0_cl, new_w, new_h, min_disparity, max_disparity, zncc_local[0])) return 1;
+	if (tuneZNCCKernel(tuner, cmd_q, zncc1, 0, im1_gray_cl, im0_gray_cl, dmap1_cl, new_w, new_h, neg_max_disparity, min_disparity, zncc_local[1])) return 1;
+	// im0 left + im1 right
+	dmap0 = executeZNCCKernel(cmd_q, zncc0, 0, zncc_local[0], im0_gray_cl, im1_gray_cl, dmap0_cl, new_w, new_h, min_disparity, max_disparity);
+	if (dmap0.Empty()) return 1;
 	// Save the result
-	WriteImage(dmap0, "imgs/im0_zncc.png", new_w, new_h, LCT_GREY, 8);
+	WriteImage(dmap0, "imgs/im0_zncc.png", LCT_GREY, 8);
 	
-	// im1 left + im0 right parameters
-	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &im1_gray_cl);
-	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &im0_gray_cl);
-	err_num |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &dmap1_cl);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(int), &neg_max_disparity);
-	err_num |= clSetKernelArg(kernel, 4, sizeof(int), &min_disparity);
-	if (!errorCheck(err_num)) return 1;
-	// Run the kernel
-	dmap1 = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, dmap1_cl);
+	// im1 left + im0 right
+	dmap1 = executeZNCCKernel(cmd_q, zncc1, 0, zncc_local[1], im1_gray_cl, im0_gray_cl, dmap1_cl, new_w, new_h, neg_max_disparity, min_disparity);
+	if (dmap1.Empty()) return 1;
+#endif
 	// Save the result
-	WriteImage(dmap1, "imgs/im1_zncc.png", new_w, new_h, LCT_GREY, 8);
+	WriteImage(dmap1, "imgs/im1_zncc.png", LCT_GREY, 8);
 
 	printf("\n");
 	
 	//
 	// CrossCheck
 	//
-	std::vector<unsigned char> cross(new_w * new_h);
-	unsigned int threshold = 3;
+	Image cross;
+	unsigned int threshold = THRESHOLD;
+	unsigned int invalid = CROSS_CHECK_INVALID;
 	// Create Kernel
-	kernel = createKernel(context, device_id, KERNEL_CROSS_CHECK, (const char**)&cross_check_src.source_str, (const size_t*)&cross_check_src.source_size);
+	kernel = registry.GetKernel(KERNEL_CROSS_CHECK_FILE_NAME, KERNEL_CROSS_CHECK);
 	if (kernel == NULL) return 1;
 
 	// Create Buffers for the vector
@@ -194,121 +1047,843 @@ int main() {
 	err_num |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &new_w);
 	err_num |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &new_h);
 	err_num |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &threshold);
+	err_num |= clSetKernelArg(kernel, 6, sizeof(unsigned int), &invalid);
 	if (!errorCheck(err_num)) return 1;
+	size_t cross_local[] = { 1, 1 };
+	tuneLocalSize(tuner, cmd_q, kernel, KERNEL_CROSS_CHECK, global_size, cross_local);
 	// Execute the Kernel
 	printf("Executing the CrossCheck Kernel\n");
-	cross = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, cross_cl);
-	WriteImage(cross, "imgs/cross_check.png", new_w, new_h, LCT_GREY, 8);
+	cross = executeBufferKernel(cmd_q, kernel, global_size, cross_local, new_w, new_h, cross_cl);
+	WriteImage(cross, "imgs/cross_check.png", LCT_GREY, 8);
 	printf("\n");
 
 	//
 	// Occlusion Fill
 	//
-	std::vector<unsigned char> fill(new_w * new_h);
-	// Create Kernel
-	kernel = createKernel(context, device_id, KERNEL_OCCLUSION_FILL, (const char**)&occlusion_fill_src.source_str, (const size_t*)&occlusion_fill_src.source_size);
-	if (kernel == NULL) return 1;
+	Image fill;
+	timer_struct timer;
+	// Create Kernels
+	cl_kernel jfa_init = registry.GetKernel(KERNEL_JUMP_FLOOD_FILE_NAME, KERNEL_JFA_INIT);
+	cl_kernel jfa_step = registry.GetKernel(KERNEL_JUMP_FLOOD_FILE_NAME, KERNEL_JFA_STEP);
+	cl_kernel jfa_resolve = registry.GetKernel(KERNEL_JUMP_FLOOD_FILE_NAME, KERNEL_JFA_RESOLVE);
+	if (jfa_init == NULL || jfa_step == NULL || jfa_resolve == NULL) return 1;
 
-	// Create Buffers for the vectors
+	// Create Buffers for the result and for the two seed buffers the steps ping-pong between
 	cl_mem fill_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);
 	if (!errorCheck(err_num)) return 1;
-
-	// Give parameters to Kernel
-	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &cross_cl);
-	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &fill_cl);
-	err_num |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &new_w);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &new_h);
+	cl_mem seeds_cl[2];
+	seeds_cl[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(cl_int), NULL, &err_num);
 	if (!errorCheck(err_num)) return 1;
-	// Execute the Kernel
-	printf("Executing the Occlusion Fill Kernel\n");
-	fill = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, fill_cl);
-	WriteImage(fill, "imgs/occlusion_fill.png", new_w, new_h, LCT_GREY, 8);
+	seeds_cl[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(cl_int), NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+
+	size_t jfa_local[] = { 1, 1 };
+	if (tuneJumpFlood(tuner, cmd_q, jfa_init, jfa_step, cross_cl, seeds_cl, new_w, new_h, global_size, jfa_local)) return 1;
+
+	printf("Executing the Jump Flooding Occlusion Fill Kernels\n");
+	StartTimer(&timer);
+	cl_event fill_event = enqueueJumpFlood(cmd_q, jfa_init, jfa_step, jfa_resolve, cross_cl, seeds_cl, fill_cl, new_w, new_h, global_size, jfa_local, NULL, NULL);
+	if (fill_event == NULL) return 1;
+	cl_event read_event = readBufferAsync(cmd_q, fill_cl, new_w, new_h, fill, 1, &fill_event);
+	if (read_event == NULL) return 1;
+	clWaitForEvents(1, &read_event);
+	clReleaseEvent(fill_event);
+	clReleaseEvent(read_event);
+	StopTimer(&timer, "Jump Flooding Occlusion Fill done");
+#if CHECK_OPENCL_FILL
+	// Compare against the CPU occlusion fill
+	printf("Checking the result against the CPU occlusion fill\n");
+	Image cpu_fill = OCCLUSION_FILL_BACKEND(cross);
+	int mismatches = CompareImages(fill, cpu_fill, FILL_TOLERANCE);
+	if (mismatches < 0 || mismatches > FILL_MAX_MISMATCH / 100 * fill.Size()) printf("Jump Flooding Occlusion Fill differs too much from the CPU occlusion fill!\n");
+	FreeImage(cpu_fill);
+#endif
+	WriteImage(fill, "imgs/occlusion_fill.png", LCT_GREY, 8);
 	printf("\n");
 
 	//
 	// Normalize the images
 	//
-	// Create Kernel
-	kernel = createKernel(context, device_id, KERNEL_NORMALIZE, (const char**)&normalize_src.source_str, (const size_t*)&normalize_src.source_size);
+	// Create Kernels. The minimum and maximum of each image are found on the device
+	kernel = registry.GetKernel(KERNEL_NORMALIZE_FILE_NAME, KERNEL_NORMALIZE);
+	cl_kernel min_max = registry.GetKernel(KERNEL_MIN_MAX_FILE_NAME, KERNEL_MIN_MAX);
+	if (kernel == NULL || min_max == NULL) return 1;
 	// Initialize
-	int min, max;
+	cl_event min_max_event;
+	cl_mem min_max_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint), NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
 	cl_mem dmap0_norm = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);;
 	cl_mem dmap1_norm = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);;
 	cl_mem cross_norm = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);;
 	cl_mem fill_norm = clCreateBuffer(context, CL_MEM_READ_WRITE, new_w * new_h * sizeof(unsigned char), NULL, &err_num);;
 	// dmap0
-	min = *std::min_element(dmap0.begin(), dmap0.end());
-	max = *std::max_element(dmap0.begin(), dmap0.end());
+	min_max_event = enqueueMinMax(cmd_q, min_max, dmap0_cl, new_w * new_h, min_max_cl, 0, NULL);
+	if (min_max_event == NULL) return 1;
+	clReleaseEvent(min_max_event);
 	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dmap0_cl);
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &dmap0_norm);
 	err_num |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &new_w);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(int), &min);
-	err_num |= clSetKernelArg(kernel, 4, sizeof(int), &max);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &min_max_cl);
+	if (!errorCheck(err_num)) return 1;
+	size_t normalize_local[] = { 1, 1 };
+	tuneLocalSize(tuner, cmd_q, kernel, KERNEL_NORMALIZE, global_size, normalize_local);
 	printf("Normalizing dmap0");
-	dmap0 = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, dmap0_norm);
-	WriteImage(dmap0, "imgs/im0_zncc_norm.png", new_w, new_h, LCT_GREY, 8);
+	dmap0 = executeBufferKernel(cmd_q, kernel, global_size, normalize_local, new_w, new_h, dmap0_norm);
+	WriteImage(dmap0, "imgs/im0_zncc_norm.png", LCT_GREY, 8);
 	// dmap1
-	min = *std::min_element(dmap1.begin(), dmap1.end());
-	max = *std::max_element(dmap1.begin(), dmap1.end());
+	min_max_event = enqueueMinMax(cmd_q, min_max, dmap1_cl, new_w * new_h, min_max_cl, 0, NULL);
+	if (min_max_event == NULL) return 1;
+	clReleaseEvent(min_max_event);
 	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dmap1_cl);
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &dmap1_norm);
 	err_num |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &new_w);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(int), &min);
-	err_num |= clSetKernelArg(kernel, 4, sizeof(int), &max);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &min_max_cl);
+	if (!errorCheck(err_num)) return 1;
 	printf("Normalizing dmap1");
-	dmap1 = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, dmap1_norm);
-	WriteImage(dmap1, "imgs/im1_zncc_norm.png", new_w, new_h, LCT_GREY, 8);
+	dmap1 = executeBufferKernel(cmd_q, kernel, global_size, normalize_local, new_w, new_h, dmap1_norm);
+	WriteImage(dmap1, "imgs/im1_zncc_norm.png", LCT_GREY, 8);
 	// Cross Check
-	min = *std::min_element(cross.begin(), cross.end());
-	max = *std::max_element(cross.begin(), cross.end());
+	min_max_event = enqueueMinMax(cmd_q, min_max, cross_cl, new_w * new_h, min_max_cl, 0, NULL);
+	if (min_max_event == NULL) return 1;
+	clReleaseEvent(min_max_event);
 	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &cross_cl);
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &cross_norm);
 	err_num |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &new_w);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(int), &min);
-	err_num |= clSetKernelArg(kernel, 4, sizeof(int), &max);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &min_max_cl);
+	if (!errorCheck(err_num)) return 1;
 	printf("Normalizing Cross Check");
-	cross = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, cross_norm);
-	WriteImage(cross, "imgs/cross_check_norm.png", new_w, new_h, LCT_GREY, 8);
+	cross = executeBufferKernel(cmd_q, kernel, global_size, normalize_local, new_w, new_h, cross_norm);
+	WriteImage(cross, "imgs/cross_check_norm.png", LCT_GREY, 8);
 	// Occlusion Fill
-	min = *std::min_element(fill.begin(), fill.end());
-	max = *std::max_element(fill.begin(), fill.end());
+	min_max_event = enqueueMinMax(cmd_q, min_max, fill_cl, new_w * new_h, min_max_cl, 0, NULL);
+	if (min_max_event == NULL) return 1;
+	clReleaseEvent(min_max_event);
 	err_num = clSetKernelArg(kernel, 0, sizeof(cl_mem), &fill_cl);
 	err_num |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &fill_norm);
 	err_num |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &new_w);
-	err_num |= clSetKernelArg(kernel, 3, sizeof(int), &min);
-	err_num |= clSetKernelArg(kernel, 4, sizeof(int), &max);
+	err_num |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &min_max_cl);
+	if (!errorCheck(err_num)) return 1;
 	printf("Normalizing Occlusion Fill");
-	fill = executeBufferKernel(cmd_q, kernel, global_size, local_size, new_w, new_h, fill_norm);
-	WriteImage(fill, "imgs/occlusion_fill_norm.png", new_w, new_h, LCT_GREY, 8);
+	fill = executeBufferKernel(cmd_q, kernel, global_size, normalize_local, new_w, new_h, fill_norm);
+	WriteImage(fill, "imgs/occlusion_fill_norm.png", LCT_GREY, 8);
 
 	//
 	// Free Memory
 	//
-	free(resize_grayscale_src.source_str);
-	free(calc_zncc_src.source_str);
-	free(cross_check_src.source_str);
-	free(occlusion_fill_src.source_str);
-	free(normalize_src.source_str);
-
+	registry.PrintStatistics();
 	err_num = clFlush(cmd_q);
 	err_num |= clFinish(cmd_q);
-	err_num |= clReleaseKernel(kernel);
 	err_num |= clReleaseMemObject(im0_gray_cl);
 	err_num |= clReleaseMemObject(im1_gray_cl);
 	err_num |= clReleaseMemObject(dmap0_cl);
 	err_num |= clReleaseMemObject(dmap1_cl);
 	err_num |= clReleaseMemObject(cross_cl);
 	err_num |= clReleaseMemObject(fill_cl);
+	err_num |= clReleaseMemObject(seeds_cl[0]);
+	err_num |= clReleaseMemObject(seeds_cl[1]);
+	err_num |= clReleaseMemObject(min_max_cl);
 	err_num |= clReleaseDevice(device_id);
 	err_num |= clReleaseCommandQueue(cmd_q);
 	err_num |= clReleaseContext(context);
 
-	FreeImageVector(im0_gray);
-	FreeImageVector(im1_gray);
-	FreeImageVector(dmap0);
-	FreeImageVector(dmap1);
-	FreeImageVector(cross);
-	FreeImageVector(fill);
+	FreeImage(im0_gray);
+	FreeImage(im1_gray);
+	FreeImage(dmap0);
+	FreeImage(dmap1);
+	FreeImage(cross);
+	FreeImage(fill);
+	return 0;
+}
+
+/*
+* \brief Device buffer the device resident pipeline can save, and the event after which the buffer is ready
+*/
+typedef struct {
+	unsigned flag;
+	unsigned norm_flag;
+	const char* file_name;
+	const char* norm_file_name;
+	cl_mem buffer;
+	cl_event ready;
+	cl_mem norm_buffer; // Normalized on the device already if set, and ready after norm_ready
+	cl_event norm_ready;
+} resident_output;
+
+#define RESIDENT_OUTPUT_COUNT 6 // Images the device resident pipeline can read back
+
+/*
+* \brief Called by runResidentPipeline with every selected image as soon as it has been read back, while the device may still be
+* working on the others. The file name has no directory. Returns 0 if successful; 1 otherwise
+*/
+typedef std::function<int(ImageView, const char*)> resident_save;
+
+/*
+* \brief OpenCL objects of the device resident pipeline. The device, context, command queue and kernels are set up once by
+* createResidentPipeline. The buffers are created for the first pair and kept for the following ones, resizeResidentPipeline only
+* replaces them when the images have another size
+*/
+typedef struct {
+	cl_device_id device_id;
+	cl_context context;
+	cl_command_queue cmd_q;
+	KernelRegistry* registry;
+	WorkGroupTuner* tuner;
+
+	cl_kernel resize_grayscale;
+	cl_kernel calc_zncc_bidir;
+	cl_kernel calc_zncc[2];
+	cl_kernel cross_check;
+	cl_kernel jfa_init;
+	cl_kernel jfa_step;
+	cl_kernel jfa_resolve;
+	cl_kernel normalize;
+	cl_kernel min_max;
+	cl_kernel cross_fill;
+	cl_kernel normalize_cross_fill;
+
+	// Size of the RGBA images the buffers were created for, 0 before the first pair
+	unsigned w;
+	unsigned h;
+	cl_mem im0_cl, im1_cl;
+	cl_mem im0_gray_img, im1_gray_img;
+	cl_mem buffers[8]; // Grayscale images, disparity maps, CrossCheck, Occlusion Fill and the two jump flooding seed buffers
+	cl_mem range_cl; // Minimum and maximum of the cross check and the occlusion fill from cross_fill
+	cl_mem post_norm_cl[2]; // Normalized CrossCheck and Occlusion Fill, created when first needed
+	cl_mem norm_cl[RESIDENT_OUTPUT_COUNT]; // Normalized outputs and their ranges, created when first needed
+	cl_mem min_max_cl[RESIDENT_OUTPUT_COUNT];
+
+	// Work-group sizes, tuned for the current size
+	size_t resize_local[2];
+	size_t zncc_local[2][2];
+	size_t bidir_local[2];
+	size_t cross_local[2];
+	size_t jfa_local[2];
+	size_t normalize_local[2];
+	size_t cross_fill_local[2];
+	size_t normalize_cross_fill_local[2];
+} resident_pipeline;
+
+/*
+* \brief Selects the device, and creates the context, the command queue and the kernels of the device resident pipeline.
+* Nothing depends on the image size yet
+* \param p The pipeline
+* \return 0 if successful; 1 otherwise
+*/
+int createResidentPipeline(resident_pipeline* p) {
+	// Every buffer starts as NULL
+	*p = resident_pipeline();
+
+	// Device selection + context and command queue creation
+	int err_num;
+	p->device_id = getGPUDevice();
+	printf("Creating context\n");
+	p->context = clCreateContext(NULL, 1, &p->device_id, NULL, NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	// The event wait lists are all the ordering the pipeline needs, so an out of order queue is used when the device has one
+	printf("Creating command queue\n");
+	p->cmd_q = clCreateCommandQueue(p->context, p->device_id, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err_num);
+	if (err_num == CL_INVALID_QUEUE_PROPERTIES) {
+		printf("Out of order command queue not supported, using an in order queue\n");
+		p->cmd_q = clCreateCommandQueue(p->context, p->device_id, CL_QUEUE_PROFILING_ENABLE, &err_num);
+	}
+	if (!errorCheck(err_num)) return 1;
+
+	// Create Kernels. Every program is built once, or loaded from the kernel cache
+	p->registry = new KernelRegistry(p->context, p->device_id, KERNEL_CACHE_DIR);
+	KernelRegistry& registry = *p->registry;
+	p->resize_grayscale = registry.GetKernel(KERNEL_RESIZE_GRAYSCALE_FILE_NAME, KERNEL_RESIZE_GRAYSCALE);
+#if ZNCC_BIDIRECTIONAL
+	p->calc_zncc_bidir = registry.GetKernel(KERNEL_CALCZNCC_BIDIR_FILE_NAME, KERNEL_CALCZNCC_BIDIR, znccBuildOptions(WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY).c_str());
+	if (p->calc_zncc_bidir == NULL) return 1;
+#else
+	p->calc_zncc[0] = getZNCCKernel(registry, ZNCC_TILED, WINDOW_Y, WINDOW_X, MIN_DISPARITY, MAX_DISPARITY);
+	p->calc_zncc[1] = getZNCCKernel(registry, ZNCC_TILED, WINDOW_Y, WINDOW_X, -MAX_DISPARITY, MIN_DISPARITY);
+	if (p->calc_zncc[0] == NULL || p->calc_zncc[1] == NULL) return 1;
+#endif
+	p->cross_check = registry.GetKernel(KERNEL_CROSS_CHECK_FILE_NAME, KERNEL_CROSS_CHECK);
+	p->jfa_init = registry.GetKernel(KERNEL_JUMP_FLOOD_FILE_NAME, KERNEL_JFA_INIT);
+	p->jfa_step = registry.GetKernel(KERNEL_JUMP_FLOOD_FILE_NAME, KERNEL_JFA_STEP);
+	p->jfa_resolve = registry.GetKernel(KERNEL_JUMP_FLOOD_FILE_NAME, KERNEL_JFA_RESOLVE);
+	p->normalize = registry.GetKernel(KERNEL_NORMALIZE_FILE_NAME, KERNEL_NORMALIZE);
+	p->min_max = registry.GetKernel(KERNEL_MIN_MAX_FILE_NAME, KERNEL_MIN_MAX);
+#if FUSED_POST_PROCESSING
+	p->cross_fill = registry.GetKernel(KERNEL_CROSS_FILL_FILE_NAME, KERNEL_CROSS_FILL);
+	p->normalize_cross_fill = registry.GetKernel(KERNEL_CROSS_FILL_FILE_NAME, KERNEL_NORMALIZE_CROSS_FILL);
+	if (p->cross_fill == NULL || p->normalize_cross_fill == NULL) return 1;
+#endif
+	registry.PrintStatistics();
+	if (p->resize_grayscale == NULL || p->cross_check == NULL || p->jfa_init == NULL || p->jfa_step == NULL || p->jfa_resolve == NULL || p->normalize == NULL || p->min_max == NULL) return 1;
+
+	// Minimum and maximum of the cross check and the occlusion fill from cross_fill
+	p->range_cl = clCreateBuffer(p->context, CL_MEM_READ_WRITE, 4 * sizeof(cl_uint), NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	for (int i = 0; i < RESIDENT_OUTPUT_COUNT; i++) {
+		p->min_max_cl[i] = clCreateBuffer(p->context, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint), NULL, &err_num);
+		if (!errorCheck(err_num)) return 1;
+	}
+	p->tuner = new WorkGroupTuner(p->device_id, TUNING_DIR);
+	printf("\n");
+	return 0;
+}
+
+/*
+* \brief Releases the buffers that depend on the image size. Buffers that were never created are skipped
+* \param p The pipeline
+* \return 0 if successful; 1 otherwise
+*/
+int releaseResidentBuffers(resident_pipeline* p) {
+	cl_mem* sized[] = { &p->im0_cl, &p->im1_cl, &p->im0_gray_img, &p->im1_gray_img, &p->post_norm_cl[0], &p->post_norm_cl[1] };
+	int err_num = 0;
+	for (int i = 0; i < sizeof(sized) / sizeof(sized[0]); i++) {
+		if (*sized[i] != NULL) err_num |= clReleaseMemObject(*sized[i]);
+		*sized[i] = NULL;
+	}
+	for (int i = 0; i < 8; i++) {
+		if (p->buffers[i] != NULL) err_num |= clReleaseMemObject(p->buffers[i]);
+		p->buffers[i] = NULL;
+	}
+	for (int i = 0; i < RESIDENT_OUTPUT_COUNT; i++) {
+		if (p->norm_cl[i] != NULL) err_num |= clReleaseMemObject(p->norm_cl[i]);
+		p->norm_cl[i] = NULL;
+	}
+	p->w = p->h = 0;
+	return errorCheck(err_num) ? 0 : 1;
+}
+
+/*
+* \brief Creates the buffers of the device resident pipeline for w x h RGBA images and tunes the work-group sizes for them.
+* Nothing is done if the buffers already have this size. Sizes the device cannot hold are refused without touching the buffers
+* \param p The pipeline
+* \param w Width of the RGBA images
+* \param h Height of the RGBA images
+* \return 0 if successful; 1 otherwise
+*/
+int resizeResidentPipeline(resident_pipeline* p, unsigned w, unsigned h) {
+	if (w == p->w && h == p->h) return 0;
+	// Checked before the old buffers are released, so a bad pair leaves the pipeline ready for the next one
+	size_t max_w = 0, max_h = 0;
+	clGetDeviceInfo(p->device_id, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(size_t), &max_w, NULL);
+	clGetDeviceInfo(p->device_id, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(size_t), &max_h, NULL);
+	if (w / 4 == 0 || h / 4 == 0 || w > max_w || h > max_h) {
+		printf("Images of %ux%u are not supported, they must be at least 4x4 and at most %ux%u\n", w, h, (unsigned)max_w, (unsigned)max_h);
+		return 1;
+	}
+	if (releaseResidentBuffers(p)) return 1;
+	unsigned new_w = w / 4;
+	unsigned new_h = h / 4;
+	size_t buffer_size = new_w * new_h * sizeof(unsigned char);
+	cl_context context = p->context;
+	cl_command_queue cmd_q = p->cmd_q;
+	int err_num;
+
+	// The RGBA images are written to these image objects for every pair
+	printf("Creating buffers for %ux%u images\n", w, h);
+	p->im0_cl = clCreateImage2D(context, CL_MEM_READ_ONLY, &getRGBAImageFormat(), w, h, 0, NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	p->im1_cl = clCreateImage2D(context, CL_MEM_READ_ONLY, &getRGBAImageFormat(), w, h, 0, NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+
+	// Device memory for every stage. The grayscale images are copied from the image objects to buffers on the device
+	p->im0_gray_img = clCreateImage2D(context, CL_MEM_READ_WRITE, &getGrayImageFormat(), new_w, new_h, 0, NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	p->im1_gray_img = clCreateImage2D(context, CL_MEM_READ_WRITE, &getGrayImageFormat(), new_w, new_h, 0, NULL, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	for (int i = 0; i < 8; i++) {
+		// The last two are the jump flooding seeds
+		p->buffers[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, i < 6 ? buffer_size : new_w * new_h * sizeof(cl_int), NULL, &err_num);
+		if (!errorCheck(err_num)) return 1;
+	}
+	p->w = w;
+	p->h = h;
+	cl_mem im0_gray_cl = p->buffers[0], im1_gray_cl = p->buffers[1];
+	cl_mem dmap0_cl = p->buffers[2], dmap1_cl = p->buffers[3];
+	cl_mem cross_cl = p->buffers[4], fill_cl = p->buffers[5];
+
+	// Work-group sizes. The tuning runs write to the buffers, so they are tuned before any pair is enqueued
+	size_t global_size[] = { new_w, new_h };
+	unsigned int threshold = THRESHOLD;
+	WorkGroupTuner& tuner = *p->tuner;
+	// Sizes used when AUTOTUNE_WORK_GROUPS is 0
+	size_t* unit_sizes[] = { p->resize_local, p->zncc_local[0], p->zncc_local[1], p->cross_local, p->jfa_local, p->normalize_local, p->normalize_cross_fill_local };
+	for (int i = 0; i < sizeof(unit_sizes) / sizeof(unit_sizes[0]); i++) unit_sizes[i][0] = unit_sizes[i][1] = 1;
+	p->bidir_local[0] = ZNCC_BIDIR_GROUP_X;
+	p->bidir_local[1] = ZNCC_BIDIR_GROUP_Y;
+	p->cross_fill_local[0] = CROSS_FILL_GROUP_X;
+	p->cross_fill_local[1] = CROSS_FILL_GROUP_Y;
+	err_num = clSetKernelArg(p->resize_grayscale, 0, sizeof(cl_mem), &p->im0_cl);
+	err_num |= clSetKernelArg(p->resize_grayscale, 1, sizeof(cl_mem), &p->im0_gray_img);
+	if (!errorCheck(err_num)) return 1;
+	tuneLocalSize(tuner, cmd_q, p->resize_grayscale, KERNEL_RESIZE_GRAYSCALE, global_size, p->resize_local);
+#if ZNCC_BIDIRECTIONAL
+	tuneBidirectionalZNCC(tuner, cmd_q, p->calc_zncc_bidir, im0_gray_cl, im1_gray_cl, dmap0_cl, dmap1_cl, new_w, new_h, p->bidir_local);
+#else
+	cl_mem zncc_left[] = { im0_gray_cl, im1_gray_cl };
+	cl_mem zncc_right[] = { im1_gray_cl, im0_gray_cl };
+	cl_mem zncc_dst[] = { dmap0_cl, dmap1_cl };
+	int zncc_min[] = { MIN_DISPARITY, -MAX_DISPARITY };
+	int zncc_max[] = { MAX_DISPARITY, MIN_DISPARITY };
+	for (int i = 0; i < 2; i++) {
+#if ZNCC_TILED
+		p->zncc_local[i][0] = ZNCC_GROUP_X;
+		p->zncc_local[i][1] = ZNCC_GROUP_Y;
+#endif
+		if (tuneZNCCKernel(tuner, cmd_q, p->calc_zncc[i], ZNCC_TILED, zncc_left[i], zncc_right[i], zncc_dst[i], new_w, new_h, zncc_min[i], zncc_max[i], p->zncc_local[i])) return 1;
+	}
+#endif
+#if FUSED_POST_PROCESSING
+	tuneCrossFill(tuner, cmd_q, p->cross_fill, dmap0_cl, dmap1_cl, cross_cl, fill_cl, p->range_cl, new_w, new_h, threshold, FILL_RADIUS, p->cross_fill_local);
+	// The normalized images go to the grayscale buffers, which the pipeline writes later
+	err_num = clSetKernelArg(p->normalize_cross_fill, 0, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(p->normalize_cross_fill, 1, sizeof(cl_mem), &fill_cl);
+	err_num |= clSetKernelArg(p->normalize_cross_fill, 2, sizeof(cl_mem), &im0_gray_cl);
+	err_num |= clSetKernelArg(p->normalize_cross_fill, 3, sizeof(cl_mem), &im1_gray_cl);
+	err_num |= clSetKernelArg(p->normalize_cross_fill, 4, sizeof(unsigned int), &new_w);
+	err_num |= clSetKernelArg(p->normalize_cross_fill, 5, sizeof(cl_mem), &p->range_cl);
+	if (!errorCheck(err_num)) return 1;
+	tuneLocalSize(tuner, cmd_q, p->normalize_cross_fill, KERNEL_NORMALIZE_CROSS_FILL, global_size, p->normalize_cross_fill_local);
+#else
+	unsigned int invalid = CROSS_CHECK_INVALID;
+	cl_mem* seeds_cl = &p->buffers[6];
+	err_num = clSetKernelArg(p->cross_check, 0, sizeof(cl_mem), &dmap0_cl);
+	err_num |= clSetKernelArg(p->cross_check, 1, sizeof(cl_mem), &dmap1_cl);
+	err_num |= clSetKernelArg(p->cross_check, 2, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(p->cross_check, 3, sizeof(unsigned int), &new_w);
+	err_num |= clSetKernelArg(p->cross_check, 4, sizeof(unsigned int), &new_h);
+	err_num |= clSetKernelArg(p->cross_check, 5, sizeof(unsigned int), &threshold);
+	err_num |= clSetKernelArg(p->cross_check, 6, sizeof(unsigned int), &invalid);
+	if (!errorCheck(err_num)) return 1;
+	tuneLocalSize(tuner, cmd_q, p->cross_check, KERNEL_CROSS_CHECK, global_size, p->cross_local);
+	if (tuneJumpFlood(tuner, cmd_q, p->jfa_init, p->jfa_step, cross_cl, seeds_cl, new_w, new_h, global_size, p->jfa_local)) return 1;
+#endif
+	// Any range works for timing, the output goes to the fill buffer
+	cl_uint tune_range[] = { 0, 255 };
+	cl_mem tune_min_max = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(tune_range), tune_range, &err_num);
+	if (!errorCheck(err_num)) return 1;
+	err_num = clSetKernelArg(p->normalize, 0, sizeof(cl_mem), &dmap0_cl);
+	err_num |= clSetKernelArg(p->normalize, 1, sizeof(cl_mem), &fill_cl);
+	err_num |= clSetKernelArg(p->normalize, 2, sizeof(unsigned int), &new_w);
+	err_num |= clSetKernelArg(p->normalize, 3, sizeof(cl_mem), &tune_min_max);
+	if (!errorCheck(err_num)) return 1;
+	tuneLocalSize(tuner, cmd_q, p->normalize, KERNEL_NORMALIZE, global_size, p->normalize_local);
+	err_num = clReleaseMemObject(tune_min_max);
+	if (!errorCheck(err_num)) return 1;
+	printf("\n");
+
+	return 0;
+}
+
+/*
+* \brief Releases everything createResidentPipeline and resizeResidentPipeline created
+* \param p The pipeline
+* \return 0 if successful; 1 otherwise
+*/
+int releaseResidentPipeline(resident_pipeline* p) {
+	int err = releaseResidentBuffers(p);
+	int err_num = 0;
+	for (int i = 0; i < RESIDENT_OUTPUT_COUNT; i++) {
+		if (p->min_max_cl[i] != NULL) err_num |= clReleaseMemObject(p->min_max_cl[i]);
+	}
+	if (p->range_cl != NULL) err_num |= clReleaseMemObject(p->range_cl);
+	delete p->tuner;
+	delete p->registry;
+	err_num |= clReleaseDevice(p->device_id);
+	err_num |= clReleaseCommandQueue(p->cmd_q);
+	err_num |= clReleaseContext(p->context);
+	*p = resident_pipeline();
+	return errorCheck(err_num) ? err : 1;
+}
+
+/*
+* \brief Events and host images of one pair in the device resident pipeline. They are kept until the queue is idle, also when
+* the pair fails half way, since the device may still be using them
+* \param events Every event of the pair, released once the queue is idle
+* \param timed Events of the timed kernels, which are also in events
+* \param timed_first Events the times start from, the same as timed except for stages of several kernels
+* \param timed_names Names of the timed kernels
+* \param raw Host images the selected outputs are read to
+* \param norm Host images the selected normalized outputs are read to
+*/
+typedef struct {
+	std::vector<cl_event> events;
+	std::vector<cl_event> timed;
+	std::vector<cl_event> timed_first;
+	std::vector<const char*> timed_names;
+	Image raw[RESIDENT_OUTPUT_COUNT];
+	Image norm[RESIDENT_OUTPUT_COUNT];
+} resident_run;
+
+/*
+* \brief Enqueues every stage of one pair, waits for the selected outputs and saves them. Returns as soon as something fails,
+* without waiting for what was already enqueued, so the caller has to finish the queue before releasing run
+* \param p Pipeline with buffers of the size of im0
+* \param im0 Left RGBA image
+* \param im1 Right RGBA image, the same size as im0
+* \param outputs OUTPUT_* flags of the images to save
+* \param save Called with every selected image once it has been read
+* \param run Every event created is added here
+* \return 0 if successful; 1 otherwise
+*/
+int runResidentStages(resident_pipeline* p, ImageView im0, ImageView im1, unsigned outputs, const resident_save& save, resident_run* run) {
+	unsigned w = p->w;
+	unsigned h = p->h;
+	unsigned new_w = w / 4;
+	unsigned new_h = h / 4;
+	size_t buffer_size = new_w * new_h * sizeof(unsigned char);
+	cl_context context = p->context;
+	cl_command_queue cmd_q = p->cmd_q;
+	cl_mem im0_gray_cl = p->buffers[0], im1_gray_cl = p->buffers[1];
+	cl_mem dmap0_cl = p->buffers[2], dmap1_cl = p->buffers[3];
+	cl_mem cross_cl = p->buffers[4], fill_cl = p->buffers[5];
+	int err_num;
+
+	size_t global_size[] = { new_w, new_h };
+	size_t origin[] = { 0, 0, 0 };
+	size_t region[] = { new_w, new_h, 1 };
+	size_t rgba_region[] = { w, h, 1 };
+	unsigned int threshold = THRESHOLD;
+	unsigned char zero = 0;
+	cl_mem zncc_dst[] = { dmap0_cl, dmap1_cl };
+	std::vector<cl_event>& events = run->events;
+
+	// Write im0 and im1 to the device, Resize & Grayscale them, then copy the results to buffers for CalcZNCC.
+	// The host images are read until the writes finish, which runResidentPipeline waits for even if this fails
+	cl_event write_events[2], gray_events[2];
+	ImageView rgba[] = { im0, im1 };
+	cl_mem rgba_cl[] = { p->im0_cl, p->im1_cl };
+	cl_mem gray_img[] = { p->im0_gray_img, p->im1_gray_img };
+	cl_mem gray_cl[] = { im0_gray_cl, im1_gray_cl };
+	for (int i = 0; i < 2; i++) {
+		err_num = clEnqueueWriteImage(cmd_q, rgba_cl[i], CL_FALSE, origin, rgba_region, rgba[i].stride, 0, rgba[i].data, 0, NULL, &write_events[i]);
+		if (!errorCheck(err_num)) return 1;
+		events.push_back(write_events[i]);
+		err_num = clSetKernelArg(p->resize_grayscale, 0, sizeof(cl_mem), &rgba_cl[i]);
+		err_num |= clSetKernelArg(p->resize_grayscale, 1, sizeof(cl_mem), &gray_img[i]);
+		if (!errorCheck(err_num)) return 1;
+		cl_event resize_event = enqueueKernel(cmd_q, p->resize_grayscale, global_size, p->resize_local, 1, &write_events[i]);
+		if (resize_event == NULL) return 1;
+		events.push_back(resize_event);
+		run->timed.push_back(resize_event);
+		run->timed_first.push_back(resize_event);
+		run->timed_names.push_back(i == 0 ? "Resize & Grayscale im0" : "Resize & Grayscale im1");
+		err_num = clEnqueueCopyImageToBuffer(cmd_q, gray_img[i], gray_cl[i], origin, region, 0, 1, &resize_event, &gray_events[i]);
+		if (!errorCheck(err_num)) return 1;
+		events.push_back(gray_events[i]);
+	}
+
+	// CalcZNCC, left=im0 and left=im1. calc_zncc skips the borders, so the results are cleared first
+	cl_event zncc_events[2];
+#if ZNCC_BIDIRECTIONAL
+	cl_event zncc_wait_list[4] = { gray_events[0], gray_events[1], NULL, NULL };
+	for (int i = 0; i < 2; i++) {
+		err_num = clEnqueueFillBuffer(cmd_q, zncc_dst[i], &zero, sizeof(unsigned char), 0, buffer_size, 0, NULL, &zncc_wait_list[2 + i]);
+		if (!errorCheck(err_num)) return 1;
+		events.push_back(zncc_wait_list[2 + i]);
+	}
+	cl_event bidir_event = enqueueBidirectionalZNCC(cmd_q, p->calc_zncc_bidir, im0_gray_cl, im1_gray_cl, dmap0_cl, dmap1_cl, new_w, new_h, p->bidir_local, 4, zncc_wait_list);
+	if (bidir_event == NULL) return 1;
+	// Both maps are finished by the same launch
+	zncc_events[0] = zncc_events[1] = bidir_event;
+	events.push_back(bidir_event);
+	run->timed.push_back(bidir_event);
+	run->timed_first.push_back(bidir_event);
+	run->timed_names.push_back("CalcZNCC left=im0 and left=im1");
+#else
+	cl_mem zncc_left[] = { im0_gray_cl, im1_gray_cl };
+	cl_mem zncc_right[] = { im1_gray_cl, im0_gray_cl };
+	int zncc_min[] = { MIN_DISPARITY, -MAX_DISPARITY };
+	int zncc_max[] = { MAX_DISPARITY, MIN_DISPARITY };
+	for (int i = 0; i < 2; i++) {
+		cl_event wait_list[3] = { gray_events[0], gray_events[1], NULL };
+		err_num = clEnqueueFillBuffer(cmd_q, zncc_dst[i], &zero, sizeof(unsigned char), 0, buffer_size, 0, NULL, &wait_list[2]);
+		if (!errorCheck(err_num)) return 1;
+		events.push_back(wait_list[2]);
+#if ZNCC_TILED
+		zncc_events[i] = enqueueTiledZNCC(cmd_q, p->calc_zncc[i], zncc_left[i], zncc_right[i], zncc_dst[i], new_w, new_h, WINDOW_Y, WINDOW_X, zncc_min[i], zncc_max[i], p->zncc_local[i], 3, wait_list);
+#else
+		err_num = clSetKernelArg(p->calc_zncc[i], 0, sizeof(cl_mem), &zncc_left[i]);
+		err_num |= clSetKernelArg(p->calc_zncc[i], 1, sizeof(cl_mem), &zncc_right[i]);
+		err_num |= clSetKernelArg(p->calc_zncc[i], 2, sizeof(cl_mem), &zncc_dst[i]);
+		err_num |= clSetKernelArg(p->calc_zncc[i], 3, sizeof(unsigned int), &new_w);
+		err_num |= clSetKernelArg(p->calc_zncc[i], 4, sizeof(unsigned int), &new_h);
+		if (!errorCheck(err_num)) return 1;
+		zncc_events[i] = enqueueKernel(cmd_q, p->calc_zncc[i], global_size, p->zncc_local[i], 3, wait_list);
+#endif
+		if (zncc_events[i] == NULL) return 1;
+		events.push_back(zncc_events[i]);
+		run->timed.push_back(zncc_events[i]);
+		run->timed_first.push_back(zncc_events[i]);
+		run->timed_names.push_back(i == 0 ? "CalcZNCC left=im0" : "CalcZNCC left=im1");
+	}
+#endif
+
+	// Normalized CrossCheck and Occlusion Fill when cross_fill does them
+	cl_mem post_norm_cl[] = { NULL, NULL };
+	cl_event post_norm_event = NULL;
+#if FUSED_POST_PROCESSING
+	// CrossCheck and Occlusion Fill in one kernel, which also finds the normalization ranges of both
+	cl_event cross_event = enqueueCrossFill(cmd_q, p->cross_fill, dmap0_cl, dmap1_cl, cross_cl, fill_cl, p->range_cl, new_w, new_h, threshold, FILL_RADIUS, p->cross_fill_local, 2, zncc_events);
+	if (cross_event == NULL) return 1;
+	cl_event fill_event = cross_event;
+	events.push_back(cross_event);
+	run->timed.push_back(cross_event);
+	run->timed_first.push_back(cross_event);
+	run->timed_names.push_back("CrossCheck & Occlusion Fill");
+
+	// Both normalized images with a single launch
+	if (outputs & (OUTPUT_CROSS_NORM | OUTPUT_FILL_NORM)) {
+		for (int i = 0; i < 2; i++) {
+			if (p->post_norm_cl[i] == NULL) {
+				p->post_norm_cl[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, NULL, &err_num);
+				if (!errorCheck(err_num)) return 1;
+			}
+			post_norm_cl[i] = p->post_norm_cl[i];
+		}
+		err_num = clSetKernelArg(p->normalize_cross_fill, 0, sizeof(cl_mem), &cross_cl);
+		err_num |= clSetKernelArg(p->normalize_cross_fill, 1, sizeof(cl_mem), &fill_cl);
+		err_num |= clSetKernelArg(p->normalize_cross_fill, 2, sizeof(cl_mem), &post_norm_cl[0]);
+		err_num |= clSetKernelArg(p->normalize_cross_fill, 3, sizeof(cl_mem), &post_norm_cl[1]);
+		err_num |= clSetKernelArg(p->normalize_cross_fill, 4, sizeof(unsigned int), &new_w);
+		err_num |= clSetKernelArg(p->normalize_cross_fill, 5, sizeof(cl_mem), &p->range_cl);
+		if (!errorCheck(err_num)) return 1;
+		post_norm_event = enqueueKernel(cmd_q, p->normalize_cross_fill, global_size, p->normalize_cross_fill_local, 1, &cross_event);
+		if (post_norm_event == NULL) return 1;
+		events.push_back(post_norm_event);
+		run->timed.push_back(post_norm_event);
+		run->timed_first.push_back(post_norm_event);
+		run->timed_names.push_back("Normalize CrossCheck & Occlusion Fill");
+	}
+#else
+	// Only cross_check and the jump flooding need the invalid value and the seed buffers
+	unsigned int invalid = CROSS_CHECK_INVALID;
+	cl_mem* seeds_cl = &p->buffers[6];
+
+	// CrossCheck
+	err_num = clSetKernelArg(p->cross_check, 0, sizeof(cl_mem), &dmap0_cl);
+	err_num |= clSetKernelArg(p->cross_check, 1, sizeof(cl_mem), &dmap1_cl);
+	err_num |= clSetKernelArg(p->cross_check, 2, sizeof(cl_mem), &cross_cl);
+	err_num |= clSetKernelArg(p->cross_check, 3, sizeof(unsigned int), &new_w);
+	err_num |= clSetKernelArg(p->cross_check, 4, sizeof(unsigned int), &new_h);
+	err_num |= clSetKernelArg(p->cross_check, 5, sizeof(unsigned int), &threshold);
+	err_num |= clSetKernelArg(p->cross_check, 6, sizeof(unsigned int), &invalid);
+	if (!errorCheck(err_num)) return 1;
+	cl_event cross_event = enqueueKernel(cmd_q, p->cross_check, global_size, p->cross_local, 2, zncc_events);
+	if (cross_event == NULL) return 1;
+	events.push_back(cross_event);
+	run->timed.push_back(cross_event);
+	run->timed_first.push_back(cross_event);
+	run->timed_names.push_back("CrossCheck");
+
+	// Occlusion Fill
+	cl_event fill_first_event = NULL;
+	cl_event fill_event = enqueueJumpFlood(cmd_q, p->jfa_init, p->jfa_step, p->jfa_resolve, cross_cl, seeds_cl, fill_cl, new_w, new_h, global_size, p->jfa_local, cross_event, &fill_first_event);
+	if (fill_event == NULL) return 1;
+	events.push_back(fill_first_event);
+	events.push_back(fill_event);
+	// From jfa_init to the end of jfa_resolve, so every step is included
+	run->timed.push_back(fill_event);
+	run->timed_first.push_back(fill_first_event);
+	run->timed_names.push_back("Jump Flooding Occlusion Fill");
+#endif
+
+	// Read back the selected images. Both grayscale and both disparity maps share a flag
+	resident_output results[RESIDENT_OUTPUT_COUNT] = {
+		{ OUTPUT_GRAY, 0, "im0_grey.png", NULL, im0_gray_cl, gray_events[0], NULL, NULL },
+		{ OUTPUT_GRAY, 0, "im1_grey.png", NULL, im1_gray_cl, gray_events[1], NULL, NULL },
+		{ OUTPUT_ZNCC, OUTPUT_ZNCC_NORM, "im0_zncc.png", "im0_zncc_norm.png", dmap0_cl, zncc_events[0], NULL, NULL },
+		{ OUTPUT_ZNCC, OUTPUT_ZNCC_NORM, "im1_zncc.png", "im1_zncc_norm.png", dmap1_cl, zncc_events[1], NULL, NULL },
+		{ OUTPUT_CROSS, OUTPUT_CROSS_NORM, "cross_check.png", "cross_check_norm.png", cross_cl, cross_event, post_norm_cl[0], post_norm_event },
+		{ OUTPUT_FILL, OUTPUT_FILL_NORM, "occlusion_fill.png", "occlusion_fill_norm.png", fill_cl, fill_event, post_norm_cl[1], post_norm_event },
+	};
+	Image* raw = run->raw;
+	Image* norm = run->norm;
+	cl_event raw_reads[RESIDENT_OUTPUT_COUNT], norm_reads[RESIDENT_OUTPUT_COUNT];
+	for (int i = 0; i < RESIDENT_OUTPUT_COUNT; i++) {
+		raw_reads[i] = norm_reads[i] = NULL;
+		if (outputs & results[i].flag) {
+			raw_reads[i] = readBufferAsync(cmd_q, results[i].buffer, new_w, new_h, raw[i], 1, &results[i].ready);
+			if (raw_reads[i] == NULL) return 1;
+			events.push_back(raw_reads[i]);
+		}
+		if (!(outputs & results[i].norm_flag)) continue;
+		if (results[i].norm_buffer != NULL) {
+			norm_reads[i] = readBufferAsync(cmd_q, results[i].norm_buffer, new_w, new_h, norm[i], 1, &results[i].norm_ready);
+			if (norm_reads[i] == NULL) return 1;
+			events.push_back(norm_reads[i]);
+			continue;
+		}
+
+		// Normalize with the minimum and maximum found on the device, so the host never waits for the raw image
+		if (p->norm_cl[i] == NULL) {
+			p->norm_cl[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, NULL, &err_num);
+			if (!errorCheck(err_num)) return 1;
+		}
+		cl_event min_max_event = enqueueMinMax(cmd_q, p->min_max, results[i].buffer, new_w * new_h, p->min_max_cl[i], 1, &results[i].ready);
+		if (min_max_event == NULL) return 1;
+		events.push_back(min_max_event);
+		run->timed.push_back(min_max_event);
+		run->timed_first.push_back(min_max_event);
+		run->timed_names.push_back("Min & Max");
+		err_num = clSetKernelArg(p->normalize, 0, sizeof(cl_mem), &results[i].buffer);
+		err_num |= clSetKernelArg(p->normalize, 1, sizeof(cl_mem), &p->norm_cl[i]);
+		err_num |= clSetKernelArg(p->normalize, 2, sizeof(unsigned int), &new_w);
+		err_num |= clSetKernelArg(p->normalize, 3, sizeof(cl_mem), &p->min_max_cl[i]);
+		if (!errorCheck(err_num)) return 1;
+		cl_event norm_event = enqueueKernel(cmd_q, p->normalize, global_size, p->normalize_local, 1, &min_max_event);
+		if (norm_event == NULL) return 1;
+		events.push_back(norm_event);
+		run->timed.push_back(norm_event);
+		run->timed_first.push_back(norm_event);
+		run->timed_names.push_back("Normalize");
+		norm_reads[i] = readBufferAsync(cmd_q, p->norm_cl[i], new_w, new_h, norm[i], 1, &norm_event);
+		if (norm_reads[i] == NULL) return 1;
+		events.push_back(norm_reads[i]);
+	}
+	err_num = clFlush(cmd_q);
+	if (!errorCheck(err_num)) return 1;
+
+	// Save the images once their reads have finished
+	int save_failed = 0;
+	for (int i = 0; i < RESIDENT_OUTPUT_COUNT; i++) {
+		if (outputs & results[i].flag) {
+			clWaitForEvents(1, &raw_reads[i]);
+			save_failed |= save(raw[i], results[i].file_name);
+		}
+		if (outputs & results[i].norm_flag) {
+			clWaitForEvents(1, &norm_reads[i]);
+			save_failed |= save(norm[i], results[i].norm_file_name);
+		}
+	}
+	return save_failed;
+}
+
+/*
+* \brief Runs the whole pipeline with the OpenCL kernels without reading the intermediate results back to the host.
+* Every stage waits for the events of the stages it needs instead of the host waiting for them, so the queue can be out of order.
+* Only the images selected by outputs are read back, and the reads do not block. The buffers are resized first if needed.
+* The queue is idle when this returns, also after a failure, so the next pair starts clean
+* \param p Pipeline from createResidentPipeline
+* \param im0 Left RGBA image
+* \param im1 Right RGBA image, the same size as im0
+* \param outputs OUTPUT_* flags of the images to save
+* \param save Called with every selected image once it has been read
+* \return 0 if successful; 1 otherwise
+*/
+int runResidentPipeline(resident_pipeline* p, ImageView im0, ImageView im1, unsigned outputs, const resident_save& save) {
+	if (resizeResidentPipeline(p, im0.width, im0.height)) return 1;
+	timer_struct timer;
+	printf("Enqueueing the pipeline\n");
+	StartTimer(&timer);
+	resident_run run;
+	int err = runResidentStages(p, im0, im1, outputs, save, &run);
+	// Also after a failure, since the device may still be reading im0 and im1 or writing the host images of run
+	int err_num = clFinish(p->cmd_q);
+	if (!errorCheck(err_num)) err = 1;
+	if (!err) {
+		StopTimer(&timer, "Device resident pipeline done");
+		// Kernel execution times from the profiling events
+		for (size_t i = 0; i < run.timed.size(); i++) {
+			printf("%s: %f milliseconds\n", run.timed_names[i], eventMilliseconds(run.timed_first[i], run.timed[i]));
+		}
+		printf("\n");
+	}
+
+	// Release the events of this pair. The buffers are kept for the next one
+	err_num = 0;
+	for (size_t i = 0; i < run.events.size(); i++) err_num |= clReleaseEvent(run.events[i]);
+	if (!errorCheck(err_num)) return 1;
+	return err;
+}
+
+/*
+* \brief Runs the device resident pipeline once, setting up and releasing the OpenCL objects around it. The images are saved to imgs/
+* \param im0 Left RGBA image
+* \param im1 Right RGBA image
+* \param outputs OUTPUT_* flags of the images to save
+* \return 0 if successful; 1 otherwise
+*/
+int RunOpenCLPipelineResident(Image& im0, Image& im1, unsigned outputs) {
+	resident_pipeline pipeline;
+	if (createResidentPipeline(&pipeline)) return 1;
+	resident_save save = [](ImageView img, const char* file_name) {
+		return WriteImage(img, (std::string("imgs/") + file_name).c_str(), LCT_GREY, 8);
+	};
+	if (runResidentPipeline(&pipeline, im0, im1, outputs, save)) return 1;
+	FreeImage(im0);
+	FreeImage(im1);
+	return releaseResidentPipeline(&pipeline);
+}
+
+/*
+* \brief Sets up the device resident pipeline once and serves stereo pairs with it until a client tells the server to quit.
+* The buffers are only created again when a pair has another size than the previous one
+* \return 0 if successful; 1 otherwise
+*/
+int RunDaemon() {
+	// An OpenCL error fails the job instead of waiting for a key nobody will press
+	setErrorCheckInteractive(0);
+	resident_pipeline pipeline;
+	if (createResidentPipeline(&pipeline)) return 1;
+	server_handler handler = [&](const server_job& job, std::string* message) {
+		Image im0, im1;
+		if (DecodeImage(im0, job.im0.c_str()) || DecodeImage(im1, job.im1.c_str())) {
+			*message = "failed to load " + job.im0 + " or " + job.im1;
+			return 1;
+		}
+		if (im0.Width() != im1.Width() || im0.Height() != im1.Height()) {
+			*message = "im0 and im1 have different sizes";
+			return 1;
+		}
+		// The reply lists the saved files
+		std::string saved;
+		resident_save save = [&](ImageView img, const char* file_name) {
+			std::string path = job.output_dir + "/" + file_name;
+			if (EncodeImage(img, path.c_str(), LCT_GREY, 8)) return 1;
+			saved += (saved.empty() ? "" : " ") + path;
+			return 0;
+		};
+		if (runResidentPipeline(&pipeline, im0, im1, DAEMON_OUTPUTS, save)) {
+			*message = "pipeline failed, saved: " + saved;
+			return 1;
+		}
+		*message = saved;
+		return 0;
+	};
+	int err = RunServer(DAEMON_SOCKET, DAEMON_SPOOL_DIR, DAEMON_POLL_MS, handler);
+	if (releaseResidentPipeline(&pipeline)) return 1;
+	return err;
+}
+
+int main() {
+	// The daemon and the batch read their own pairs, and do not wait for a key so they can run unattended
+	if (DAEMON_MODE) return RunDaemon();
+	if (BATCH_MODE) {
+		batch_config config = { BATCH_DECODE_THREADS, BATCH_COMPUTE_WORKERS, BATCH_THREADS_PER_WORKER, BATCH_ENCODE_THREADS, BATCH_QUEUE_CAPACITY };
+		return RunBatch(BATCH_INPUT_DIR, BATCH_OUTPUT_DIR, config, ComputeBatchPair);
+	}
+
+	// A sequence reads its own frames
+	if (SEQUENCE_MODE) {
+		if (RunSequencePipeline()) return 1;
+		printf("DONE!\n");
+		getchar();
+		return 0;
+	}
+
+	// Initialize original images. Dimensions are read from the files
+	Image im0, im1;
+
+	// Read the images into memory
+	if (ReadImage(im0, "im0.png")) return 1;
+	if (ReadImage(im1, "im1.png")) return 1;
+	printf("\n");
+
+	// Run the selected pipeline
+	int err;
+	if (PYRAMID_MODE) err = RunPyramidPipeline(im0, im1);
+	// The SGM kernels are only in RunOpenCLPipeline
+	else if (USE_OPENCL) err = OPENCL_DEVICE_RESIDENT && !SGM_AGGREGATION ? RunOpenCLPipelineResident(im0, im1, OPENCL_OUTPUTS) : RunOpenCLPipeline(im0, im1);
+	else err = RunCPUPipeline(im0, im1);
+	if (err) return err;
 
 	printf("DONE!\n");
 	getchar();